@@ -0,0 +1,136 @@
+/**
+ * @file blocking_pool.cc
+ * @brief 阻塞调用线程池实现
+ * @version 0.1
+ * @date 2021-06-21
+ */
+
+#include "blocking_pool.h"
+#include <errno.h>
+#include "config.h"
+#include "log.h"
+#include "scheduler.h"
+#include "util.h"
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_blocking_pool_threads =
+    Config::Lookup<uint32_t>("blocking_pool.threads", 4, "blocking call thread pool size, 0 means run on io threads");
+
+BlockingPool::BlockingPool(size_t threads, const std::string &name)
+    : m_name(name) {
+    for (size_t i = 0; i < threads; ++i) {
+        m_threads.push_back(std::make_shared<Thread>(std::bind(&BlockingPool::work, this),
+                                                     m_name + "_" + std::to_string(i)));
+    }
+}
+
+BlockingPool::~BlockingPool() {
+    stop();
+}
+
+void BlockingPool::stop() {
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_stopping) {
+            return;
+        }
+        m_stopping = true;
+    }
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_sem.notify();
+    }
+    for (auto &i : m_threads) {
+        i->join();
+    }
+}
+
+void BlockingPool::submit(Job &job) {
+    Scheduler *scheduler = Scheduler::GetThis();
+    Fiber::ptr fiber;
+    if (scheduler && !m_threads.empty()) {
+        fiber = Fiber::GetThis();
+    }
+    // 调度协程自己不能挂起
+    if (!fiber || fiber.get() == Scheduler::GetMainFiber()) {
+        job.call(job.arg);
+        return;
+    }
+
+    job.scheduler = scheduler;
+    job.thread    = GetThreadId();
+    job.fiber     = fiber;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_stopping) {
+            lock.unlock();
+            job.fiber.reset();
+            job.call(job.arg);
+            return;
+        }
+        // 协程不在调度器的任何队列里，要让调度器等它回来再停止
+        scheduler->addExternalWait();
+        if (m_tail) {
+            m_tail->next = &job;
+        } else {
+            m_head = &job;
+        }
+        m_tail = &job;
+        size_t depth = ++m_queueDepth;
+        if (depth > m_maxQueueDepth) {
+            m_maxQueueDepth = depth;
+        }
+    }
+    ++m_submitCount;
+    m_sem.notify();
+
+    // 任务持有协程的引用，这里只留裸指针，执行完由线程池放回原来的调度线程
+    Fiber *raw_ptr = fiber.get();
+    fiber.reset();
+    raw_ptr->yield();
+    errno = job.error;
+}
+
+void BlockingPool::work() {
+    while (true) {
+        m_sem.wait();
+        Job *job = nullptr;
+        {
+            MutexType::Lock lock(m_mutex);
+            if (!m_head) {
+                if (m_stopping) {
+                    return;
+                }
+                continue;
+            }
+            job    = m_head;
+            m_head = job->next;
+            if (!m_head) {
+                m_tail = nullptr;
+            }
+        }
+        --m_queueDepth;
+        ++m_busyCount;
+        job->call(job->arg);
+        job->error = errno;
+
+        // job在挂起协程的栈上，调度之后协程随时可能恢复，之后不能再访问job
+        Fiber::ptr fiber     = std::move(job->fiber);
+        Scheduler *scheduler = job->scheduler;
+        int thread           = job->thread;
+        --m_busyCount;
+        ++m_completeCount;
+        scheduler->schedule(std::move(fiber), thread);
+        scheduler->doneExternalWait();
+    }
+}
+
+BlockingPool *BlockingPool::GetInstance() {
+    // 不回收，避免进程退出时和其他全局对象的析构顺序问题
+    static BlockingPool *s_pool = new BlockingPool(g_blocking_pool_threads->getValue());
+    return s_pool;
+}
+
+} // namespace sylar
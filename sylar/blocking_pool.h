@@ -0,0 +1,161 @@
+/**
+ * @file blocking_pool.h
+ * @brief 阻塞调用线程池
+ * @details 普通文件读写、open、stat、getaddrinfo这类调用没有就绪通知，直接在调度线程上执行会卡住这个线程上的所有协程。
+ *          hook把它们交给一个小线程池执行，调用的协程挂起，执行完之后回到原来的调度线程继续。
+ *          线程数由blocking_pool.threads配置，为0时不转移，直接在调度线程执行
+ * @version 0.1
+ * @date 2021-06-21
+ */
+
+#ifndef __SYLAR_BLOCKING_POOL_H__
+#define __SYLAR_BLOCKING_POOL_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "fiber.h"
+#include "noncopyable.h"
+#include "thread.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 阻塞调用线程池
+ */
+class BlockingPool : Noncopyable {
+public:
+    typedef std::shared_ptr<BlockingPool> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数，立即启动线程
+     * @param[in] threads 线程数，为0时run直接在当前线程执行
+     * @param[in] name 线程名称前缀
+     */
+    BlockingPool(size_t threads, const std::string &name = "blocking");
+
+    /**
+     * @brief 析构函数，停止并等待所有线程退出
+     */
+    ~BlockingPool();
+
+    /**
+     * @brief 在线程池里执行fn，当前协程挂起，执行完后在原来的调度线程上恢复
+     * @details 不在调度器的协程里调用、线程池为空或者已经停止时直接在当前线程执行。
+     *          fn里设置的errno会带回调用方。任务放在当前协程的栈上，不分配内存
+     */
+    template <class F>
+    void run(F &&fn) {
+        Job job;
+        job.call = &Job::Invoke<typename std::remove_reference<F>::type>;
+        job.arg  = (void *)&fn;
+        submit(job);
+    }
+
+    /**
+     * @brief 停止线程池，已经提交的任务执行完再退出
+     */
+    void stop();
+
+    /**
+     * @brief 线程数
+     */
+    size_t getThreadCount() const { return m_threads.size(); }
+
+    /**
+     * @brief 排队等待执行的任务数
+     */
+    size_t getQueueDepth() const { return m_queueDepth; }
+
+    /**
+     * @brief 历史上最大的排队任务数
+     */
+    size_t getMaxQueueDepth() const { return m_maxQueueDepth; }
+
+    /**
+     * @brief 正在执行任务的线程数
+     */
+    size_t getBusyCount() const { return m_busyCount; }
+
+    /**
+     * @brief 交给线程池执行的任务总数，不包括直接在调用线程执行的
+     */
+    uint64_t getSubmitCount() const { return m_submitCount; }
+
+    /**
+     * @brief 执行完成的任务总数
+     */
+    uint64_t getCompleteCount() const { return m_completeCount; }
+
+    /**
+     * @brief 全局线程池，第一次使用时按blocking_pool.threads创建，进程退出时不回收
+     */
+    static BlockingPool *GetInstance();
+
+private:
+    /**
+     * @brief 一个阻塞调用，放在挂起协程的栈上
+     */
+    struct Job {
+        /// 执行函数和参数
+        void (*call)(void *) = nullptr;
+        void *arg            = nullptr;
+        /// 执行完之后设置的errno
+        int error = 0;
+        /// 挂起的协程和它所在的调度器、线程
+        Fiber::ptr fiber;
+        Scheduler *scheduler = nullptr;
+        int thread           = -1;
+        /// 队列的下一个
+        Job *next = nullptr;
+
+        template <class F>
+        static void Invoke(void *arg) {
+            (*(F *)arg)();
+        }
+    };
+
+    /**
+     * @brief 提交任务并挂起当前协程，不能转移时直接执行
+     */
+    void submit(Job &job);
+
+    /**
+     * @brief 线程池线程的执行函数
+     */
+    void work();
+
+private:
+    /// 线程名称前缀
+    std::string m_name;
+    /// 线程
+    std::vector<Thread::ptr> m_threads;
+    /// 保护任务队列
+    MutexType m_mutex;
+    /// 有任务或者停止时通知
+    Semaphore m_sem;
+    /// 任务队列，先进先出
+    Job *m_head = nullptr;
+    Job *m_tail = nullptr;
+    /// 是否停止
+    bool m_stopping = false;
+    /// 排队任务数
+    std::atomic<size_t> m_queueDepth{0};
+    /// 最大排队任务数
+    std::atomic<size_t> m_maxQueueDepth{0};
+    /// 正在执行任务的线程数
+    std::atomic<size_t> m_busyCount{0};
+    /// 提交的任务总数
+    std::atomic<uint64_t> m_submitCount{0};
+    /// 完成的任务总数
+    std::atomic<uint64_t> m_completeCount{0};
+};
+
+} // namespace sylar
+
+#endif
@@ -1,7 +1,7 @@
 /**
  * @file fd_manager.cc
  * @brief 文件句柄管理类实现
- * @details 只管理socket fd，记录fd是否为socket，用户是否设置非阻塞，系统是否设置非阻塞，send/recv超时时间
+ * @details 管理socket fd和hook的open打开的文件，记录fd是否为socket、是否普通文件，用户是否设置非阻塞，系统是否设置非阻塞，send/recv超时时间
  *          提供FdManager单例和get/del方法，用于创建/获取/删除fd
  * @version 0.1
  * @date 2021-06-21
@@ -17,16 +17,22 @@ namespace sylar {
 FdCtx::FdCtx(int fd)
     :m_isInit(false)
     ,m_isSocket(false)
+    ,m_isFile(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
     ,m_isClosed(false)
     ,m_fd(fd)
     ,m_recvTimeout(-1)
     ,m_sendTimeout(-1) {
-    init();
 }
 
 FdCtx::~FdCtx() {
+    FdEventSlot* slot = m_eventSlots.load(std::memory_order_relaxed);
+    while(slot) {
+        FdEventSlot* next = slot->next;
+        delete slot;
+        slot = next;
+    }
 }
 
 bool FdCtx::init() {
@@ -40,9 +46,11 @@ bool FdCtx::init() {
     if(-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isFile = false;
     } else {
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        m_isFile = S_ISREG(fd_stat.st_mode);
     }
 
     if(m_isSocket) {
@@ -77,40 +85,79 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+    FdCtx* ctx = lookup(fd);
+    if(ctx || !auto_create) {
+        // 别名构造，不持有所有权
+        return FdCtx::ptr(FdCtx::ptr(), ctx);
+    }
+
+    RWMutexType::WriteLock lock(m_mutex);
+    ctx = m_datas.getOrCreate(fd, [fd]() {
+        return new FdCtx(fd);
+    });
+    if(!ctx) {
         return nullptr;
     }
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
-        }
-    } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
-        }
+    if(!ctx->m_live.load(std::memory_order_relaxed)) {
+        // 新建的，或者复用之前关闭的fd留下的FdCtx，检查类型
+        ctx->m_isInit = false;
+        ctx->init();
+        ctx->m_live.store(true, std::memory_order_release);
     }
-    lock.unlock();
+    return FdCtx::ptr(FdCtx::ptr(), ctx);
+}
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+void FdManager::del(int fd) {
+    FdCtx* ctx = m_datas.get(fd);
+    if(!ctx) {
+        return;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    if(ctx->m_live.load(std::memory_order_relaxed)) {
+        ctx->m_generation.fetch_add(1, std::memory_order_release);
+        ctx->m_live.store(false, std::memory_order_release);
     }
-    m_datas[fd] = ctx;
-    return ctx;
 }
 
-void FdManager::del(int fd) {
+FdEventSlot* FdManager::getEventSlot(int fd, uint64_t owner, const std::function<FdEventSlot*()>& create) {
+    FdEventSlot* slot = findEventSlot(fd, owner);
+    if(slot) {
+        return slot;
+    }
+    // 每个fd每个IOManager只创建一次，加锁保证同一个IOManager的多个线程拿到的是同一个
     RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        return;
+    FdCtx* ctx = m_datas.getOrCreate(fd, [fd]() {
+        return new FdCtx(fd);
+    });
+    if(!ctx) {
+        return nullptr;
     }
-    m_datas[fd].reset();
+    FdEventSlot* head = ctx->m_eventSlots.load(std::memory_order_acquire);
+    for(slot = head; slot; slot = slot->next) {
+        uint64_t expected = 0;
+        if(slot->owner.load(std::memory_order_acquire) == owner
+                || slot->owner.compare_exchange_strong(expected, owner)) {
+            return slot;
+        }
+    }
+    slot = create();
+    slot->owner.store(owner, std::memory_order_relaxed);
+    slot->next = head;
+    ctx->m_eventSlots.store(slot, std::memory_order_release);
+    return slot;
+}
+
+void FdManager::releaseEventSlots(uint64_t owner, const std::function<void(FdEventSlot*)>& reset) {
+    m_datas.forEach([owner, &reset](int fd, FdCtx* ctx) {
+        FdEventSlot* slot = ctx->findEventSlot(owner);
+        if(slot) {
+            reset(slot);
+            slot->owner.store(0, std::memory_order_release);
+        }
+    });
 }
 
 }
@@ -9,23 +9,43 @@
 #ifndef __FD_MANAGER_H__
 #define __FD_MANAGER_H__
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
+#include <sys/socket.h>
 #include "thread.h"
 #include "singleton.h"
+#include "timer.h"
+#include "fd_table.h"
 
 namespace sylar {
 
+/**
+ * @brief 挂在FdCtx上的IOManager事件上下文的基类
+ * @details 每个在这个fd上等待过事件的IOManager各有一个，串成单向链表，创建之后一直保留到FdManager析构。
+ *          IOManager析构时把自己的归还(owner置0)，之后创建的IOManager可以接着用
+ */
+struct FdEventSlot {
+    virtual ~FdEventSlot() {}
+    /// 所属IOManager的编号，0表示空闲
+    std::atomic<uint64_t> owner{0};
+    /// 链表的下一个，放进链表之后不再修改
+    FdEventSlot* next = nullptr;
+};
+
 /**
  * @brief 文件句柄上下文类
  * @details 管理文件句柄类型(是否socket)
  *          是否阻塞,是否关闭,读/写超时时间
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx {
+friend class FdManager;
 public:
     typedef std::shared_ptr<FdCtx> ptr;
     /**
      * @brief 通过文件句柄构造FdCtx
+     * @details 这时还不检查fd，FdManager::get登记时才初始化
      */
     FdCtx(int fd);
     /**
@@ -43,6 +63,11 @@ public:
      */
     bool isSocket() const { return m_isSocket;}
 
+    /**
+     * @brief 是否普通文件，hook的读写交给阻塞调用线程池执行
+     */
+    bool isFile() const { return m_isFile;}
+
     /**
      * @brief 是否已关闭
      */
@@ -83,6 +108,37 @@ public:
      * @return 超时时间毫秒
      */
     uint64_t getTimeout(int type);
+
+    /**
+     * @brief 获取读或写方向等待超时用的定时器，每次阻塞时重新启用，避免每次都创建
+     * @param[in] type 类型SO_RCVTIMEO(读超时), SO_SNDTIMEO(写超时)
+     * @return 定时器的引用，还没创建过时为空
+     */
+    Timer::ptr& getTimeoutTimer(int type) { return type == SO_RCVTIMEO ? m_recvTimer : m_sendTimer;}
+
+    /**
+     * @brief 文件句柄
+     */
+    int getFd() const { return m_fd;}
+
+    /**
+     * @brief fd关闭的次数
+     * @details FdCtx在fd关闭之后留给同一个fd复用，跨过挂起点持有FdCtx时先记下它，
+     *          再用的时候不相等说明中间fd被关闭过，拿到的已经是别人的了
+     */
+    uint32_t getGeneration() const { return m_generation.load(std::memory_order_acquire);}
+
+    /**
+     * @brief 不加锁查找owner的事件上下文，没有时返回nullptr
+     */
+    FdEventSlot* findEventSlot(uint64_t owner) const {
+        for(FdEventSlot* i = m_eventSlots.load(std::memory_order_acquire); i; i = i->next) {
+            if(i->owner.load(std::memory_order_acquire) == owner) {
+                return i;
+            }
+        }
+        return nullptr;
+    }
 private:
     /**
      * @brief 初始化
@@ -93,6 +149,8 @@ private:
     bool m_isInit: 1;
     /// 是否socket
     bool m_isSocket: 1;
+    /// 是否普通文件
+    bool m_isFile: 1;
     /// 是否hook非阻塞
     bool m_sysNonblock: 1;
     /// 是否用户主动设置非阻塞
@@ -105,6 +163,16 @@ private:
     uint64_t m_recvTimeout;
     /// 写超时时间毫秒
     uint64_t m_sendTimeout;
+    /// 读超时定时器
+    Timer::ptr m_recvTimer;
+    /// 写超时定时器
+    Timer::ptr m_sendTimer;
+    /// fd是否打开着，关闭之后FdCtx留给同一个fd复用
+    std::atomic<bool> m_live{false};
+    /// fd关闭的次数
+    std::atomic<uint32_t> m_generation{0};
+    /// IOManager的事件上下文链表，只在头部插入，不删除
+    std::atomic<FdEventSlot*> m_eventSlots{nullptr};
 };
 
 /**
@@ -120,22 +188,61 @@ public:
 
     /**
      * @brief 获取/创建文件句柄类FdCtx
+     * @details FdCtx由FdManager持有，fd关闭之后保留给同一个fd复用，返回的智能指针是不持有所有权的别名，
+     *          复制时也没有引用计数的开销。指针在FdManager析构之前一直有效，但fd关闭又打开之后指向的是新fd的状态，
+     *          跨过挂起点使用时要用FdCtx::getGeneration确认fd没有被关闭过
      * @param[in] fd 文件句柄
      * @param[in] auto_create 是否自动创建
      * @return 返回对应文件句柄类FdCtx::ptr
      */
     FdCtx::ptr get(int fd, bool auto_create = false);
 
+    /**
+     * @brief 不加锁获取fd的FdCtx，hook的热路径使用
+     * @details FdCtx在FdManager析构之前不会释放，返回的指针一直有效
+     * @return fd没有登记或者已经关闭时返回nullptr
+     */
+    FdCtx* lookup(int fd) const {
+        FdCtx* ctx = m_datas.get(fd);
+        return (ctx && ctx->m_live.load(std::memory_order_acquire)) ? ctx : nullptr;
+    }
+
     /**
      * @brief 删除文件句柄类
+     * @details FdCtx标记为关闭并增加关闭次数，留给同一个fd复用
      * @param[in] fd 文件句柄
      */
     void del(int fd);
+
+    /**
+     * @brief 获取fd上属于owner的IOManager事件上下文，没有时先复用空闲的，再用create创建
+     * @details IOManager的事件上下文和FdCtx共用一张表，没有经过hook登记的fd在表里占一个没有打开的FdCtx
+     * @param[in] owner IOManager的编号
+     * @param[in] create 创建新的事件上下文
+     * @return fd超出范围时返回nullptr
+     */
+    FdEventSlot* getEventSlot(int fd, uint64_t owner, const std::function<FdEventSlot*()>& create);
+
+    /**
+     * @brief 不加锁查找fd上属于owner的事件上下文
+     * @return 没有时返回nullptr
+     */
+    FdEventSlot* findEventSlot(int fd, uint64_t owner) const {
+        FdCtx* ctx = m_datas.get(fd);
+        return ctx ? ctx->findEventSlot(owner) : nullptr;
+    }
+
+    /**
+     * @brief IOManager析构时归还它的全部事件上下文
+     * @param[in] owner IOManager的编号
+     * @param[in] reset 归还之前调用，清理事件上下文的状态
+     */
+    void releaseEventSlots(uint64_t owner, const std::function<void(FdEventSlot*)>& reset);
 private:
-    /// 读写锁
+    /// 创建和删除时加锁，读取不加锁
     RWMutexType m_mutex;
-    /// 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    /// 文件句柄集合，IOManager的事件上下文也挂在这里
+    FdTable<FdCtx> m_datas;
 };
 
 /// 文件句柄单例
@@ -0,0 +1,142 @@
+/**
+ * @file fd_table.h
+ * @brief 按fd下标的分块表
+ * @details FdManager的fd表，IOManager的事件上下文挂在表项FdCtx上，两者共用这一张表。
+ *          两级数组，第一级固定大小，第二级按块在第一次用到时分配，分配之后地址不再变化，也不会整体扩容搬迁，所以读取不需要加锁。表里的对象一旦创建就一直保留到表析构，
+ *          fd关闭之后由使用方自己标记、复用，拿到的裸指针在表的生命周期内总是有效的
+ * @version 0.1
+ * @date 2021-06-21
+ */
+
+#ifndef __SYLAR_FD_TABLE_H__
+#define __SYLAR_FD_TABLE_H__
+
+#include <atomic>
+#include <stddef.h>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief fd分块表
+ * @tparam T 表项类型，表析构时delete
+ */
+template <class T>
+class FdTable : Noncopyable {
+public:
+    /// 每块的表项数
+    static const size_t CHUNK_BITS = 12;
+    static const size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    /// 块数，最多支持CHUNK_COUNT * CHUNK_SIZE个fd，与fs.nr_open的默认上限一致
+    static const size_t CHUNK_COUNT = 256;
+    static const size_t MAX_FDS     = CHUNK_COUNT * CHUNK_SIZE;
+
+    FdTable() {
+        for (auto &i : m_chunks) {
+            i.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable() {
+        for (auto &i : m_chunks) {
+            Chunk *chunk = i.load(std::memory_order_relaxed);
+            if (!chunk) {
+                continue;
+            }
+            for (auto &j : chunk->slots) {
+                delete j.load(std::memory_order_relaxed);
+            }
+            delete chunk;
+        }
+    }
+
+    /**
+     * @brief 无锁读取fd的表项
+     * @return 不存在或者超出范围时返回nullptr
+     */
+    T *get(int fd) const {
+        if (fd < 0 || (size_t)fd >= MAX_FDS) {
+            return nullptr;
+        }
+        Chunk *chunk = m_chunks[fd >> CHUNK_BITS].load(std::memory_order_acquire);
+        if (!chunk) {
+            return nullptr;
+        }
+        return chunk->slots[fd & (CHUNK_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 获取fd的表项，不存在时用create创建一个
+     * @details 多个线程同时创建时只有一个放进表里，其他线程创建的被删除，返回表里的那个
+     * @param[in] create 返回new出来的表项
+     * @return 超出范围时返回nullptr
+     */
+    template <class F>
+    T *getOrCreate(int fd, F create) {
+        T *v = get(fd);
+        if (v || fd < 0 || (size_t)fd >= MAX_FDS) {
+            return v;
+        }
+        std::atomic<T *> &slot = getChunk(fd >> CHUNK_BITS)->slots[fd & (CHUNK_SIZE - 1)];
+        T *expected = nullptr;
+        v           = create();
+        if (!slot.compare_exchange_strong(expected, v, std::memory_order_acq_rel)) {
+            delete v;
+            return expected;
+        }
+        return v;
+    }
+
+    /**
+     * @brief 遍历所有已经创建的表项
+     */
+    template <class F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < CHUNK_COUNT; ++i) {
+            Chunk *chunk = m_chunks[i].load(std::memory_order_acquire);
+            if (!chunk) {
+                continue;
+            }
+            for (size_t j = 0; j < CHUNK_SIZE; ++j) {
+                T *v = chunk->slots[j].load(std::memory_order_acquire);
+                if (v) {
+                    f((int)(i * CHUNK_SIZE + j), v);
+                }
+            }
+        }
+    }
+
+private:
+    struct Chunk {
+        Chunk() {
+            for (auto &i : slots) {
+                i.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        std::atomic<T *> slots[CHUNK_SIZE];
+    };
+
+    /**
+     * @brief 获取第index块，不存在时分配
+     */
+    Chunk *getChunk(size_t index) {
+        Chunk *chunk = m_chunks[index].load(std::memory_order_acquire);
+        if (chunk) {
+            return chunk;
+        }
+        Chunk *fresh = new Chunk;
+        if (!m_chunks[index].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+            delete fresh;
+            return chunk;
+        }
+        return fresh;
+    }
+
+private:
+    /// 第一级数组，元素只会从nullptr变成分配好的块
+    std::atomic<Chunk *> m_chunks[CHUNK_COUNT];
+};
+
+} // namespace sylar
+
+#endif
@@ -6,6 +6,8 @@
  */
 
 #include <atomic>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "fiber.h"
 #include "config.h"
 #include "log.h"
@@ -30,16 +32,189 @@ static thread_local Fiber::ptr t_thread_fiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
+//每个线程最多缓存的空闲协程栈数量，为0表示不缓存
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_max_count =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_count", 64, "max cached fiber stacks per thread");
+
+//所有线程合计最多缓存的空闲协程栈数量，为0表示只受每线程上限约束
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_max_total =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_total", 0, "max cached fiber stacks of all threads");
+
+static uint32_t s_fiber_stack_size           = 0;
+static uint32_t s_fiber_stack_pool_max_count = 0;
+static uint32_t s_fiber_stack_pool_max_total = 0;
+
+namespace {
+struct _FiberStackIniter {
+    _FiberStackIniter() {
+        s_fiber_stack_size           = g_fiber_stack_size->getValue();
+        s_fiber_stack_pool_max_count = g_fiber_stack_pool_max_count->getValue();
+        s_fiber_stack_pool_max_total = g_fiber_stack_pool_max_total->getValue();
+
+        g_fiber_stack_size->addListener(
+            [](const uint32_t &ov, const uint32_t &nv) {
+                s_fiber_stack_size = nv;
+            });
+
+        g_fiber_stack_pool_max_count->addListener(
+            [](const uint32_t &ov, const uint32_t &nv) {
+                s_fiber_stack_pool_max_count = nv;
+            });
+
+        g_fiber_stack_pool_max_total->addListener(
+            [](const uint32_t &ov, const uint32_t &nv) {
+                s_fiber_stack_pool_max_total = nv;
+            });
+    }
+};
+static _FiberStackIniter _init;
+} // namespace
+
+/// 全局静态变量，栈池命中次数
+static std::atomic<uint64_t> s_stack_pool_hit{0};
+/// 全局静态变量，栈池未命中次数
+static std::atomic<uint64_t> s_stack_pool_miss{0};
+/// 全局静态变量，所有线程缓存的空闲栈总数
+static std::atomic<uint32_t> s_stack_pool_total{0};
+
+/**
+ * @brief 空闲栈链表节点，直接存放在空闲栈的内存里，不需要额外分配
+ */
+struct FreeStack {
+    FreeStack *next;
+};
+
+/**
+ * @brief 线程局部的空闲栈链表
+ * @note 只用POD类型，保证线程退出时其他thread_local对象析构过程中释放协程栈仍然安全
+ */
+struct StackPool {
+    /// 链表头
+    FreeStack *head;
+    /// 链表中栈的数量
+    uint32_t count;
+    /// 链表中每个栈的大小（已按页对齐）
+    size_t size;
+    /// 线程已退出，不再缓存
+    bool exited;
+};
+
+static thread_local StackPool t_stack_pool = {nullptr, 0, 0, false};
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+static size_t AlignStackSize(size_t size) {
+    size_t page = GetPageSize();
+    return (size + page - 1) / page * page;
+}
+
+static void *MapStack(size_t size) {
+    size_t page = GetPageSize();
+    void *base  = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    SYLAR_ASSERT2(base != MAP_FAILED, "mmap fiber stack");
+    // 栈向低地址增长，保护页放在最低的一页
+    int rt = mprotect(base, page, PROT_NONE);
+    SYLAR_ASSERT2(rt == 0, "mprotect fiber stack guard page");
+    return (char *)base + page;
+}
+
+static void UnmapStack(void *vp, size_t size) {
+    size_t page = GetPageSize();
+    munmap((char *)vp - page, size + page);
+}
+
+static void DrainStackPool(StackPool &pool) {
+    while (pool.head) {
+        FreeStack *fs = pool.head;
+        pool.head     = fs->next;
+        UnmapStack(fs, pool.size);
+    }
+    s_stack_pool_total.fetch_sub(pool.count, std::memory_order_relaxed);
+    pool.count = 0;
+}
+
 /**
- * @brief malloc栈内存分配器
+ * @brief 占用一个全局缓存名额，超过fiber.stack_pool.max_total时返回false
  */
-class MallocStackAllocator {
-public:
-    static void *Alloc(size_t size) { return malloc(size); }
-    static void Dealloc(void *vp, size_t size) { return free(vp); }
+static bool ReserveStackSlot() {
+    uint32_t max_total = s_fiber_stack_pool_max_total;
+    uint32_t total     = s_stack_pool_total.fetch_add(1, std::memory_order_relaxed);
+    if (max_total && total >= max_total) {
+        s_stack_pool_total.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 线程退出时归还缓存的栈
+ */
+struct StackPoolReaper {
+    ~StackPoolReaper() {
+        DrainStackPool(t_stack_pool);
+        t_stack_pool.exited = true;
+    }
+    /// 首次缓存栈时置位，确保本线程的reaper被构造，从而在线程退出时析构
+    bool armed = false;
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local StackPoolReaper t_stack_pool_reaper;
+
+/**
+ * @brief fiber.stack_size变化之后，丢掉旧尺寸的缓存栈
+ * @return 现在缓存的栈尺寸
+ */
+static size_t RefreshStackPool(StackPool &pool) {
+    size_t size = AlignStackSize(s_fiber_stack_size);
+    if (pool.head && pool.size != size) {
+        DrainStackPool(pool);
+    }
+    return size;
+}
+
+void *StackAllocator::Alloc(size_t size) {
+    size            = AlignStackSize(size);
+    StackPool &pool = t_stack_pool;
+    // 自定义尺寸的栈不从缓存取，也不会清掉缓存
+    if (RefreshStackPool(pool) == size && pool.head) {
+        FreeStack *fs = pool.head;
+        pool.head     = fs->next;
+        --pool.count;
+        s_stack_pool_total.fetch_sub(1, std::memory_order_relaxed);
+        s_stack_pool_hit.fetch_add(1, std::memory_order_relaxed);
+        return fs;
+    }
+    s_stack_pool_miss.fetch_add(1, std::memory_order_relaxed);
+    return MapStack(size);
+}
+
+void StackAllocator::Dealloc(void *vp, size_t size) {
+    size            = AlignStackSize(size);
+    StackPool &pool = t_stack_pool;
+    if (!pool.exited && RefreshStackPool(pool) == size && pool.count < s_fiber_stack_pool_max_count
+            && ReserveStackSlot()) {
+        t_stack_pool_reaper.armed = true;
+        FreeStack *fs = static_cast<FreeStack *>(vp);
+        fs->next      = pool.head;
+        pool.head     = fs;
+        pool.size     = size;
+        ++pool.count;
+        return;
+    }
+    UnmapStack(vp, size);
+}
+
+uint64_t StackAllocator::GetHitCount() {
+    return s_stack_pool_hit.load(std::memory_order_relaxed);
+}
+
+uint64_t StackAllocator::GetMissCount() {
+    return s_stack_pool_miss.load(std::memory_order_relaxed);
+}
 
 uint64_t Fiber::GetFiberId() {
     if (t_fiber) {
@@ -52,10 +227,6 @@ Fiber::Fiber() {
     SetThis(this);
     m_state = RUNNING;
 
-    if (getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
-    }
-
     ++s_fiber_count;
     m_id = s_fiber_id++; // 协程id从0开始，用完加1
 
@@ -83,23 +254,15 @@ Fiber::ptr Fiber::GetThis() {
 /**
  * 带参数的构造函数用于创建其他协程，需要分配栈
  */
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(InlineFunction cb, size_t stacksize, bool run_in_scheduler)
     : m_id(s_fiber_id++)
-    , m_cb(cb)
+    , m_cb(std::move(cb))
     , m_runInScheduler(run_in_scheduler) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+    m_stacksize = stacksize ? stacksize : s_fiber_stack_size;
     m_stack     = StackAllocator::Alloc(m_stacksize);
 
-    if (getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
-    }
-
-    m_ctx.uc_link          = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() id = " << m_id;
 }
@@ -130,20 +293,13 @@ Fiber::~Fiber() {
 /**
  * 这里为了简化状态管理，强制只有TERM状态的协程才可以重置，但其实刚创建好但没执行过的协程也应该允许重置的
  */
-void Fiber::reset(std::function<void()> cb) {
+void Fiber::reset(InlineFunction cb) {
     SYLAR_ASSERT(m_stack);
     SYLAR_ASSERT(m_state == TERM);
-    m_cb = cb;
-    if (getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
-    }
-
-    m_ctx.uc_link          = nullptr;
-    m_ctx.uc_stack.ss_sp   = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = READY;
+    m_cb = std::move(cb);
+    m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
+    m_state  = READY;
+    m_thread = -1;
 }
 
 void Fiber::resume() {
@@ -153,34 +309,29 @@ void Fiber::resume() {
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
-        if (swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx);
     } else {
-        if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&(t_thread_fiber->m_ctx), &m_ctx);
+    }
+
+    // 回到这里时协程的上下文已经完整保存，这时才把状态改成READY。如果在yield里切换之前就改，
+    // 其他线程可能在上下文保存完之前就resume它，调度器看到RUNNING状态的协程会暂缓调度
+    if (m_state != TERM) {
+        m_state = READY;
     }
 }
 
 void Fiber::yield() {
     /// 协程运行完之后会自动yield一次，用于回到主协程，此时状态已为结束状态
     SYLAR_ASSERT(m_state == RUNNING || m_state == TERM);
-    if (m_state != TERM) {
-        m_state = READY;
-    }
 
     // 如果协程参与调度器调度，那么应该和调度器的主协程进行swap，而不是线程主协程
     if (m_runInScheduler) {
         SetThis(Scheduler::GetMainFiber());
-        if (swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx))) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx));
     } else {
         SetThis(t_thread_fiber.get());
-        if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx))) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        FiberContext::Swap(&m_ctx, &(t_thread_fiber->m_ctx));
     }
 }
 
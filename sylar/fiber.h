@@ -1,7 +1,7 @@
 /**
  * @file fiber.h
  * @brief 协程模块
- * @details 基于ucontext_t实现，非对称协程
+ * @details 非对称协程，上下文切换由FiberContext实现，可在编译时选择手写汇编或ucontext_t
  * @version 0.1
  * @date 2021-06-15
  */
@@ -11,11 +11,45 @@
 
 #include <functional>
 #include <memory>
-#include <ucontext.h>
+#include "fiber_context.h"
+#include "inline_function.h"
 #include "thread.h"
 
 namespace sylar {
 
+/**
+ * @brief 协程栈分配器
+ * @details 栈内存通过mmap分配，并在栈的低地址端额外映射一个PROT_NONE保护页，栈溢出时直接触发SIGSEGV，
+ * 而不是悄悄踩坏相邻内存。释放的栈优先放回线程局部的空闲链表，同一线程再创建协程时直接复用，
+ * 空闲链表的容量由fiber.stack_pool.max_count配置，只缓存大小等于fiber.stack_size的栈
+ */
+class StackAllocator {
+public:
+    /**
+     * @brief 分配协程栈
+     * @param[in] size 栈大小，会向上取整到页大小
+     * @return 栈的可用内存起始地址（保护页之上）
+     */
+    static void *Alloc(size_t size);
+
+    /**
+     * @brief 释放协程栈，优先放回当前线程的空闲链表
+     * @param[in] vp Alloc返回的地址
+     * @param[in] size 分配时传入的栈大小
+     */
+    static void Dealloc(void *vp, size_t size);
+
+    /**
+     * @brief 从空闲链表中直接取到栈的次数
+     */
+    static uint64_t GetHitCount();
+
+    /**
+     * @brief 空闲链表为空，需要重新mmap的次数
+     */
+    static uint64_t GetMissCount();
+};
+
 /**
  * @brief 协程类
  */
@@ -53,7 +87,7 @@ public:
      * @param[in] stacksize 栈大小
      * @param[in] run_in_scheduler 本协程是否参与调度器调度，默认为true
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+    Fiber(InlineFunction cb, size_t stacksize = 0, bool run_in_scheduler = true);
 
     /**
      * @brief 析构函数
@@ -64,7 +98,7 @@ public:
      * @brief 重置协程状态和入口函数，复用栈空间，不重新创建栈
      * @param[in] cb 
      */
-    void reset(std::function<void()> cb);
+    void reset(InlineFunction cb);
 
     /**
      * @brief 将当前协程切到到执行状态
@@ -88,6 +122,17 @@ public:
      */
     State getState() const { return m_state; }
 
+    /**
+     * @brief 协程绑定的调度线程，-1表示不绑定
+     * @details 绑定之后协程挂起再被IO事件、定时器唤醒时，没有指定线程的话仍然回到这个线程；reset时解除绑定
+     */
+    int getThread() const { return m_thread; }
+
+    /**
+     * @brief 设置协程绑定的调度线程
+     */
+    void setThread(int thread) { m_thread = thread; }
+
 public:
     /**
      * @brief 设置当前正在运行的协程，即设置线程局部变量t_fiber的值
@@ -125,12 +170,14 @@ private:
     uint32_t m_stacksize = 0;
     /// 协程状态
     State m_state        = READY;
+    /// 绑定的调度线程
+    int m_thread         = -1;
     /// 协程上下文
-    ucontext_t m_ctx;
+    FiberContext m_ctx;
     /// 协程栈地址
     void *m_stack = nullptr;
     /// 协程入口函数
-    std::function<void()> m_cb;
+    InlineFunction m_cb;
     /// 本协程是否参与调度器调度
     bool m_runInScheduler;
 };
@@ -0,0 +1,165 @@
+/**
+ * @file fiber_context.cc
+ * @brief 协程上下文切换实现
+ * @version 0.1
+ * @date 2021-06-15
+ */
+
+#include <stdint.h>
+#include "fiber_context.h"
+#include "macro.h"
+
+namespace sylar {
+
+void UContext::make(void *stack, size_t size, void (*fn)()) {
+    if (getcontext(&m_ctx)) {
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+
+    m_ctx.uc_link          = nullptr;
+    m_ctx.uc_stack.ss_sp   = stack;
+    m_ctx.uc_stack.ss_size = size;
+
+    makecontext(&m_ctx, fn, 0);
+}
+
+void UContext::Swap(UContext *from, UContext *to) {
+    if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+}
+
+#ifdef SYLAR_HAS_ASM_CONTEXT
+
+extern "C" void sylar_context_entry();
+
+#if defined(__x86_64__)
+
+/**
+ * System V AMD64 ABI的callee-saved寄存器为rbx/rbp/r12-r15，另外MXCSR的控制位和x87控制字也要求由被调用者保存。
+ * 切出时栈上的布局（低地址在前）：
+ *   [0]  mxcsr     [4]  x87 cw     [8]  未使用
+ *   [16] r12  [24] r13  [32] r14  [40] r15  [48] rbx  [56] rbp  [64] 返回地址
+ */
+asm(R"(
+    .text
+    .globl sylar_context_swap
+    .type sylar_context_swap, @function
+    .align 16
+sylar_context_swap:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $16, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $16, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size sylar_context_swap, .-sylar_context_swap
+
+    .globl sylar_context_entry
+    .type sylar_context_entry, @function
+    .align 16
+sylar_context_entry:
+    callq *%r12
+    ud2
+    .size sylar_context_entry, .-sylar_context_entry
+)");
+
+void AsmContext::make(void *stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    // 第一次切进来时ret到sylar_context_entry，此时rsp = top - 16，满足call之前16字节对齐的要求
+    uint64_t *sp = (uint64_t *)(top - 88);
+    uint32_t *fp = (uint32_t *)sp;
+    fp[0]        = 0x1F80; // MXCSR默认值
+    fp[1]        = 0x037F; // x87控制字默认值
+    sp[1]        = 0;
+    sp[2]        = (uint64_t)fn; // r12
+    sp[3]        = 0;            // r13
+    sp[4]        = 0;            // r14
+    sp[5]        = 0;            // r15
+    sp[6]        = 0;            // rbx
+    sp[7]        = 0;            // rbp
+    sp[8]        = (uint64_t)&sylar_context_entry;
+    m_sp         = sp;
+}
+
+#elif defined(__aarch64__)
+
+/**
+ * AAPCS64的callee-saved寄存器为x19-x28、x29(fp)、x30(lr)以及d8-d15，栈帧大小176字节，保持16字节对齐。
+ * 切出时栈上的布局：
+ *   [0-72] x19-x28  [80] x29  [88] x30  [96-152] d8-d15
+ */
+asm(R"(
+    .text
+    .globl sylar_context_swap
+    .type sylar_context_swap, %function
+    .align 4
+sylar_context_swap:
+    sub sp, sp, #176
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x2, sp
+    str x2, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #176
+    ret
+    .size sylar_context_swap, .-sylar_context_swap
+
+    .globl sylar_context_entry
+    .type sylar_context_entry, %function
+    .align 4
+sylar_context_entry:
+    blr x19
+    brk #0
+    .size sylar_context_entry, .-sylar_context_entry
+)");
+
+void AsmContext::make(void *stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t *sp  = (uint64_t *)(top - 176);
+    for (int i = 0; i < 22; ++i) {
+        sp[i] = 0;
+    }
+    sp[0]  = (uint64_t)fn;                   // x19
+    sp[11] = (uint64_t)&sylar_context_entry; // x30
+    m_sp   = sp;
+}
+
+#endif
+
+#endif
+
+} // namespace sylar
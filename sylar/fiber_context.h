@@ -0,0 +1,100 @@
+/**
+ * @file fiber_context.h
+ * @brief 协程上下文切换
+ * @details 提供两种上下文实现：基于glibc ucontext_t的UContext，以及手写汇编的AsmContext。
+ * glibc的swapcontext每次切换都会调用rt_sigprocmask保存/恢复信号掩码，AsmContext只保存ABI规定的
+ * callee-saved寄存器，不进内核。具体使用哪种由编译选项FIBER_CONTEXT决定，Fiber只依赖FiberContext
+ * @version 0.1
+ * @date 2021-06-15
+ */
+
+#ifndef __SYLAR_FIBER_CONTEXT_H__
+#define __SYLAR_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+#include <ucontext.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SYLAR_HAS_ASM_CONTEXT 1
+#endif
+
+namespace sylar {
+
+/**
+ * @brief 基于ucontext_t的协程上下文
+ */
+class UContext {
+public:
+    /**
+     * @brief 在指定栈上初始化上下文，切换进来后从fn开始执行
+     * @param[in] stack 栈内存起始地址
+     * @param[in] size 栈大小
+     * @param[in] fn 入口函数，不允许返回
+     */
+    void make(void *stack, size_t size, void (*fn)());
+
+    /**
+     * @brief 保存当前上下文到from，并切换到to
+     */
+    static void Swap(UContext *from, UContext *to);
+
+    /**
+     * @brief 实现名称
+     */
+    static const char *Name() { return "ucontext"; }
+
+private:
+    ucontext_t m_ctx;
+};
+
+#ifdef SYLAR_HAS_ASM_CONTEXT
+
+extern "C" {
+/**
+ * @brief 汇编实现的上下文切换
+ * @details 把callee-saved寄存器压到当前栈上，栈顶保存到*from_sp，然后切到to_sp并弹出对应的寄存器
+ */
+void sylar_context_swap(void **from_sp, void *to_sp);
+}
+
+/**
+ * @brief 手写汇编的协程上下文，只保存一个栈指针
+ */
+class AsmContext {
+public:
+    /**
+     * @brief 在指定栈上初始化上下文，切换进来后从fn开始执行
+     * @param[in] stack 栈内存起始地址
+     * @param[in] size 栈大小
+     * @param[in] fn 入口函数，不允许返回
+     */
+    void make(void *stack, size_t size, void (*fn)());
+
+    /**
+     * @brief 保存当前上下文到from，并切换到to
+     */
+    static void Swap(AsmContext *from, AsmContext *to) {
+        sylar_context_swap(&from->m_sp, to->m_sp);
+    }
+
+    /**
+     * @brief 实现名称
+     */
+    static const char *Name() { return "asm"; }
+
+private:
+    /// 切出时的栈顶，寄存器都保存在栈上
+    void *m_sp = nullptr;
+};
+
+#endif
+
+#if defined(SYLAR_FIBER_UCONTEXT) || !defined(SYLAR_HAS_ASM_CONTEXT)
+typedef UContext FiberContext;
+#else
+typedef AsmContext FiberContext;
+#endif
+
+} // namespace sylar
+
+#endif
@@ -6,6 +6,7 @@
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "blocking_pool.h"
 #include "macro.h"
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -23,22 +24,42 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(pread) \
+    XX(preadv) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(pwrite) \
+    XX(pwritev) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(tee) \
     XX(close) \
+    XX(open) \
+    XX(stat) \
+    XX(getaddrinfo) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
     XX(setsockopt)
 
+#ifdef SYLAR_HOOK_XSTAT
+/**
+ * @brief 老版本glibc没有导出stat，用__xstat实现原始的stat
+ */
+static int stat_by_xstat(const char *pathname, struct stat *statbuf) {
+    return __xstat_f(_STAT_VER, pathname, statbuf);
+}
+#endif
+
 void hook_init() {
     static bool is_inited = false;
     if(is_inited) {
@@ -47,6 +68,12 @@ void hook_init() {
 #define XX(name) name ## _f = (name ## _fun)dlsym(RTLD_NEXT, #name);
     HOOK_FUN(XX);
 #undef XX
+#ifdef SYLAR_HOOK_XSTAT
+    __xstat_f = (__xstat_fun)dlsym(RTLD_NEXT, "__xstat");
+    if(!stat_f) {
+        stat_f = &stat_by_xstat;
+    }
+#endif
 }
 
 static uint64_t s_connect_timeout = -1;
@@ -79,6 +106,40 @@ struct timer_info {
     int cancelled = 0;
 };
 
+/**
+ * @brief 启用fd读或写方向的超时定时器，复用FdCtx里的定时器对象，只有第一次或换了IOManager时才创建
+ * @details 回调只捕获FdCtx的地址和(关闭次数, 事件)，放得进std::function的内部存储，不分配内存。
+ *          FdCtx会被同一个fd复用，回调执行时关闭次数变了说明fd已经关闭过，可能又被别人打开，这时不处理
+ */
+static void arm_timeout(sylar::IOManager* iom, sylar::FdCtx* ctx, uint32_t event,
+        int timeout_so, uint64_t ms) {
+    uint64_t key = (uint64_t)ctx->getGeneration() << 32 | event;
+    auto cb = [ctx, key]() {
+        if(ctx->getGeneration() != (uint32_t)(key >> 32)) {
+            return;
+        }
+        sylar::IOManager::GetThis()->cancelEvent(ctx->getFd(), (sylar::IOManager::Event)(uint32_t)key);
+    };
+    sylar::Timer::ptr& timer = ctx->getTimeoutTimer(timeout_so);
+    if(!timer || !iom->rearmTimer(timer, ms, cb)) {
+        timer = iom->addTimer(ms, cb);
+    }
+}
+
+/**
+ * @brief 登记内核刚分配的fd
+ * @details 这个fd号还登记着，说明之前的fd没有经过hook的close就关掉了(fclose、dup2、直接系统调用等)，
+ *          先按关闭处理，清掉旧的FdCtx状态和IOManager里的注册、就绪状态，再登记新的
+ */
+static void register_fd(int fd) {
+    if(sylar::FdMgr::GetInstance()->lookup(fd)) {
+        sylar::FdMgr::GetInstance()->del(fd);
+    }
+    // 和关闭并发的等待可能在close清理之后又把旧文件注册进epoll，这里不管旧的FdCtx是否还在都清理一次
+    sylar::IOManager::OnFdClosed(fd);
+    sylar::FdMgr::GetInstance()->get(fd, true);
+}
+
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         uint32_t event, int timeout_so, Args&&... args) {
@@ -86,7 +147,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     if(!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -96,12 +157,24 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return -1;
     }
 
+    if(ctx->isFile()) {
+        // 普通文件总是就绪的，读写可能卡在磁盘上，交给阻塞调用线程池
+        ssize_t n = -1;
+        sylar::BlockingPool::GetInstance()->run([&]() {
+            n = fun(fd, std::forward<Args>(args)...);
+        });
+        return n;
+    }
+
     if(!ctx->isSocket() || ctx->getUserNonblock()) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    // 超时的截止时间从第一次阻塞开始算，0表示还没有阻塞过
+    uint64_t deadline = 0;
+    // 挂起期间fd可能被其他协程关闭，FdCtx会留给复用这个fd的新连接，醒来时用关闭次数判断
+    uint32_t generation = ctx->getGeneration();
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -110,22 +183,29 @@ retry:
     }
     if(n == -1 && errno == EAGAIN) {
         sylar::IOManager* iom = sylar::IOManager::GetThis();
-        sylar::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
+        sylar::Timer* timer = nullptr;
 
         if(to != (uint64_t)-1) {
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
+            // 定时器只负责把协程叫醒，醒来重试还是EAGAIN并且过了截止时间才算超时
+            uint64_t now = sylar::CoarseNowMS();
+            if(!deadline) {
+                deadline = now + to;
+            } else if(now >= deadline) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            arm_timeout(iom, ctx, event, timeout_so, deadline - now);
+            timer = ctx->getTimeoutTimer(timeout_so).get();
         }
 
         int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
-        if(SYLAR_UNLIKELY(rt)) {
+        if(rt == 1) {
+            // 持久注册模式下事件在上次等待之后已经就绪过，不用挂起，直接重试
+            if(timer) {
+                timer->cancel();
+            }
+            goto retry;
+        } else if(SYLAR_UNLIKELY(rt)) {
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
             if(timer) {
@@ -133,14 +213,19 @@ retry:
             }
             return -1;
         } else {
+            if(SYLAR_UNLIKELY(ctx->getGeneration() != generation)) {
+                // 重试到添加事件之间fd被其他线程关闭了，close可能在添加之前就取消过事件，自己取消一次，唤醒后按关闭处理
+                iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+            }
             sylar::Fiber::GetThis()->yield();
+            if(ctx->getGeneration() != generation) {
+                // 定时器可能已经归新连接使用，不能再取消，旧的回调到期时发现关闭次数不对什么也不做
+                errno = EBADF;
+                return -1;
+            }
             if(timer) {
                 timer->cancel();
             }
-            if(tinfo->cancelled) {
-                errno = tinfo->cancelled;
-                return -1;
-            }
             goto retry;
         }
     }
@@ -149,10 +234,67 @@ retry:
 }
 
 
+/**
+ * @brief splice/tee两端都可能是socket，输出端是socket时等可写，否则输入端是socket时等可读，
+ *        都不是socket时do_io直接调用。管道一端仍然按管道自己的阻塞属性
+ */
+template<typename Fun>
+static ssize_t do_pipe_io(int fd_in, int fd_out, Fun fun, const char* hook_fun_name) {
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd_out);
+    if(ctx && ctx->isSocket()) {
+        return do_io(fd_out, fun, hook_fun_name, sylar::IOManager::WRITE, SO_SNDTIMEO);
+    }
+    return do_io(fd_in, fun, hook_fun_name, sylar::IOManager::READ, SO_RCVTIMEO);
+}
+
+
+#ifndef SYLAR_HAS_IO_URING
+// 没有io_uring头文件时操作码只是占位，IOManager不会启用io_uring，do_uring总是返回false
+enum {
+    IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_CONNECT, IORING_OP_ACCEPT,
+    IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SEND, IORING_OP_RECV
+};
+#endif
+
+/**
+ * @brief 用io_uring执行hook的IO操作，提交之后挂起当前协程，完成后直接拿到结果，不用先等就绪再调用一次
+ * @param[out] result 操作结果，同对应的系统调用
+ * @return 是否已经处理，没有启用io_uring或者fd不适合时返回false，由调用方走do_io
+ */
+static bool do_uring(int fd, uint8_t opcode, int timeout_so, const void* addr,
+        uint32_t len, uint64_t off, uint32_t op_flags, ssize_t& result) {
+    if(!sylar::t_hook_enable) {
+        return false;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || !iom->isIoUring()) {
+        return false;
+    }
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return false;
+    }
+
+    int rt = iom->submitIo(opcode, fd, addr, len, off, op_flags, ctx->getTimeout(timeout_so));
+    if(rt == -EAGAIN) {
+        return false;
+    }
+    if(rt < 0) {
+        errno = -rt;
+        result = -1;
+    } else {
+        result = rt;
+    }
+    return true;
+}
+
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;
     HOOK_FUN(XX);
 #undef XX
+#ifdef SYLAR_HOOK_XSTAT
+__xstat_fun __xstat_f = nullptr;
+#endif
 
 unsigned int sleep(unsigned int seconds) {
     if(!sylar::t_hook_enable) {
@@ -204,7 +346,7 @@ int socket(int domain, int type, int protocol) {
     if(fd == -1) {
         return fd;
     }
-    sylar::FdMgr::GetInstance()->get(fd, true);
+    register_fd(fd);
     return fd;
 }
 
@@ -212,7 +354,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!sylar::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     if(!ctx || ctx->isClose()) {
         errno = EBADF;
         return -1;
@@ -226,14 +368,31 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    int n = connect_f(fd, addr, addrlen);
-    if(n == 0) {
-        return 0;
-    } else if(n != -1 || errno != EINPROGRESS) {
-        return n;
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    bool in_progress = false;
+    if(iom && iom->isIoUring()) {
+        // 连接建立或者失败之后才完成，老内核对非阻塞socket可能直接返回-EINPROGRESS，这时回到epoll等待可写
+        int rt = iom->submitIo(IORING_OP_CONNECT, fd, addr, 0, addrlen, 0, timeout_ms);
+        if(rt == -EINPROGRESS) {
+            in_progress = true;
+        } else if(rt != -EAGAIN) {
+            if(rt < 0) {
+                errno = -rt;
+                return -1;
+            }
+            return 0;
+        }
+    }
+
+    if(!in_progress) {
+        int n = connect_f(fd, addr, addrlen);
+        if(n == 0) {
+            return 0;
+        } else if(n != -1 || errno != EINPROGRESS) {
+            return n;
+        }
     }
 
-    sylar::IOManager* iom = sylar::IOManager::GetThis();
     sylar::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(tinfo);
@@ -250,6 +409,10 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     }
 
     int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
+    while(rt == 1) {
+        // 就绪状态是发起连接之前留下的，已经被addEvent清掉，重新等待
+        rt = iom->addEvent(fd, sylar::IOManager::WRITE);
+    }
     if(rt == 0) {
         sylar::Fiber::GetThis()->yield();
         if(timer) {
@@ -284,22 +447,54 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    ssize_t n;
+    int fd;
+    if(do_uring(s, IORING_OP_ACCEPT, SO_RCVTIMEO, addr, 0, (uint64_t)addrlen, 0, n)) {
+        fd = n;
+    } else {
+        fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    }
+    if(fd >= 0) {
+        register_fd(fd);
+    }
+    return fd;
+}
+
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    ssize_t n;
+    int fd;
+    if(do_uring(s, IORING_OP_ACCEPT, SO_RCVTIMEO, addr, 0, (uint64_t)addrlen, flags, n)) {
+        fd = n;
+    } else {
+        fd = do_io(s, accept4_f, "accept4", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    }
     if(fd >= 0) {
-        sylar::FdMgr::GetInstance()->get(fd, true);
+        register_fd(fd);
     }
     return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    ssize_t n;
+    if(do_uring(fd, IORING_OP_READ, SO_RCVTIMEO, buf, count, -1, 0, n)) {
+        return n;
+    }
     return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+    if(do_uring(fd, IORING_OP_READV, SO_RCVTIMEO, iov, iovcnt, -1, 0, n)) {
+        return n;
+    }
     return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    ssize_t n;
+    if(do_uring(sockfd, IORING_OP_RECV, SO_RCVTIMEO, buf, len, 0, flags, n)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -311,15 +506,35 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    return do_io(fd, pread_f, "pread", sylar::IOManager::READ, SO_RCVTIMEO, buf, count, offset);
+}
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return do_io(fd, preadv_f, "preadv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt, offset);
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t n;
+    if(do_uring(fd, IORING_OP_WRITE, SO_SNDTIMEO, buf, count, -1, 0, n)) {
+        return n;
+    }
     return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+    if(do_uring(fd, IORING_OP_WRITEV, SO_SNDTIMEO, iov, iovcnt, -1, 0, n)) {
+        return n;
+    }
     return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n;
+    if(do_uring(s, IORING_OP_SEND, SO_SNDTIMEO, msg, len, 0, flags, n)) {
+        return n;
+    }
     return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
@@ -331,22 +546,111 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    return do_io(fd, pwrite_f, "pwrite", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count, offset);
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return do_io(fd, pwritev_f, "pwritev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt, offset);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    // 输入是普通文件，总是立即可读，只有作为输出的socket发送缓冲区满时需要挂起
+    return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    return do_pipe_io(fd_in, fd_out, [=](int) {
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }, "splice");
+}
+
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    return do_pipe_io(fd_in, fd_out, [=](int) {
+        return tee_f(fd_in, fd_out, len, flags);
+    }, "tee");
+}
+
 int close(int fd) {
+    // 持久注册的fd在关闭前要从epoll中删除，不管当前线程有没有开启hook
+    sylar::IOManager::OnFdClosed(fd);
     if(!sylar::t_hook_enable) {
+        // 上下文也要删掉，否则之后复用这个fd的socket会拿到旧的上下文
+        sylar::FdMgr::GetInstance()->del(fd);
         return close_f(fd);
     }
 
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     if(ctx) {
+        // 先增加关闭次数再取消事件，之后才添加事件的协程能看到fd已经关闭，自己取消
+        sylar::FdMgr::GetInstance()->del(fd);
         auto iom = sylar::IOManager::GetThis();
         if(iom) {
             iom->cancelAll(fd);
         }
-        sylar::FdMgr::GetInstance()->del(fd);
     }
     return close_f(fd);
 }
 
+int open(const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    // O_TMPFILE包含O_DIRECTORY的位，只有O_DIRECTORY时没有mode参数
+    if((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, int);
+        va_end(va);
+    }
+    if(!sylar::t_hook_enable) {
+        return open_f(pathname, flags, mode);
+    }
+    int fd = -1;
+    sylar::BlockingPool::GetInstance()->run([&]() {
+        fd = open_f(pathname, flags, mode);
+    });
+    if(fd >= 0) {
+        // 登记之后普通文件的读写也交给线程池
+        register_fd(fd);
+    }
+    return fd;
+}
+
+int stat(const char *pathname, struct stat *statbuf) {
+    if(!sylar::t_hook_enable) {
+        return stat_f(pathname, statbuf);
+    }
+    int rt = -1;
+    sylar::BlockingPool::GetInstance()->run([&]() {
+        rt = stat_f(pathname, statbuf);
+    });
+    return rt;
+}
+
+#ifdef SYLAR_HOOK_XSTAT
+int __xstat(int ver, const char *pathname, struct stat *statbuf) {
+    if(!sylar::t_hook_enable) {
+        return __xstat_f(ver, pathname, statbuf);
+    }
+    int rt = -1;
+    sylar::BlockingPool::GetInstance()->run([&]() {
+        rt = __xstat_f(ver, pathname, statbuf);
+    });
+    return rt;
+}
+#endif
+
+int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res) {
+    if(!sylar::t_hook_enable) {
+        return getaddrinfo_f(node, service, hints, res);
+    }
+    // 域名解析可能要等几秒，交给阻塞调用线程池
+    int rt = -1;
+    sylar::BlockingPool::GetInstance()->run([&]() {
+        rt = getaddrinfo_f(node, service, hints, res);
+    });
+    return rt;
+}
+
 int fcntl(int fd, int cmd, ... /* arg */ ) {
     va_list va;
     va_start(va, cmd);
@@ -355,7 +659,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
                 }
@@ -372,7 +676,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return arg;
                 }
@@ -442,7 +746,7 @@ int ioctl(int d, unsigned long int request, ...) {
 
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(d);
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(d);
         if(!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(d, request, arg);
         }
@@ -461,7 +765,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     }
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
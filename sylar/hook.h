@@ -14,10 +14,22 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 
+/**
+ * glibc 2.33之前libc.so不导出stat，头文件里的stat是调用__xstat的内联函数，
+ * 这时改为hook __xstat，stat_f也通过它实现
+ */
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 33)
+#define SYLAR_HOOK_XSTAT 1
+#endif
+
 namespace sylar {
     /**
      * @brief 当前线程是否hook
@@ -51,6 +63,9 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int s, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_fun accept4_f;
+
 //read
 typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
 extern read_fun read_f;
@@ -67,6 +82,12 @@ extern recvfrom_fun recvfrom_f;
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr *msg, int flags);
 extern recvmsg_fun recvmsg_f;
 
+typedef ssize_t (*pread_fun)(int fd, void *buf, size_t count, off_t offset);
+extern pread_fun pread_f;
+
+typedef ssize_t (*preadv_fun)(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+extern preadv_fun preadv_f;
+
 //write
 typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
 extern write_fun write_f;
@@ -83,9 +104,40 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef ssize_t (*pwrite_fun)(int fd, const void *buf, size_t count, off_t offset);
+extern pwrite_fun pwrite_f;
+
+typedef ssize_t (*pwritev_fun)(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+extern pwritev_fun pwritev_f;
+
+//zero copy
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_fun sendfile_f;
+
+typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+extern splice_fun splice_f;
+
+typedef ssize_t (*tee_fun)(int fd_in, int fd_out, size_t len, unsigned int flags);
+extern tee_fun tee_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
+//file, dns
+typedef int (*open_fun)(const char *pathname, int flags, ...);
+extern open_fun open_f;
+
+typedef int (*stat_fun)(const char *pathname, struct stat *statbuf);
+extern stat_fun stat_f;
+
+#ifdef SYLAR_HOOK_XSTAT
+typedef int (*__xstat_fun)(int ver, const char *pathname, struct stat *statbuf);
+extern __xstat_fun __xstat_f;
+#endif
+
+typedef int (*getaddrinfo_fun)(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+extern getaddrinfo_fun getaddrinfo_f;
+
 //
 typedef int (*fcntl_fun)(int fd, int cmd, ... /* arg */ );
 extern fcntl_fun fcntl_f;
@@ -66,14 +66,112 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
     , m_close(close)
     , m_websocket(false)
     , m_parserParamFlag(0)
-    , m_path("/") {
+    , m_path("/")
+    , m_views(0) {
+}
+
+/**
+ * @brief 在头部视图数组里忽略大小写查找key，同名时后出现的为准
+ * @return 找不到返回nullptr
+ */
+static const std::pair<StringView, StringView> *FindHeaderView(const HttpRequest::HeaderViews &headers, StringView key) {
+    for (auto it = headers.rbegin(); it != headers.rend(); ++it) {
+        if (it->first.size() == key.size() && strncasecmp(it->first.data(), key.data(), key.size()) == 0) {
+            return &*it;
+        }
+    }
+    return nullptr;
 }
 
 std::string HttpRequest::getHeader(const std::string &key, const std::string &def) const {
+    if (m_views & VIEW_HEADERS) {
+        auto v = FindHeaderView(m_headerViews, key);
+        return v ? std::string(v->second.data(), v->second.size()) : def;
+    }
     auto it = m_headers.find(key);
     return it == m_headers.end() ? def : it->second;
 }
 
+StringView HttpRequest::getHeaderView(StringView key, StringView def) const {
+    if (m_views & VIEW_HEADERS) {
+        auto v = FindHeaderView(m_headerViews, key);
+        return v ? v->second : def;
+    }
+    auto it = m_headers.find(std::string(key.data(), key.size()));
+    return it == m_headers.end() ? def : StringView(it->second);
+}
+
+void HttpRequest::appendBodyView(StringView v) {
+    if (m_views & VIEW_BODY) {
+        if (m_bodyView.data() + m_bodyView.size() == v.data()) {
+            m_bodyView = StringView(m_bodyView.data(), m_bodyView.size() + v.size());
+            return;
+        }
+        materialize(VIEW_BODY);
+    } else if (m_body.empty()) {
+        m_bodyView = v;
+        m_views |= VIEW_BODY;
+        return;
+    }
+    m_body.append(v.data(), v.size());
+}
+
+void HttpRequest::addHeaderView(StringView field, StringView value) {
+    if (!(m_views & VIEW_HEADERS) && !m_headers.empty()) {
+        // 已经拷贝成MAP了(比如chunked的trailer头部)，直接写MAP
+        m_headers[std::string(field.data(), field.size())].assign(value.data(), value.size());
+        return;
+    }
+    if (m_headerViews.empty()) {
+        // 常见请求的头部数量，一次分配
+        m_headerViews.reserve(16);
+    }
+    m_headerViews.push_back(std::make_pair(field, value));
+    m_views |= VIEW_HEADERS;
+}
+
+void HttpRequest::materialize(uint8_t flags) const {
+    flags &= m_views;
+    if (!flags) {
+        return;
+    }
+    if (flags & VIEW_PATH) {
+        m_path.assign(m_pathView.data(), m_pathView.size());
+    }
+    if (flags & VIEW_QUERY) {
+        m_query.assign(m_queryView.data(), m_queryView.size());
+    }
+    if (flags & VIEW_FRAGMENT) {
+        m_fragment.assign(m_fragmentView.data(), m_fragmentView.size());
+    }
+    if (flags & VIEW_BODY) {
+        m_body.assign(m_bodyView.data(), m_bodyView.size());
+    }
+    if (flags & VIEW_HEADERS) {
+        for (auto &i : m_headerViews) {
+            m_headers[std::string(i.first.data(), i.first.size())].assign(i.second.data(), i.second.size());
+        }
+        m_headerViews.clear();
+    }
+    m_views &= ~flags;
+}
+
+void HttpRequest::rebaseViews(const char *from, size_t len, const char *to) {
+    auto rebase = [from, len, to](StringView &v) {
+        if (v.data() >= from && v.data() < from + len) {
+            v = StringView(to + (v.data() - from), v.size());
+        }
+    };
+    rebase(m_pathView);
+    rebase(m_queryView);
+    rebase(m_fragmentView);
+    rebase(m_bodyView);
+    for (auto &i : m_headerViews) {
+        rebase(i.first);
+        rebase(i.second);
+    }
+}
+
 std::shared_ptr<HttpResponse> HttpRequest::createResponse() {
     HttpResponse::ptr rsp(new HttpResponse(getVersion(), isClose()));
     return rsp;
@@ -93,6 +191,7 @@ std::string HttpRequest::getCookie(const std::string &key, const std::string &de
 }
 
 void HttpRequest::setHeader(const std::string &key, const std::string &val) {
+    materialize(VIEW_HEADERS);
     m_headers[key] = val;
 }
 
@@ -105,6 +204,7 @@ void HttpRequest::setCookie(const std::string &key, const std::string &val) {
 }
 
 void HttpRequest::delHeader(const std::string &key) {
+    materialize(VIEW_HEADERS);
     m_headers.erase(key);
 }
 
@@ -117,6 +217,13 @@ void HttpRequest::delCookie(const std::string &key) {
 }
 
 bool HttpRequest::hasHeader(const std::string &key, std::string *val) {
+    if (m_views & VIEW_HEADERS) {
+        auto v = FindHeaderView(m_headerViews, key);
+        if (v && val) {
+            val->assign(v->second.data(), v->second.size());
+        }
+        return v != nullptr;
+    }
     auto it = m_headers.find(key);
     if (it == m_headers.end()) {
         return false;
@@ -163,6 +270,7 @@ std::ostream &HttpRequest::dump(std::ostream &os) const {
     //Host: wwww.sylar.top
     //
     //
+    materialize(VIEW_ALL);
     os << HttpMethodToString(m_method) << " "
        << m_path
        << (m_query.empty() ? "" : "?")
@@ -228,6 +336,7 @@ void HttpRequest::initQueryParam() {
         ++pos;                                                                                             \
     } while (true);
 
+    materialize(VIEW_QUERY);
     PARSE_PARAM(m_query, m_params, '&', );
     m_parserParamFlag |= 0x1;
 }
@@ -241,6 +350,7 @@ void HttpRequest::initBodyParam() {
         m_parserParamFlag |= 0x2;
         return;
     }
+    materialize(VIEW_BODY);
     PARSE_PARAM(m_body, m_params, '&', );
     m_parserParamFlag |= 0x2;
 }
@@ -321,35 +431,78 @@ std::string HttpResponse::toString() const {
 }
 
 std::ostream &HttpResponse::dump(std::ostream &os) const {
-    os << "HTTP/"
-       << ((uint32_t)(m_version >> 4))
-       << "."
-       << ((uint32_t)(m_version & 0x0F))
-       << " "
-       << (uint32_t)m_status
-       << " "
-       << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
-       << "\r\n";
+    std::string head;
+    dumpHead(head);
+    return os << head << m_body;
+}
+
+namespace {
+/**
+ * @brief 预先拼好的HTTP/1.0和HTTP/1.1状态行，按状态码下标
+ */
+struct StatusLines {
+    /// 状态码上限，HTTP_STATUS_MAP里最大的是511
+    static const size_t MAX_CODE = 600;
+
+    StatusLines() {
+#define XX(code, name, msg)                                   \
+    lines[0][code] = "HTTP/1.0 " #code " " #msg "\r\n"; \
+    lines[1][code] = "HTTP/1.1 " #code " " #msg "\r\n";
+        HTTP_STATUS_MAP(XX);
+#undef XX
+    }
+
+    /**
+     * @brief 返回预先拼好的状态行，不存在时返回nullptr
+     */
+    const std::string *get(uint8_t version, HttpStatus status) const {
+        uint32_t code = (uint32_t)status;
+        if ((version != 0x10 && version != 0x11) || code >= MAX_CODE || lines[version & 0x1][code].empty()) {
+            return nullptr;
+        }
+        return &lines[version & 0x1][code];
+    }
+
+    std::string lines[2][MAX_CODE];
+};
+} // namespace
+
+void HttpResponse::dumpHead(std::string &out) const {
+    static const StatusLines s_status_lines;
+    const std::string *line = m_reason.empty() ? s_status_lines.get(m_version, m_status) : nullptr;
+    if (line) {
+        out.append(*line);
+    } else {
+        out.append("HTTP/");
+        AppendUint(out, m_version >> 4);
+        out.append(".");
+        AppendUint(out, m_version & 0x0F);
+        out.append(" ");
+        AppendUint(out, (uint32_t)m_status);
+        out.append(" ");
+        out.append(m_reason.empty() ? HttpStatusToString(m_status) : m_reason.c_str());
+        out.append("\r\n");
+    }
 
     for (auto &i : m_headers) {
         if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
             continue;
         }
-        os << i.first << ": " << i.second << "\r\n";
+        out.append(i.first).append(": ").append(i.second).append("\r\n");
     }
     for (auto &i : m_cookies) {
-        os << "Set-Cookie: " << i << "\r\n";
+        out.append("Set-Cookie: ").append(i).append("\r\n");
     }
     if (!m_websocket) {
-        os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+        out.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
     }
     if (!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
+        out.append("content-length: ");
+        AppendUint(out, m_body.size());
+        out.append("\r\n\r\n");
     } else {
-        os << "\r\n";
+        out.append("\r\n");
     }
-    return os;
 }
 
 std::ostream &operator<<(std::ostream &os, const HttpRequest &req) {
@@ -15,6 +15,7 @@
 #include <sstream>
 #include <memory>
 #include <boost/lexical_cast.hpp>
+#include <boost/utility/string_view.hpp>
 
 namespace sylar {
 namespace http {
@@ -122,9 +123,17 @@ T getAs(const MapType& m, const std::string& key, const T& def = T()) {
     return def;
 }
 
+/**
+ * @brief 不持有内存的字符串视图，C++11没有std::string_view，用boost的实现
+ */
+typedef boost::string_view StringView;
+
 class HttpResponse;
 /**
  * @brief HTTP请求结构
+ * @details 零拷贝解析时path/query/fragment/body和头部只是指向连接读缓存的视图，
+ *          头部按出现顺序存在一个小数组里，第一次通过std::string接口访问时才拷贝出来。
+ *          视图在HttpSession读取下一个请求之前有效，HttpSession复用读缓存前会把仍被引用的请求拷贝出来
  */
 class HttpRequest {
 public:
@@ -134,6 +143,9 @@ public:
     /// MAP结构
     typedef std::map<std::string, std::string, CaseInsensitiveLess> MapType;
 
+    /// 零拷贝模式下的头部数组，按出现顺序保存
+    typedef std::vector<std::pair<StringView, StringView> > HeaderViews;
+
     /**
      * @brief 构造函数
      * @param[in] version 版本
@@ -160,22 +172,44 @@ public:
     /**
      * @brief 返回HTTP请求的路径
      */
-    const std::string& getPath() const { return m_path;}
+    const std::string& getPath() const { materialize(VIEW_PATH); return m_path;}
 
     /**
      * @brief 返回HTTP请求的查询参数
      */
-    const std::string& getQuery() const { return m_query;}
+    const std::string& getQuery() const { materialize(VIEW_QUERY); return m_query;}
 
     /**
      * @brief 返回HTTP请求的消息体
      */
-    const std::string& getBody() const { return m_body;}
+    const std::string& getBody() const { materialize(VIEW_BODY); return m_body;}
 
     /**
      * @brief 返回HTTP请求的消息头MAP
      */
-    const MapType& getHeaders() const { return m_headers;}
+    const MapType& getHeaders() const { materialize(VIEW_HEADERS); return m_headers;}
+
+    /**
+     * @brief 返回HTTP请求的路径，不拷贝
+     */
+    StringView getPathView() const { return (m_views & VIEW_PATH) ? m_pathView : StringView(m_path);}
+
+    /**
+     * @brief 返回HTTP请求的查询参数，不拷贝
+     */
+    StringView getQueryView() const { return (m_views & VIEW_QUERY) ? m_queryView : StringView(m_query);}
+
+    /**
+     * @brief 返回HTTP请求的消息体，不拷贝
+     */
+    StringView getBodyView() const { return (m_views & VIEW_BODY) ? m_bodyView : StringView(m_body);}
+
+    /**
+     * @brief 获取HTTP请求的头部参数，不拷贝
+     * @param[in] key 关键字，忽略大小写
+     * @param[in] def 不存在时返回的值
+     */
+    StringView getHeaderView(StringView key, StringView def = StringView()) const;
 
     /**
      * @brief 返回HTTP请求的参数MAP
@@ -203,31 +237,72 @@ public:
      * @brief 设置HTTP请求的路径
      * @param[in] v 请求路径
      */
-    void setPath(const std::string& v) { m_path = v;}
+    void setPath(const std::string& v) { m_path = v; m_views &= ~VIEW_PATH;}
 
     /**
      * @brief 设置HTTP请求的查询参数
      * @param[in] v 查询参数
      */
-    void setQuery(const std::string& v) { m_query = v;}
+    void setQuery(const std::string& v) { m_query = v; m_views &= ~VIEW_QUERY;}
 
     /**
      * @brief 设置HTTP请求的Fragment
      * @param[in] v fragment
      */
-    void setFragment(const std::string& v) { m_fragment = v;}
+    void setFragment(const std::string& v) { m_fragment = v; m_views &= ~VIEW_FRAGMENT;}
 
     /**
      * @brief 设置HTTP请求的消息体
      * @param[in] v 消息体
      */
-    void setBody(const std::string& v) { m_body = v;}
+    void setBody(const std::string& v) { m_body = v; m_views &= ~VIEW_BODY;}
 
     /**
      * @brief 追加HTTP请求的消息体
      * @param[in] v 追加内容
      */
-    void appendBody(const std::string &v) { m_body.append(v); }
+    void appendBody(const std::string &v) { materialize(VIEW_BODY); m_body.append(v); }
+
+    /**
+     * @brief 设置HTTP请求的路径视图，调用方保证v指向的内存在请求使用期间有效
+     */
+    void setPathView(StringView v) { m_pathView = v; m_views |= VIEW_PATH;}
+
+    /**
+     * @brief 设置HTTP请求的查询参数视图
+     */
+    void setQueryView(StringView v) { m_queryView = v; m_views |= VIEW_QUERY;}
+
+    /**
+     * @brief 设置HTTP请求的Fragment视图
+     */
+    void setFragmentView(StringView v) { m_fragmentView = v; m_views |= VIEW_FRAGMENT;}
+
+    /**
+     * @brief 追加HTTP请求的消息体
+     * @details 和已有的消息体视图在内存上相连时只延长视图，否则拷贝
+     */
+    void appendBodyView(StringView v);
+
+    /**
+     * @brief 追加一个头部视图，同名头部以后出现的为准
+     */
+    void addHeaderView(StringView field, StringView value);
+
+    /**
+     * @brief 是否还有指向外部内存的视图
+     */
+    bool hasViews() const { return m_views != 0;}
+
+    /**
+     * @brief 把所有视图拷贝成自己持有的字符串，之后请求不再依赖外部内存
+     */
+    void materialize() { materialize(VIEW_ALL);}
+
+    /**
+     * @brief 外部内存整体搬到新地址后，把指向[from, from + len)的视图平移到to开始的内存
+     */
+    void rebaseViews(const char* from, size_t len, const char* to);
 
     /**
      * @brief 是否自动关闭
@@ -253,7 +328,7 @@ public:
      * @brief 设置HTTP请求的头部MAP
      * @param[in] v map
      */
-    void setHeaders(const MapType& v) { m_headers = v;}
+    void setHeaders(const MapType& v) { m_headers = v; m_headerViews.clear(); m_views &= ~VIEW_HEADERS;}
 
     /**
      * @brief 设置HTTP请求的参数MAP
@@ -365,6 +440,7 @@ public:
      */
     template<class T>
     bool checkGetHeaderAs(const std::string& key, T& val, const T& def = T()) {
+        materialize(VIEW_HEADERS);
         return checkGetAs(m_headers, key, val, def);
     }
 
@@ -377,6 +453,7 @@ public:
      */
     template<class T>
     T getHeaderAs(const std::string& key, const T& def = T()) {
+        materialize(VIEW_HEADERS);
         return getAs(m_headers, key, def);
     }
 
@@ -468,6 +545,22 @@ public:
      * @brief 初始化，实际是判断connection是否为keep-alive，以设置是否自动关闭套接字
      */
     void init();
+private:
+    /// m_views的标志位，置位表示对应字段当前只有视图
+    enum {
+        VIEW_PATH     = 0x1,
+        VIEW_QUERY    = 0x2,
+        VIEW_FRAGMENT = 0x4,
+        VIEW_BODY     = 0x8,
+        VIEW_HEADERS  = 0x10,
+        VIEW_ALL      = 0x1F
+    };
+
+    /**
+     * @brief 把flags对应的视图拷贝到std::string和头部MAP里
+     * @details const接口也需要按需拷贝，所以相关成员都是mutable
+     */
+    void materialize(uint8_t flags) const;
 private:
     /// HTTP方法
     HttpMethod m_method;
@@ -482,15 +575,27 @@ private:
     /// 请求的完整url
     std::string m_url;
     /// 请求路径
-    std::string m_path;
+    mutable std::string m_path;
     /// 请求参数
-    std::string m_query;
+    mutable std::string m_query;
     /// 请求fragment
-    std::string m_fragment;
+    mutable std::string m_fragment;
     /// 请求消息体
-    std::string m_body;
+    mutable std::string m_body;
     /// 请求头部MAP
-    MapType m_headers;
+    mutable MapType m_headers;
+    /// 哪些字段还是视图，见VIEW_*
+    mutable uint8_t m_views;
+    /// 零拷贝解析出的路径
+    StringView m_pathView;
+    /// 零拷贝解析出的查询参数
+    StringView m_queryView;
+    /// 零拷贝解析出的fragment
+    StringView m_fragmentView;
+    /// 零拷贝解析出的消息体
+    StringView m_bodyView;
+    /// 零拷贝解析出的头部
+    mutable HeaderViews m_headerViews;
     /// 请求参数MAP
     MapType m_params;
     /// 请求Cookie MAP
@@ -653,6 +758,13 @@ public:
      */
     std::ostream& dump(std::ostream& os) const;
 
+    /**
+     * @brief 把状态行和头部(包括结尾的空行)追加到out末尾，不包含消息体
+     * @details 状态行是预先拼好的，消息体由调用方单独发送，不需要再拷贝一次
+     * @param[in, out] out 输出缓存
+     */
+    void dumpHead(std::string& out) const;
+
     /**
      * @brief 转成字符串
      */
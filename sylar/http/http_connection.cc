@@ -283,7 +283,7 @@ HttpConnectionPool::HttpConnectionPool(const std::string& host
 }
 
 HttpConnection::ptr HttpConnectionPool::getConnection() {
-    uint64_t now_ms = sylar::GetCurrentMS();
+    uint64_t now_ms = sylar::CoarseWallMS();
     std::vector<HttpConnection*> invalid_conns;
     HttpConnection* ptr = nullptr;
     MutexType::Lock lock(m_mutex);
@@ -335,7 +335,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
 void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool) {
     ++ptr->m_request;
     if(!ptr->isConnected()
-            || ((ptr->m_createTime + pool->m_maxAliveTime) >= sylar::GetCurrentMS())
+            || ((ptr->m_createTime + pool->m_maxAliveTime) >= sylar::CoarseWallMS())
             || (ptr->m_request >= pool->m_maxRequest)) {
         delete ptr;
         --pool->m_total;
@@ -95,7 +95,7 @@ static int on_request_headers_complete_cb(http_parser *p) {
     HttpRequestParser *parser = static_cast<HttpRequestParser *>(p->data);
     parser->getData()->setVersion(((p->http_major) << 0x4) | (p->http_minor));
     parser->getData()->setMethod((HttpMethod)(p->method));
-    return 0;
+    return parser->onHeadersComplete();
 }
 
 /**
@@ -105,6 +105,8 @@ static int on_request_message_complete_cb(http_parser *p) {
     SYLAR_LOG_DEBUG(g_logger) << "on_request_message_complete_cb";
     HttpRequestParser *parser = static_cast<HttpRequestParser *>(p->data);
     parser->setFinished(true);
+    // 一个请求解析完就停下，流水线上后面的请求留在缓存里给下一个解析器
+    http_parser_pause(p, 1);
     return 0;
 }
 
@@ -197,6 +199,43 @@ static int on_request_body_cb(http_parser *p, const char *buf, size_t len) {
     return 0;
 }
 
+/**
+ * @brief 零拷贝模式的url回调
+ */
+static int on_request_url_view_cb(http_parser *p, const char *buf, size_t len) {
+    return static_cast<HttpRequestParser *>(p->data)->onUrlView(buf, len);
+}
+
+/**
+ * @brief 零拷贝模式的首部字段名称回调
+ */
+static int on_request_header_field_view_cb(http_parser *p, const char *buf, size_t len) {
+    return static_cast<HttpRequestParser *>(p->data)->onHeaderFieldView(buf, len);
+}
+
+/**
+ * @brief 零拷贝模式的首部字段值回调
+ */
+static int on_request_header_value_view_cb(http_parser *p, const char *buf, size_t len) {
+    return static_cast<HttpRequestParser *>(p->data)->onHeaderValueView(buf, len);
+}
+
+/**
+ * @brief 零拷贝模式的消息体回调，相连的数据只延长视图
+ */
+static int on_request_body_view_cb(http_parser *p, const char *buf, size_t len) {
+    static_cast<HttpRequestParser *>(p->data)->getData()->appendBodyView(StringView(buf, len));
+    return 0;
+}
+
+/**
+ * @brief 零拷贝模式的解析结束回调，chunked的trailer头部在这里保存
+ */
+static int on_request_message_complete_view_cb(http_parser *p) {
+    static_cast<HttpRequestParser *>(p->data)->commitHeaderView();
+    return on_request_message_complete_cb(p);
+}
+
 static http_parser_settings s_request_settings = {
     .on_message_begin    = on_request_message_begin_cb,
     .on_url              = on_request_url_cb,
@@ -209,16 +248,122 @@ static http_parser_settings s_request_settings = {
     .on_chunk_header     = on_request_chunk_header_cb,
     .on_chunk_complete   = on_request_chunk_complete_cb};
 
-HttpRequestParser::HttpRequestParser() {
+static http_parser_settings s_request_view_settings = {
+    .on_message_begin    = on_request_message_begin_cb,
+    .on_url              = on_request_url_view_cb,
+    .on_status           = on_request_status_cb,
+    .on_header_field     = on_request_header_field_view_cb,
+    .on_header_value     = on_request_header_value_view_cb,
+    .on_headers_complete = on_request_headers_complete_cb,
+    .on_body             = on_request_body_view_cb,
+    .on_message_complete = on_request_message_complete_view_cb,
+    .on_chunk_header     = on_request_chunk_header_cb,
+    .on_chunk_complete   = on_request_chunk_complete_cb};
+
+HttpRequestParser::HttpRequestParser(bool zero_copy) {
     http_parser_init(&m_parser, HTTP_REQUEST);
     m_data.reset(new HttpRequest);
-    m_parser.data = this;
-    m_error       = 0;
-    m_finished    = false;
+    m_parser.data     = this;
+    m_error           = 0;
+    m_finished        = false;
+    m_zeroCopy        = zero_copy;
+    m_headersComplete = false;
+    m_headerState     = HEADER_NONE;
+}
+
+/**
+ * @brief 数据读到一半时http-parser会把同一个token分多次回调，零拷贝模式下数据不搬迁，后一段紧接着前一段
+ * @return 不相连时返回false
+ */
+static bool ExtendView(StringView &v, const char *buf, size_t len) {
+    if (!v.data()) {
+        v = StringView(buf, len);
+        return true;
+    }
+    if (v.data() + v.size() != buf) {
+        return false;
+    }
+    v = StringView(v.data(), v.size() + len);
+    return true;
+}
+
+int HttpRequestParser::onUrlView(const char *buf, size_t len) {
+    SYLAR_LOG_DEBUG(g_logger) << "on_request_url_view_cb, url is:" << StringView(buf, len);
+    return ExtendView(m_urlView, buf, len) ? 0 : 1;
+}
+
+int HttpRequestParser::onHeaderFieldView(const char *buf, size_t len) {
+    if (m_headerState == HEADER_FIELD && ExtendView(m_fieldView, buf, len)) {
+        return 0;
+    }
+    // 新的头部开始，上一个头部已经完整了，value为空时没有value回调
+    commitHeaderView();
+    m_fieldView   = StringView(buf, len);
+    m_headerState = HEADER_FIELD;
+    return 0;
+}
+
+int HttpRequestParser::onHeaderValueView(const char *buf, size_t len) {
+    if (m_headerState == HEADER_NONE || !ExtendView(m_valueView, buf, len)) {
+        return 1;
+    }
+    m_headerState = HEADER_VALUE;
+    return 0;
+}
+
+int HttpRequestParser::onHeadersComplete() {
+    m_headersComplete = true;
+    if (!m_zeroCopy) {
+        return 0;
+    }
+    commitHeaderView();
+
+    struct http_parser_url url_parser;
+    http_parser_url_init(&url_parser);
+    if (http_parser_parse_url(m_urlView.data(), m_urlView.size(), 0, &url_parser) != 0) {
+        SYLAR_LOG_DEBUG(g_logger) << "parse url fail";
+        return -1;
+    }
+#define XX(field, setter)                                                              \
+    if (url_parser.field_set & (1 << field)) {                                         \
+        m_data->setter(StringView(m_urlView.data() + url_parser.field_data[field].off, \
+                                  url_parser.field_data[field].len));                  \
+    }
+    XX(UF_PATH, setPathView);
+    XX(UF_QUERY, setQueryView);
+    XX(UF_FRAGMENT, setFragmentView);
+#undef XX
+    return 0;
+}
+
+void HttpRequestParser::commitHeaderView() {
+    if (m_headerState == HEADER_NONE) {
+        return;
+    }
+    m_data->addHeaderView(m_fieldView, m_valueView);
+    m_fieldView   = StringView();
+    m_valueView   = StringView();
+    m_headerState = HEADER_NONE;
+}
+
+void HttpRequestParser::rebase(const char *from, size_t len, const char *to) {
+    auto rebase = [from, len, to](StringView &v) {
+        if (v.data() >= from && v.data() < from + len) {
+            v = StringView(to + (v.data() - from), v.size());
+        }
+    };
+    rebase(m_urlView);
+    rebase(m_fieldView);
+    rebase(m_valueView);
+    m_data->rebaseViews(from, len, to);
 }
 
 size_t HttpRequestParser::execute(char *data, size_t len) {
-    size_t nparsed = http_parser_execute(&m_parser, &s_request_settings, data, len);
+    size_t nparsed = http_parser_execute(&m_parser, m_zeroCopy ? &s_request_view_settings : &s_request_settings,
+                                         data, len);
+    if (HTTP_PARSER_ERRNO(&m_parser) == HPE_PAUSED) {
+        http_parser_pause(&m_parser, 0);
+    }
     if (m_parser.upgrade) {
         //处理新协议，暂时不处理
         SYLAR_LOG_DEBUG(g_logger) << "found upgrade, ignore";
@@ -226,10 +371,8 @@ size_t HttpRequestParser::execute(char *data, size_t len) {
     } else if (m_parser.http_errno != 0) {
         SYLAR_LOG_DEBUG(g_logger) << "parse request fail: " << http_errno_name(HTTP_PARSER_ERRNO(&m_parser));
         setError((int8_t)m_parser.http_errno);
-    } else {
-        if (nparsed < len) {
-            memmove(data, data + nparsed, (len - nparsed));
-        }
+    } else if (!m_zeroCopy && nparsed < len) {
+        memmove(data, data + nparsed, (len - nparsed));
     }
     return nparsed;
 }
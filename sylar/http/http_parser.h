@@ -22,17 +22,64 @@ public:
 
     /**
      * @brief 构造函数
+     * @param[in] zero_copy 是否零拷贝解析，请求的path/query/body和头部只保存指向data的视图
      */
-    HttpRequestParser();
+    HttpRequestParser(bool zero_copy = false);
 
     /**
      * @brief 解析协议
+     * @details 一个请求解析完成后就停止，data里后面的数据属于流水线上的下一个请求，不会被解析。
+     *          零拷贝模式下已解析的数据不移除，调用方要保证同一个请求的数据在内存上连续，
+     *          并且在请求使用期间不被覆盖，内存搬迁时调用rebase
      * @param[in, out] data 协议文本内存
      * @param[in] len 协议文本内存长度
-     * @return 返回实际解析的长度,并且将已解析的数据移除
+     * @return 返回实际解析的长度,非零拷贝模式下会将已解析的数据移除
      */
     size_t execute(char *data, size_t len);
 
+    /**
+     * @brief 是否零拷贝解析
+     */
+    bool isZeroCopy() const { return m_zeroCopy; }
+
+    /**
+     * @brief 头部是否已经解析完，之后只剩消息体
+     */
+    bool isHeadersComplete() const { return m_headersComplete; }
+
+    /**
+     * @brief 零拷贝模式下已解析的数据整体从from搬到to后，平移所有视图
+     * @param[in] from 原来的内存
+     * @param[in] len 搬迁的长度
+     * @param[in] to 新的内存
+     */
+    void rebase(const char *from, size_t len, const char *to);
+
+    /**
+     * @brief 零拷贝模式的url回调，url可能分多次返回
+     */
+    int onUrlView(const char *buf, size_t len);
+
+    /**
+     * @brief 零拷贝模式的头部field回调
+     */
+    int onHeaderFieldView(const char *buf, size_t len);
+
+    /**
+     * @brief 零拷贝模式的头部value回调
+     */
+    int onHeaderValueView(const char *buf, size_t len);
+
+    /**
+     * @brief 头部解析完成，零拷贝模式下保存最后一个头部，拆分url
+     */
+    int onHeadersComplete();
+
+    /**
+     * @brief 把解析到一半的头部保存到请求里
+     */
+    void commitHeaderView();
+
     /**
      * @brief 是否解析完成
      * @return 是否解析完成
@@ -98,6 +145,18 @@ private:
     bool m_finished;
     /// 当前的HTTP头部field，http-parser解析HTTP头部是field和value分两次返回
     std::string m_field;
+    /// 是否零拷贝解析
+    bool m_zeroCopy;
+    /// 头部是否已经解析完
+    bool m_headersComplete;
+    /// 零拷贝模式下最近一次回调的是field还是value，数据读到一半时同一个field或value会分多次回调
+    enum { HEADER_NONE, HEADER_FIELD, HEADER_VALUE } m_headerState;
+    /// 零拷贝模式下的完整url
+    StringView m_urlView;
+    /// 零拷贝模式下当前的头部field
+    StringView m_fieldView;
+    /// 零拷贝模式下当前的头部value
+    StringView m_valueView;
 };
 
 /**
@@ -1,42 +1,93 @@
 #include "http_session.h"
 #include "http_parser.h"
+#include "../config.h"
 
 namespace sylar {
 namespace http {
 
+static sylar::ConfigVar<bool>::ptr g_http_request_zero_copy =
+    sylar::Config::Lookup("http.request.zero_copy", true, "parse http request as views into the session read buffer");
+
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
-    : SocketStream(sock, owner) {
+    : SocketStream(sock, owner)
+    , m_buffer(new char[HttpRequestParser::GetHttpRequestBufferSize()])
+    , m_bufferSize(HttpRequestParser::GetHttpRequestBufferSize())
+    , m_zeroCopy(g_http_request_zero_copy->getValue()) {
+}
+
+HttpSession::~HttpSession() {
+    releaseRequest();
+}
+
+void HttpSession::releaseRequest() {
+    if (m_request && m_request.use_count() > 1 && m_request->hasViews()) {
+        m_request->materialize();
+    }
+    m_request.reset();
+}
+
+bool HttpSession::makeRoom(HttpRequestParser *parser) {
+    if (!m_zeroCopy) {
+        // 已解析的数据都被移走了，缓存里全是没解析的数据
+        return false;
+    }
+    char *data = m_buffer.get();
+    if (parser->isHeadersComplete()) {
+        // 只剩消息体，请求拷贝出来之后已解析的数据就没用了
+        parser->getData()->materialize();
+        memmove(data, data + m_bufferStart, m_bufferLen);
+        m_bufferStart = 0;
+        return true;
+    }
+    size_t size = m_bufferSize * 2;
+    std::unique_ptr<char[]> buffer(new char[size]);
+    memcpy(buffer.get(), data, m_bufferStart + m_bufferLen);
+    parser->rebase(data, m_bufferSize, buffer.get());
+    m_buffer.swap(buffer);
+    m_bufferSize = size;
+    return true;
 }
 
 HttpRequest::ptr HttpSession::recvRequest() {
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    std::shared_ptr<char> buffer(
-        new char[buff_size], [](char *ptr) {
-            delete[] ptr;
-        });
-    char *data = buffer.get();
-    int offset = 0;
+    releaseRequest();
+    if (m_bufferStart > 0) {
+        // 流水线上剩下的数据挪到缓存开头，请求总是从缓存开头开始
+        memmove(m_buffer.get(), m_buffer.get() + m_bufferStart, m_bufferLen);
+        m_bufferStart = 0;
+    }
+    HttpRequestParser::ptr parser(new HttpRequestParser(m_zeroCopy));
     do {
-        int len = read(data + offset, buff_size - offset);
-        if (len <= 0) {
+        if (m_bufferLen > 0) {
+            size_t nparse = parser->execute(m_buffer.get() + m_bufferStart, m_bufferLen);
+            if (parser->hasError()) {
+                close();
+                return nullptr;
+            }
+            m_bufferLen -= nparse;
+            if (m_zeroCopy) {
+                // 零拷贝模式下解析完的数据留在原处给请求的视图用，否则已经被移走了
+                m_bufferStart += nparse;
+            }
+            if (parser->isFinished()) {
+                break;
+            }
+        }
+        if (m_bufferStart + m_bufferLen == m_bufferSize && !makeRoom(parser.get())) {
             close();
             return nullptr;
         }
-        len += offset;
-        size_t nparse = parser->execute(data, len);
-        if (parser->hasError()) {
+        // 缓存里已经没有完整的请求，阻塞读之前先把攒下的响应发出去
+        if (flush() < 0) {
             close();
             return nullptr;
         }
-        offset = len - nparse;
-        if (offset == (int)buff_size) {
+        size_t offset = m_bufferStart + m_bufferLen;
+        int len       = read(m_buffer.get() + offset, m_bufferSize - offset);
+        if (len <= 0) {
             close();
             return nullptr;
         }
-        if (parser->isFinished()) {
-            break;
-        }
+        m_bufferLen += len;
     } while (true);
 
     // 与sylar的HTTP解析库不一样的是，nodejs/http-parser解析结束时body部分已经解析完了，所以这里不再需要单独读取body
@@ -65,14 +116,83 @@ HttpRequest::ptr HttpSession::recvRequest() {
     // }
     
     parser->getData()->init();
+    if (m_zeroCopy) {
+        m_request = parser->getData();
+    }
     return parser->getData();
 }
 
+/// 最多攒多少个响应一起发送
+static const size_t s_max_pending_responses = 16;
+
+/// 不超过这个大小的消息体拷贝到输出缓存里，和头部一起作为一段发送
+static const size_t s_inline_body_size = 1024;
+
+/// 输出缓存发送后超过这个容量就释放，偶尔的大响应不要一直占着内存
+static const size_t s_max_output_capacity = 64 * 1024;
+
 int HttpSession::sendResponse(HttpResponse::ptr rsp) {
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+    size_t begin            = m_output.size();
+    const std::string &body = rsp->getBody();
+    rsp->dumpHead(m_output);
+    if (body.size() <= s_inline_body_size) {
+        m_output.append(body);
+    } else {
+        m_bodies.push_back(std::make_pair(m_output.size(), rsp));
+    }
+    ++m_pendingCount;
+    int size = m_output.size() - begin + (body.size() > s_inline_body_size ? body.size() : 0);
+    if (m_bufferLen > 0 && !rsp->isClose() && m_pendingCount < s_max_pending_responses) {
+        return size;
+    }
+    int rt = flush();
+    return rt > 0 ? size : rt;
+}
+
+int HttpSession::flush() {
+    if (!m_pendingCount) {
+        return 0;
+    }
+    // 输出缓存按大消息体的位置切开，消息体直接指向响应对象里的数据
+    m_iovs.clear();
+    size_t offset = 0;
+    for (auto &i : m_bodies) {
+        iovec iov;
+        if (i.first > offset) {
+            iov.iov_base = &m_output[offset];
+            iov.iov_len  = i.first - offset;
+            m_iovs.push_back(iov);
+        }
+        const std::string &body = i.second->getBody();
+        iov.iov_base            = (void *)body.data();
+        iov.iov_len             = body.size();
+        m_iovs.push_back(iov);
+        offset = i.first;
+    }
+    if (offset < m_output.size()) {
+        iovec iov;
+        iov.iov_base = &m_output[offset];
+        iov.iov_len  = m_output.size() - offset;
+        m_iovs.push_back(iov);
+    }
+    int64_t rt = writevFixSize(&m_iovs[0], m_iovs.size());
+    m_output.clear();
+    m_bodies.clear();
+    m_pendingCount = 0;
+    if (m_output.capacity() > s_max_output_capacity) {
+        std::string().swap(m_output);
+    }
+    if (rt <= 0) {
+        return -1;
+    }
+    return rt;
+}
+
+void HttpSession::close() {
+    if (m_pendingCount && isConnected()) {
+        flush();
+    }
+    SocketStream::close();
 }
 
 } // namespace http
@@ -10,12 +10,17 @@
 #ifndef __SYLAR_HTTP_SESSION_H__
 #define __SYLAR_HTTP_SESSION_H__
 
+#include <memory>
+#include <string>
+#include <vector>
 #include "../streams/socket_stream.h"
 #include "http.h"
 
 namespace sylar {
 namespace http {
 
+class HttpRequestParser;
+
 /**
  * @brief HTTPSession封装
  */
@@ -31,19 +36,85 @@ public:
      */
     HttpSession(Socket::ptr sock, bool owner = true);
 
+    /**
+     * @brief 析构函数，返回的请求还被别处持有时先拷贝出来
+     */
+    ~HttpSession();
+
     /**
      * @brief 接收HTTP请求
+     * @details 读缓存在连接上一直保留，上一个请求之后多读到的数据先用来解析，不够时再从socket读取，
+     *          所以流水线上连续发来的请求一次read就可以全部读进来。
+     *          http.request.zero_copy打开时请求里的头部等字段直接指向读缓存，在下一次recvRequest之前有效，
+     *          之后还被持有的请求会在读缓存被覆盖前拷贝出来
      */
     HttpRequest::ptr recvRequest();
 
     /**
      * @brief 发送HTTP响应
+     * @details 状态行和头部序列化到连接的输出缓存里，小消息体跟在后面，大消息体不拷贝，发送时作为单独的iovec。
+     *          读缓存里还有流水线上后续请求的数据时先不发送，攒到需要从socket读数据、
+     *          响应要求关闭连接或者攒够一批时，用一次writev一起发出
      * @param[in] rsp HTTP响应
      * @return >0 发送成功
      *         =0 对方关闭
      *         <0 Socket异常
      */
     int sendResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 发出攒下的响应
+     * @return >0 发送成功
+     *         =0 没有待发送的响应
+     *         <0 Socket异常
+     */
+    int flush();
+
+    /**
+     * @brief 读缓存里是否还有没解析的数据
+     */
+    bool hasBufferedData() const { return m_bufferLen > 0; }
+
+    /**
+     * @brief 先发出攒下的响应再关闭
+     */
+    virtual void close() override;
+
+private:
+    /**
+     * @brief 读缓存满了但请求还没解析完时腾出空间
+     * @details 头部已经解析完时把请求拷贝出来，缓存从头复用；否则把缓存扩大一倍，
+     *          头部大小由http-parser的HTTP_MAX_HEADER_SIZE限制
+     * @return 没有空间可腾时返回false
+     */
+    bool makeRoom(HttpRequestParser *parser);
+
+    /**
+     * @brief 上一个请求用完了，还被别处持有时把视图拷贝出来
+     */
+    void releaseRequest();
+
+private:
+    /// 读缓存
+    std::unique_ptr<char[]> m_buffer;
+    /// 读缓存大小
+    size_t m_bufferSize;
+    /// 读缓存里没解析的数据的起始位置，零拷贝模式下前面是当前请求已解析的数据
+    size_t m_bufferStart = 0;
+    /// 读缓存里没解析的数据长度
+    size_t m_bufferLen = 0;
+    /// 是否零拷贝解析请求
+    bool m_zeroCopy;
+    /// 零拷贝模式下最近返回的请求，它的视图指向读缓存
+    HttpRequest::ptr m_request;
+    /// 攒下的响应的状态行和头部，小消息体直接拼在后面，发送后清空但保留容量
+    std::string m_output;
+    /// 不拷贝的大消息体应该插在m_output的哪个位置，响应对象保留到发送完
+    std::vector<std::pair<size_t, HttpResponse::ptr> > m_bodies;
+    /// 攒下的响应数
+    size_t m_pendingCount = 0;
+    /// writev用的iovec数组，复用
+    std::vector<iovec> m_iovs;
 };
 
 }
@@ -1,9 +1,272 @@
 #include "servlet.h"
+#include <algorithm>
+#include <deque>
 #include <fnmatch.h>
+#include <string.h>
 
 namespace sylar {
 namespace http {
 
+/**
+ * @brief 编译好的路由表，构建完成后只读
+ * @details 路径按'/'切成段，每段是树上的一层，"/a/b"的段是"", "a", "b"。
+ *          一层里静态段按字典序排好二分查找，另外最多一个路径参数子节点
+ */
+class RouteTable {
+public:
+    /**
+     * @brief 添加精准匹配或者带路径参数的路由
+     * @param[in] method INVALID_METHOD表示不区分方法
+     */
+    void addRoute(HttpMethod method, const std::string &uri, IServletCreator::ptr creator) {
+        Node *node     = &m_root;
+        size_t pos     = 0;
+        bool has_param = false;
+        do {
+            size_t slash = uri.find('/', pos);
+            std::string seg = uri.substr(pos, slash == std::string::npos ? std::string::npos : slash - pos);
+            if (seg.size() > 1 && seg[0] == ':') {
+                has_param = true;
+                if (!node->param) {
+                    node->param.reset(new Node);
+                    node->param->paramName = seg.substr(1);
+                }
+                node = node->param.get();
+            } else {
+                node = node->getOrCreate(seg);
+            }
+            pos = slash == std::string::npos ? std::string::npos : slash + 1;
+        } while (pos != std::string::npos);
+
+        if (method == HttpMethod::INVALID_METHOD) {
+            node->any = creator;
+        } else {
+            node->methods.push_back(std::make_pair(method, creator));
+        }
+        if (!has_param && !m_statics.count(uri)) {
+            m_staticKeys.push_back(uri);
+            m_statics[m_staticKeys.back()] = node;
+        }
+    }
+
+    /**
+     * @brief 添加模糊匹配的路由，先添加的优先
+     */
+    void addGlob(const std::string &pattern, IServletCreator::ptr creator) {
+        size_t order = m_globCount++;
+        // "前缀/*"并且前缀里没有通配符时，等价于匹配前缀下的所有路径
+        if (pattern.size() >= 2 && pattern.compare(pattern.size() - 2, 2, "/*") == 0 &&
+            pattern.find_first_of("*?[\\", 0) == pattern.size() - 1) {
+            Node *node = &m_root;
+            std::string prefix = pattern.substr(0, pattern.size() - 2);
+            size_t pos = 0;
+            do {
+                size_t slash = prefix.find('/', pos);
+                node         = node->getOrCreate(
+                    prefix.substr(pos, slash == std::string::npos ? std::string::npos : slash - pos));
+                pos = slash == std::string::npos ? std::string::npos : slash + 1;
+            } while (pos != std::string::npos);
+            if (!node->wildcard) {
+                node->wildcard      = creator;
+                node->wildcardOrder = order;
+            }
+            return;
+        }
+        m_fnmatchs.push_back(Glob{pattern, creator, order});
+    }
+
+    /**
+     * @brief 查找路径对应的servlet
+     * @param[out] params 非空时保存路径参数
+     * @return 没有匹配时返回nullptr
+     */
+    IServletCreator *match(HttpMethod method, StringView path, RouteParams *params) const {
+        // 精准匹配先整条路径查一次哈希表，命中时不用逐段走树
+        auto it = m_statics.find(path);
+        IServletCreator *creator = it != m_statics.end() ? it->second->get(method) : nullptr;
+        if (!creator) {
+            creator = matchRoute(&m_root, method, path, params);
+        }
+        if (creator) {
+            return creator;
+        }
+
+        // 模糊匹配，树上的通配节点只在静态段上，沿着静态段走一遍取最早添加的
+        const Node *best  = nullptr;
+        const Node *node  = &m_root;
+        StringView rest   = path;
+        while (true) {
+            size_t slash = rest.find('/');
+            node         = node->find(rest.substr(0, slash));
+            if (!node || slash == StringView::npos) {
+                break;
+            }
+            rest = rest.substr(slash + 1);
+            if (node->wildcard && (!best || node->wildcardOrder < best->wildcardOrder)) {
+                best = node;
+            }
+        }
+        size_t best_order = best ? best->wildcardOrder : m_globCount;
+        if (!m_fnmatchs.empty() && m_fnmatchs.front().order < best_order) {
+            std::string uri(path.data(), path.size());
+            for (auto &i : m_fnmatchs) {
+                if (i.order >= best_order) {
+                    break;
+                }
+                if (!fnmatch(i.pattern.c_str(), uri.c_str(), 0)) {
+                    return i.creator.get();
+                }
+            }
+        }
+        return best ? best->wildcard.get() : nullptr;
+    }
+
+private:
+    /**
+     * @brief 树节点，对应路径的一段
+     */
+    struct Node {
+        /// 静态子节点，按段排序
+        std::vector<std::pair<std::string, std::unique_ptr<Node> > > children;
+        /// 路径参数子节点
+        std::unique_ptr<Node> param;
+        /// 路径参数名，只有路径参数节点有
+        std::string paramName;
+        /// 路径正好在这里结束时，不区分方法的servlet
+        IServletCreator::ptr any;
+        /// 路径正好在这里结束时，按方法注册的servlet
+        std::vector<std::pair<HttpMethod, IServletCreator::ptr> > methods;
+        /// 匹配这里往下所有路径的模糊匹配servlet
+        IServletCreator::ptr wildcard;
+        /// 模糊匹配servlet的添加顺序
+        size_t wildcardOrder = 0;
+
+        const Node *find(StringView seg) const {
+            auto it = std::lower_bound(children.begin(), children.end(), seg,
+                                       [](const std::pair<std::string, std::unique_ptr<Node> > &lhs, StringView rhs) {
+                                           return StringView(lhs.first) < rhs;
+                                       });
+            return it != children.end() && StringView(it->first) == seg ? it->second.get() : nullptr;
+        }
+
+        Node *getOrCreate(const std::string &seg) {
+            auto it = std::lower_bound(children.begin(), children.end(), seg,
+                                       [](const std::pair<std::string, std::unique_ptr<Node> > &lhs, const std::string &rhs) {
+                                           return lhs.first < rhs;
+                                       });
+            if (it == children.end() || it->first != seg) {
+                it = children.insert(it, std::make_pair(seg, std::unique_ptr<Node>(new Node)));
+            }
+            return it->second.get();
+        }
+
+        IServletCreator *get(HttpMethod method) const {
+            for (auto &i : methods) {
+                if (i.first == method) {
+                    return i.second.get();
+                }
+            }
+            return any.get();
+        }
+    };
+
+    /**
+     * @brief StringView的哈希，FNV-1a按8字节一组混合，比逐字节少很多次乘法
+     */
+    struct ViewHash {
+        size_t operator()(StringView v) const {
+            const char *p = v.data();
+            size_t n      = v.size();
+            uint64_t h    = 14695981039346656037ULL ^ n;
+            uint64_t w    = 0;
+            for (; n >= 8; p += 8, n -= 8) {
+                memcpy(&w, p, 8);
+                h = (h ^ w) * 1099511628211ULL;
+                h ^= h >> 29;
+            }
+            w = 0;
+            memcpy(&w, p, n);
+            h = (h ^ w) * 1099511628211ULL;
+            return h ^ (h >> 32);
+        }
+    };
+
+    /**
+     * @brief 模糊匹配，fnmatch
+     */
+    struct Glob {
+        std::string pattern;
+        IServletCreator::ptr creator;
+        size_t order;
+    };
+
+    /**
+     * @brief 从node往下匹配剩下的路径rest，静态段优先，走不通时回溯到路径参数
+     */
+    static IServletCreator *matchRoute(const Node *node, HttpMethod method, StringView rest, RouteParams *params) {
+        size_t slash    = rest.find('/');
+        StringView seg  = rest.substr(0, slash);
+        StringView next = slash == StringView::npos ? StringView() : rest.substr(slash + 1);
+        IServletCreator *creator = nullptr;
+
+        const Node *child = node->find(seg);
+        if (child) {
+            creator = slash == StringView::npos ? child->get(method) : matchRoute(child, method, next, params);
+            if (creator) {
+                return creator;
+            }
+        }
+        child = node->param.get();
+        if (child && !seg.empty()) {
+            size_t size = params ? params->size() : 0;
+            if (params) {
+                params->push_back(std::make_pair(StringView(child->paramName), seg));
+            }
+            creator = slash == StringView::npos ? child->get(method) : matchRoute(child, method, next, params);
+            if (!creator && params) {
+                params->resize(size);
+            }
+        }
+        return creator;
+    }
+
+private:
+    /// 根节点，第一段之前
+    Node m_root;
+    /// 不带路径参数的路由，整条路径一次哈希查找，键指向m_staticKeys
+    std::unordered_map<StringView, const Node *, ViewHash> m_statics;
+    /// m_statics的键，deque追加时已有元素不搬迁
+    std::deque<std::string> m_staticKeys;
+    /// 不能编译到树上的模糊匹配，按添加顺序
+    std::vector<Glob> m_fnmatchs;
+    /// 模糊匹配的数量，用来确定添加顺序
+    size_t m_globCount = 0;
+};
+
+/// 路由表版本号，所有分发器共用，保证版本在进程内唯一；有分发器创建、修改注册信息或析构时增加
+static std::atomic<uint64_t> s_route_version{0};
+
+namespace {
+/**
+ * @brief 查找线程缓存的路由表
+ * @details 按分发器的路由表版本号分槽，版本号在进程内唯一，同一个线程交替使用几个分发器时互不挤占
+ */
+struct RouteCache {
+    /// 槽数，一个线程一般只用到一两个分发器
+    static const size_t SLOTS = 4;
+    /// 上次检查时的全局版本号，变了就清空所有槽，过期的路由表和析构了的分发器的servlet不会一直留在线程里
+    uint64_t epoch = 0;
+    /// 每个槽缓存的路由表版本，0表示空
+    uint64_t versions[SLOTS] = {0};
+    /// 每个槽缓存的路由表
+    std::shared_ptr<const RouteTable> tables[SLOTS];
+    /// 没有命中时下一个替换的槽
+    size_t next = 0;
+};
+} // namespace
+
+static thread_local RouteCache t_route_cache;
+
 FunctionServlet::FunctionServlet(callback cb)
     :Servlet("FunctionServlet")
     ,m_cb(cb) {
@@ -18,14 +281,24 @@ int32_t FunctionServlet::handle(sylar::http::HttpRequest::ptr request
 
 
 ServletDispatch::ServletDispatch()
-    :Servlet("ServletDispatch") {
+    :Servlet("ServletDispatch")
+    ,m_version(++s_route_version) {
     m_default.reset(new NotFoundServlet("sylar/1.0"));
 }
 
+ServletDispatch::~ServletDispatch() {
+    ++s_route_version;
+}
+
 int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request
                , sylar::http::HttpResponse::ptr response
                , sylar::http::HttpSession::ptr session) {
-    auto slt = getMatchedServlet(request->getPath());
+    RouteParams params;
+    auto slt = getMatchedServlet(request->getMethod(), request->getPathView(), &params);
+    for(auto& i : params) {
+        request->setParam(std::string(i.first.data(), i.first.size())
+                        , std::string(i.second.data(), i.second.size()));
+    }
     if(slt) {
         slt->handle(request, response, session);
     }
@@ -35,11 +308,13 @@ int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request
 void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
     RWMutexType::WriteLock lock(m_mutex);
     m_datas[uri] = std::make_shared<HoldServletCreator>(slt);
+    invalidate();
 }
 
 void ServletDispatch::addServletCreator(const std::string& uri, IServletCreator::ptr creator) {
     RWMutexType::WriteLock lock(m_mutex);
     m_datas[uri] = creator;
+    invalidate();
 }
 
 void ServletDispatch::addGlobServletCreator(const std::string& uri, IServletCreator::ptr creator) {
@@ -52,6 +327,7 @@ void ServletDispatch::addGlobServletCreator(const std::string& uri, IServletCrea
         }
     }
     m_globs.push_back(std::make_pair(uri, creator));
+    invalidate();
 }
 
 void ServletDispatch::addServlet(const std::string& uri
@@ -59,6 +335,19 @@ void ServletDispatch::addServlet(const std::string& uri
     RWMutexType::WriteLock lock(m_mutex);
     m_datas[uri] = std::make_shared<HoldServletCreator>(
                         std::make_shared<FunctionServlet>(cb));
+    invalidate();
+}
+
+void ServletDispatch::addServlet(HttpMethod method, const std::string& uri
+                        ,Servlet::ptr slt) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_methodDatas[std::make_pair(method, uri)] = std::make_shared<HoldServletCreator>(slt);
+    invalidate();
+}
+
+void ServletDispatch::addServlet(HttpMethod method, const std::string& uri
+                        ,FunctionServlet::callback cb) {
+    addServlet(method, uri, std::make_shared<FunctionServlet>(cb));
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri
@@ -73,6 +362,7 @@ void ServletDispatch::addGlobServlet(const std::string& uri
     }
     m_globs.push_back(std::make_pair(uri
                 , std::make_shared<HoldServletCreator>(slt)));
+    invalidate();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri
@@ -83,6 +373,13 @@ void ServletDispatch::addGlobServlet(const std::string& uri
 void ServletDispatch::delServlet(const std::string& uri) {
     RWMutexType::WriteLock lock(m_mutex);
     m_datas.erase(uri);
+    invalidate();
+}
+
+void ServletDispatch::delServlet(HttpMethod method, const std::string& uri) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_methodDatas.erase(std::make_pair(method, uri));
+    invalidate();
 }
 
 void ServletDispatch::delGlobServlet(const std::string& uri) {
@@ -94,6 +391,7 @@ void ServletDispatch::delGlobServlet(const std::string& uri) {
             break;
         }
     }
+    invalidate();
 }
 
 Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
@@ -114,18 +412,66 @@ Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
 }
 
 Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri) {
-    RWMutexType::ReadLock lock(m_mutex);
-    auto mit = m_datas.find(uri);
-    if(mit != m_datas.end()) {
-        return mit->second->get();
+    return getMatchedServlet(HttpMethod::INVALID_METHOD, uri);
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(HttpMethod method, StringView path, RouteParams* params) {
+    IServletCreator* creator = getRouteTable()->match(method, path, params);
+    return creator ? creator->get() : m_default;
+}
+
+void ServletDispatch::invalidate() {
+    // 先置空再换版本号，读到新版本号的线程一定读不到旧的路由表
+    std::atomic_store(&m_table, std::shared_ptr<const RouteTable>());
+    m_version.store(++s_route_version, std::memory_order_release);
+}
+
+std::shared_ptr<const RouteTable> ServletDispatch::buildRouteTable() {
+    RWMutexType::WriteLock lock(m_mutex);
+    std::shared_ptr<const RouteTable> table = std::atomic_load(&m_table);
+    if(table) {
+        return table;
     }
-    for(auto it = m_globs.begin();
-            it != m_globs.end(); ++it) {
-        if(!fnmatch(it->first.c_str(), uri.c_str(), 0)) {
-            return it->second->get();
+    std::shared_ptr<RouteTable> build(new RouteTable);
+    for(auto& i : m_datas) {
+        build->addRoute(HttpMethod::INVALID_METHOD, i.first, i.second);
+    }
+    for(auto& i : m_methodDatas) {
+        build->addRoute(i.first.first, i.first.second, i.second);
+    }
+    for(auto& i : m_globs) {
+        build->addGlob(i.first, i.second);
+    }
+    table = build;
+    std::atomic_store(&m_table, table);
+    return table;
+}
+
+const RouteTable* ServletDispatch::getRouteTable() {
+    RouteCache& cache = t_route_cache;
+    uint64_t epoch    = s_route_version.load(std::memory_order_acquire);
+    if(cache.epoch != epoch) {
+        for(size_t i = 0; i < RouteCache::SLOTS; ++i) {
+            cache.versions[i] = 0;
+            cache.tables[i].reset();
+        }
+        cache.epoch = epoch;
+    }
+    uint64_t version = m_version.load(std::memory_order_acquire);
+    for(size_t i = 0; i < RouteCache::SLOTS; ++i) {
+        if(cache.versions[i] == version) {
+            return cache.tables[i].get();
         }
     }
-    return m_default;
+    // 没有缓存时读发布的路由表，只有注册信息修改过才加锁重新编译
+    std::shared_ptr<const RouteTable> table = std::atomic_load(&m_table);
+    if(!table) {
+        table = buildRouteTable();
+    }
+    size_t slot = cache.next++ % RouteCache::SLOTS;
+    cache.versions[slot] = version;
+    cache.tables[slot] = std::move(table);
+    return cache.tables[slot].get();
 }
 
 void ServletDispatch::listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos) {
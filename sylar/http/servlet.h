@@ -9,6 +9,7 @@
 #ifndef __SYLAR_HTTP_SERVLET_H__
 #define __SYLAR_HTTP_SERVLET_H__
 
+#include <atomic>
 #include <memory>
 #include <functional>
 #include <string>
@@ -131,8 +132,19 @@ public:
     }
 };
 
+/// 路径参数，参数名 -> 路径里对应的一段，都指向路由表和请求路径里的内存
+typedef std::vector<std::pair<StringView, StringView> > RouteParams;
+
+class RouteTable;
+
 /**
  * @brief Servlet分发器
+ * @details 注册信息编译成按路径段的前缀树：
+ *          1. 精准匹配的uri里以':'开头的段是路径参数，比如/user/:id，匹配到的值通过request->getParam("id")获取
+ *          2. 模糊匹配的uri只在末尾有一个'*'并且'*'前面是'/'时，编译成树上的通配节点，其他形式仍然逐个fnmatch
+ *          3. 同一个uri可以按HTTP方法分别注册，方法对不上时使用不区分方法的servlet
+ *          查找时静态段优先于路径参数，精准匹配优先于模糊匹配，模糊匹配之间按添加顺序。
+ *          路由表只读，注册信息修改时丢弃，下次查找时重新编译；查找线程缓存路由表，版本没变时不加锁
  */
 class ServletDispatch : public Servlet {
 public:
@@ -145,6 +157,12 @@ public:
      * @brief 构造函数
      */
     ServletDispatch();
+
+    /**
+     * @brief 析构函数，换一次全局版本号，各线程下次查找时丢掉缓存的路由表，不再持有这里的servlet
+     */
+    ~ServletDispatch();
+
     virtual int32_t handle(sylar::http::HttpRequest::ptr request
                    , sylar::http::HttpResponse::ptr response
                    , sylar::http::HttpSession::ptr session) override;
@@ -163,6 +181,22 @@ public:
      */
     void addServlet(const std::string& uri, FunctionServlet::callback cb);
 
+    /**
+     * @brief 添加只处理method请求的servlet
+     * @param[in] method HTTP方法
+     * @param[in] uri uri
+     * @param[in] slt serlvet
+     */
+    void addServlet(HttpMethod method, const std::string& uri, Servlet::ptr slt);
+
+    /**
+     * @brief 添加只处理method请求的servlet
+     * @param[in] method HTTP方法
+     * @param[in] uri uri
+     * @param[in] cb FunctionServlet回调函数
+     */
+    void addServlet(HttpMethod method, const std::string& uri, FunctionServlet::callback cb);
+
     /**
      * @brief 添加模糊匹配servlet
      * @param[in] uri uri 模糊匹配 /sylar_*
@@ -196,6 +230,13 @@ public:
      */
     void delServlet(const std::string& uri);
 
+    /**
+     * @brief 删除只处理method请求的servlet
+     * @param[in] method HTTP方法
+     * @param[in] uri uri
+     */
+    void delServlet(HttpMethod method, const std::string& uri);
+
     /**
      * @brief 删除模糊匹配servlet
      * @param[in] uri uri
@@ -235,8 +276,33 @@ public:
      */
     Servlet::ptr getMatchedServlet(const std::string& uri);
 
+    /**
+     * @brief 通过方法和路径获取servlet
+     * @param[in] method HTTP方法，INVALID_METHOD表示只匹配不区分方法的servlet
+     * @param[in] path 请求路径
+     * @param[out] params 非空时保存路径参数，值指向path
+     * @return 优先精准匹配,其次模糊匹配,最后返回默认
+     */
+    Servlet::ptr getMatchedServlet(HttpMethod method, StringView path, RouteParams* params = nullptr);
+
     void listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
     void listAllGlobServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
+private:
+    /**
+     * @brief 注册信息变化，丢弃路由表
+     */
+    void invalidate();
+
+    /**
+     * @brief 返回当前线程缓存的路由表，过期时重新获取
+     * @details 返回的指针在当前线程下一次调用之前有效
+     */
+    const RouteTable* getRouteTable();
+
+    /**
+     * @brief 加写锁由注册信息编译路由表并发布，别的线程已经编译好时直接返回
+     */
+    std::shared_ptr<const RouteTable> buildRouteTable();
 private:
     /// 读写互斥量
     RWMutexType m_mutex;
@@ -246,6 +312,13 @@ private:
     /// 模糊匹配servlet 数组
     /// uri(/sylar/*) -> servlet
     std::vector<std::pair<std::string, IServletCreator::ptr> > m_globs;
+    /// 按方法注册的servlet
+    /// (method, uri) -> servlet
+    std::map<std::pair<HttpMethod, std::string>, IServletCreator::ptr> m_methodDatas;
+    /// 由注册信息编译出的路由表，注册信息修改时置空，用std::atomic_load/atomic_store读写，读的时候不加锁
+    std::shared_ptr<const RouteTable> m_table;
+    /// 路由表版本，所有分发器之间唯一，查找线程用它判断缓存的路由表是否过期
+    std::atomic<uint64_t> m_version;
     /// 默认servlet，所有路径都没匹配到时使用
     Servlet::ptr m_default;
 };
@@ -0,0 +1,188 @@
+/**
+ * @file inline_function.h
+ * @brief 小对象内联存储的回调函数封装
+ * @version 0.1
+ * @date 2021-06-15
+ */
+
+#ifndef __SYLAR_INLINE_FUNCTION_H__
+#define __SYLAR_INLINE_FUNCTION_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+/**
+ * @brief 只能移动的void()回调封装
+ * @details 与std::function相比，INLINE_SIZE字节以内并且移动不抛异常的可调用对象直接放在对象内部，
+ *          std::bind绑定几个智能指针或者lambda捕获少量变量都不会分配堆内存；超过大小的才放到堆上。
+ *          只支持移动，调度任务在队列之间传递时不会有拷贝
+ */
+class InlineFunction {
+public:
+    /// 内联存储大小，足够放下std::function或绑定了成员函数指针和两个shared_ptr的std::bind
+    static const size_t INLINE_SIZE = 64;
+
+    InlineFunction() {}
+
+    InlineFunction(std::nullptr_t) {}
+
+    /**
+     * @brief 从任意可调用对象构造，空的函数指针或std::function构造出来的也是空对象
+     */
+    template <class F, class = typename std::enable_if<
+                           !std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+    InlineFunction(F &&f) {
+        typedef typename std::decay<F>::type Fn;
+        Fn fn(std::forward<F>(f));
+        if (IsNull(fn)) {
+            return;
+        }
+        store(std::move(fn), std::integral_constant<bool, IsInline<Fn>::value>());
+    }
+
+    InlineFunction(InlineFunction &&other) noexcept {
+        moveFrom(other);
+    }
+
+    InlineFunction &operator=(InlineFunction &&other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineFunction &operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction &) = delete;
+    InlineFunction &operator=(const InlineFunction &) = delete;
+
+    ~InlineFunction() { reset(); }
+
+    /**
+     * @brief 调用，调用前必须确认非空
+     */
+    void operator()() { m_ops->invoke(&m_storage); }
+
+    /**
+     * @brief 是否非空
+     */
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    /**
+     * @brief 交换
+     */
+    void swap(InlineFunction &other) {
+        InlineFunction tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    /**
+     * @brief 置空，析构保存的可调用对象
+     */
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    /**
+     * @brief 针对具体类型的操作表
+     */
+    struct Ops {
+        void (*invoke)(void *);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *);
+    };
+
+    typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    template <class Fn>
+    struct IsInline {
+        static const bool value = sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(Storage)
+                                  && std::is_nothrow_move_constructible<Fn>::value;
+    };
+
+    /**
+     * @brief 内联存储的操作
+     */
+    template <class Fn>
+    struct InlineOps {
+        static void Invoke(void *p) { (*static_cast<Fn *>(p))(); }
+        static void Move(void *dst, void *src) {
+            new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+            static_cast<Fn *>(src)->~Fn();
+        }
+        static void Destroy(void *p) { static_cast<Fn *>(p)->~Fn(); }
+        static const Ops s_ops;
+    };
+
+    /**
+     * @brief 堆上存储的操作，内联存储区只放一个指针
+     */
+    template <class Fn>
+    struct HeapOps {
+        static void Invoke(void *p) { (**static_cast<Fn **>(p))(); }
+        static void Move(void *dst, void *src) {
+            *static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+        }
+        static void Destroy(void *p) { delete *static_cast<Fn **>(p); }
+        static const Ops s_ops;
+    };
+
+    template <class Fn>
+    static bool IsNull(const Fn &) { return false; }
+    template <class R, class... Args>
+    static bool IsNull(const std::function<R(Args...)> &f) { return !f; }
+    template <class R, class... Args>
+    static bool IsNull(R (*f)(Args...)) { return !f; }
+
+    template <class Fn>
+    void store(Fn &&fn, std::true_type) {
+        new (&m_storage) Fn(std::move(fn));
+        m_ops = &InlineOps<Fn>::s_ops;
+    }
+
+    template <class Fn>
+    void store(Fn &&fn, std::false_type) {
+        *reinterpret_cast<Fn **>(&m_storage) = new Fn(std::move(fn));
+        m_ops = &HeapOps<Fn>::s_ops;
+    }
+
+    void moveFrom(InlineFunction &other) {
+        if (other.m_ops) {
+            other.m_ops->move(&m_storage, &other.m_storage);
+            m_ops       = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+private:
+    /// 可调用对象的存储区
+    Storage m_storage;
+    /// 操作表，为nullptr表示空
+    const Ops *m_ops = nullptr;
+};
+
+template <class Fn>
+const InlineFunction::Ops InlineFunction::InlineOps<Fn>::s_ops = {
+    &InlineOps<Fn>::Invoke, &InlineOps<Fn>::Move, &InlineOps<Fn>::Destroy};
+
+template <class Fn>
+const InlineFunction::Ops InlineFunction::HeapOps<Fn>::s_ops = {
+    &HeapOps<Fn>::Invoke, &HeapOps<Fn>::Move, &HeapOps<Fn>::Destroy};
+
+} // namespace sylar
+
+#endif
@@ -0,0 +1,297 @@
+/**
+ * @file io_uring.cc
+ * @brief io_uring的简单封装实现
+ * @version 0.1
+ * @date 2021-06-16
+ */
+
+#include "io_uring.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "log.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+#ifdef SYLAR_HAS_IO_URING
+
+static int IoUringSetup(uint32_t entries, io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int IoUringEnter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int IoUringRegister(int fd, uint32_t opcode, void *arg, uint32_t nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = IoUringSetup(entries, &p);
+    if (m_fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno
+                                 << " errstr=" << strerror(errno);
+        return false;
+    }
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = (io_uring_sqe *)sqes;
+
+    char *sq    = (char *)m_sqRing;
+    m_sqHead    = (unsigned *)(sq + p.sq_off.head);
+    m_sqTail    = (unsigned *)(sq + p.sq_off.tail);
+    m_sqMask    = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sqArray   = (unsigned *)(sq + p.sq_off.array);
+    m_sqEntries = p.sq_entries;
+    m_sqeHead = m_sqeTail = *m_sqTail;
+
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (unsigned *)(cq + p.cq_off.head);
+    m_cqTail = (unsigned *)(cq + p.cq_off.tail);
+    m_cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes   = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+uint32_t IoUring::sqSpaceLeft() const {
+    return m_sqEntries - (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE));
+}
+
+io_uring_sqe *IoUring::getSqe() {
+    // 内核消费到哪里由m_sqHead表示，本地取出但还没提交的也占着位置
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqeTail - head >= m_sqEntries) {
+        return nullptr;
+    }
+    io_uring_sqe *sqe = &m_sqes[m_sqeTail & *m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submit() {
+    unsigned to_submit = m_sqeTail - m_sqeHead;
+    if (!to_submit) {
+        return 0;
+    }
+    // 提交项和数组下标一一对应，填好下标之后再发布新的队尾
+    unsigned tail = *m_sqTail;
+    for (; m_sqeHead != m_sqeTail; ++m_sqeHead, ++tail) {
+        m_sqArray[tail & *m_sqMask] = m_sqeHead & *m_sqMask;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+    int rt;
+    do {
+        rt = IoUringEnter(m_fd, to_submit, 0, 0);
+    } while (rt < 0 && errno == EINTR);
+    if (rt < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ", " << to_submit << ") errno="
+                                  << errno << " errstr=" << strerror(errno);
+    }
+    return rt;
+}
+
+io_uring_cqe *IoUring::peekCqe() {
+    unsigned head = *m_cqHead;
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &m_cqes[head & *m_cqMask];
+}
+
+void IoUring::cqeSeen() {
+    __atomic_store_n(m_cqHead, *m_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 同步取消ring_fd上所有针对fd的操作
+ */
+static int SyncCancelFd(int ring_fd, int fd) {
+#ifdef IORING_ASYNC_CANCEL_FD_FIXED
+    io_uring_sync_cancel_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.fd              = fd;
+    reg.flags           = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    reg.timeout.tv_sec  = -1;
+    reg.timeout.tv_nsec = -1;
+    return IoUringRegister(ring_fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int IoUring::cancelFd(int fd) {
+    if (!HasSyncCancel()) {
+        errno = ENOSYS;
+        return -1;
+    }
+    int rt = SyncCancelFd(m_fd, fd);
+    if (rt < 0 && errno != ENOENT) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring sync cancel fd=" << fd << " errno=" << errno
+                                  << " errstr=" << strerror(errno);
+    }
+    return rt;
+}
+
+/**
+ * @brief io_uring的探测结果
+ */
+struct IoUringProbe {
+    /// IOManager用到的操作码是否都支持
+    bool supported = false;
+    /// 是否支持IORING_REGISTER_SYNC_CANCEL
+    bool syncCancel = false;
+};
+
+/**
+ * @brief 创建一个临时的io_uring，探测需要的操作码是否都支持，以及是否支持同步取消
+ */
+static IoUringProbe ProbeIoUring() {
+    IoUringProbe rt;
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = IoUringSetup(2, &p);
+    if (fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring not supported, errno=" << errno << " errstr=" << strerror(errno);
+        return rt;
+    }
+    // 探测IOManager用到的操作码，IORING_OP_ASYNC_CANCEL用于不支持同步取消时按user_data取消
+    const size_t len = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    io_uring_probe *probe = (io_uring_probe *)calloc(1, len);
+    if (IoUringRegister(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        static const uint8_t s_ops[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_RECV, IORING_OP_SEND,
+                                        IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_LINK_TIMEOUT,
+                                        IORING_OP_ASYNC_CANCEL};
+        rt.supported = true;
+        for (auto op : s_ops) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                SYLAR_LOG_WARN(g_logger) << "io_uring opcode " << (int)op << " not supported";
+                rt.supported = false;
+            }
+        }
+    }
+    free(probe);
+
+    // 取消这个io_uring自己的fd上的操作，当然一个也没有，老内核不认识这个注册码时返回EINVAL
+    if (rt.supported) {
+        rt.syncCancel = (SyncCancelFd(fd, fd) >= 0 || (errno != EINVAL && errno != ENOSYS));
+        if (!rt.syncCancel) {
+            SYLAR_LOG_INFO(g_logger) << "io_uring sync cancel not supported, cancel by user_data instead";
+        }
+    }
+    close(fd);
+    return rt;
+}
+
+/**
+ * @brief 探测结果，只探测一次
+ */
+static const IoUringProbe &GetIoUringProbe() {
+    static const IoUringProbe s_probe = ProbeIoUring();
+    return s_probe;
+}
+
+bool IoUring::IsSupported() {
+    return GetIoUringProbe().supported;
+}
+
+bool IoUring::HasSyncCancel() {
+    return GetIoUringProbe().syncCancel;
+}
+
+#else
+
+IoUring::~IoUring() {
+}
+
+bool IoUring::init(uint32_t entries) {
+    return false;
+}
+
+uint32_t IoUring::sqSpaceLeft() const {
+    return 0;
+}
+
+io_uring_sqe *IoUring::getSqe() {
+    return nullptr;
+}
+
+int IoUring::submit() {
+    return -1;
+}
+
+io_uring_cqe *IoUring::peekCqe() {
+    return nullptr;
+}
+
+void IoUring::cqeSeen() {
+}
+
+int IoUring::cancelFd(int fd) {
+    errno = ENOSYS;
+    return -1;
+}
+
+bool IoUring::IsSupported() {
+    return false;
+}
+
+bool IoUring::HasSyncCancel() {
+    return false;
+}
+
+#endif
+
+} // namespace sylar
@@ -0,0 +1,137 @@
+/**
+ * @file io_uring.h
+ * @brief io_uring的简单封装
+ * @details 直接使用io_uring_setup/io_uring_enter系统调用和mmap映射的提交/完成队列，不依赖liburing。
+ * 一个IoUring只能由一个线程提交和收割，IOManager给每个调度线程分配一个。
+ * 编译环境没有<linux/io_uring.h>或者运行的内核不支持时init返回false，由调用方回退到epoll
+ * @version 0.1
+ * @date 2021-06-16
+ */
+
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "noncopyable.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define SYLAR_HAS_IO_URING 1
+#endif
+#endif
+
+#ifndef SYLAR_HAS_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace sylar {
+
+/**
+ * @brief 单线程使用的io_uring实例
+ */
+class IoUring : Noncopyable {
+public:
+    IoUring() {}
+
+    ~IoUring();
+
+    /**
+     * @brief 创建io_uring实例并映射提交/完成队列
+     * @param[in] entries 提交队列长度，完成队列是它的两倍
+     * @return 内核或编译环境不支持时返回false
+     */
+    bool init(uint32_t entries);
+
+    /**
+     * @brief io_uring的文件句柄，完成队列不为空时可读，可以放进epoll里等待
+     */
+    int getFd() const { return m_fd; }
+
+    /**
+     * @brief 取一个空闲的提交项，已经清零，提交队列满时返回nullptr
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief 还没有提交给内核的提交项数量
+     */
+    uint32_t pendingSubmit() const { return m_sqeTail - m_sqeHead; }
+
+    /**
+     * @brief 提交队列还能取出多少个提交项
+     */
+    uint32_t sqSpaceLeft() const;
+
+    /**
+     * @brief 把取出的提交项全部提交给内核，一次io_uring_enter
+     * @return 提交的数量，失败返回-1
+     */
+    int submit();
+
+    /**
+     * @brief 查看完成队列头部的完成项，没有时返回nullptr
+     * @details 处理完之后调用cqeSeen归还
+     */
+    io_uring_cqe *peekCqe();
+
+    /**
+     * @brief 归还peekCqe取出的完成项
+     */
+    void cqeSeen();
+
+    /**
+     * @brief 同步取消这个io_uring上所有针对fd的操作，可以在任意线程调用
+     * @details 被取消的操作以-ECANCELED完成，完成项照常由收割线程处理。
+     *          需要内核支持IORING_REGISTER_SYNC_CANCEL，不支持时返回-1，errno为ENOSYS，
+     *          调用方应改用IORING_OP_ASYNC_CANCEL按user_data逐个取消
+     * @return 取消的操作数量，失败返回-1
+     */
+    int cancelFd(int fd);
+
+    /**
+     * @brief 当前内核是否支持IOManager用到的io_uring操作，只检测一次
+     */
+    static bool IsSupported();
+
+    /**
+     * @brief 当前内核是否支持同步取消，即cancelFd是否可用，和IsSupported一起检测
+     */
+    static bool HasSyncCancel();
+
+private:
+    /// io_uring文件句柄
+    int m_fd = -1;
+    /// 提交队列的映射
+    void *m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    /// 完成队列的映射，支持IORING_FEAT_SINGLE_MMAP时与提交队列是同一块
+    void *m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    /// 提交项数组的映射
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    /// 提交队列的头、尾、掩码和下标数组，位于共享内存中
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned *m_sqMask = nullptr;
+    unsigned *m_sqArray = nullptr;
+    /// 提交队列长度
+    unsigned m_sqEntries = 0;
+    /// 本地已经取出的提交项区间[m_sqeHead, m_sqeTail)，submit时发布给内核
+    unsigned m_sqeHead = 0;
+    unsigned m_sqeTail = 0;
+
+    /// 完成队列的头、尾、掩码和完成项数组，位于共享内存中
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned *m_cqMask = nullptr;
+    io_uring_cqe *m_cqes = nullptr;
+};
+
+} // namespace sylar
+
+#endif
@@ -5,10 +5,14 @@
  * @date 2021-06-16
  */
 
-#include <unistd.h>    // for pipe()
-#include <sys/epoll.h> // for epoll_xxx()
-#include <fcntl.h>     // for fcntl()
+#include <unistd.h>      // for read()/write()
+#include <sys/epoll.h>   // for epoll_xxx()
+#include <sys/eventfd.h> // for eventfd()
+#include <poll.h>        // for poll()
+#include <fcntl.h>       // for fcntl()
+#include <algorithm>     // for std::find()
 #include "iomanager.h"
+#include "config.h"
 #include "log.h"
 #include "macro.h"
 
@@ -16,6 +20,44 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_iomanager_sharded_epoll =
+    Config::Lookup<bool>("iomanager.sharded_epoll", false, "one epoll instance per worker thread");
+
+static ConfigVar<bool>::ptr g_iomanager_persistent_events =
+    Config::Lookup<bool>("iomanager.persistent_events", true, "keep fds registered in epoll with EPOLLET until close");
+
+static ConfigVar<bool>::ptr g_iomanager_io_uring =
+    Config::Lookup<bool>("iomanager.io_uring", false, "use io_uring for hooked socket io, fall back to epoll when unsupported");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_io_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring_entries", 256, "io_uring submission queue entries per worker thread");
+
+/// io_uring句柄在epoll里的标记，最高位区分FdContext指针和eventfd，低位是调度线程下标
+static const uint64_t RING_EVENT_TAG = 1ull << 63;
+
+/// 本地队列还有任务时，io_uring提交项攒够这么多再提交
+static const uint32_t IO_URING_SUBMIT_BATCH = 32;
+
+/// 链接超时项的user_data标记，IoRequest至少8字节对齐，最低位区分操作本身和它的超时项
+static const uint64_t RING_TIMEOUT_TAG = 1;
+
+/// IOManager的编号，不复用
+static std::atomic<uint64_t> s_iomanager_id{0};
+
+/**
+ * @brief 持久注册模式的IOManager列表，fd关闭时逐个通知
+ * @details 故意不释放，进程退出阶段的close钩子也可以安全访问
+ */
+struct PersistentRegistry {
+    RWMutex mutex;
+    std::vector<IOManager *> ioms;
+};
+
+static PersistentRegistry &GetPersistentRegistry() {
+    static PersistentRegistry *s_registry = new PersistentRegistry;
+    return *s_registry;
+}
+
 enum EpollCtlOp {
 };
 
@@ -81,7 +123,7 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx) {
     ctx.cb = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, std::vector<ScheduleTask> *batch) {
     // 待触发的事件必须已被注册过
     SYLAR_ASSERT(events & event);
     /**
@@ -91,7 +133,18 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     events = (Event)(events & ~event);
     // 调度对应的协程
     EventContext &ctx = getEventContext(event);
-    if (ctx.cb) {
+    if (!ctx.cb) {
+        // 等待的协程醒来后会一直读写到EAGAIN，就绪状态由它消费掉；回调函数不一定会读写干净，保留就绪状态，
+        // 下次addEvent时直接再调度一次，避免边缘触发丢事件
+        ready = (Event)(ready & ~event);
+    }
+    if (batch && ctx.scheduler == Scheduler::GetThis()) {
+        if (ctx.cb) {
+            batch->push_back(ScheduleTask(std::move(ctx.cb), -1));
+        } else {
+            batch->push_back(ScheduleTask(&ctx.fiber, -1));
+        }
+    } else if (ctx.cb) {
         ctx.scheduler->schedule(ctx.cb);
     } else {
         ctx.scheduler->schedule(ctx.fiber);
@@ -100,68 +153,153 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-    : Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(5000);
-    SYLAR_ASSERT(m_epfd > 0);
-
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(!rt);
-
-    // 关注pipe读句柄的可读事件，用于tickle协程
+/**
+ * @brief 把eventfd以边缘触发的方式加入epoll，epoll_event里存的是fd的值或者带标记的下标，与FdContext指针区分开
+ */
+static void AddWakeFd(int epfd, int fd, uint64_t data) {
     epoll_event event;
     memset(&event, 0, sizeof(epoll_event));
-    event.events  = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+    event.events   = EPOLLIN | EPOLLET;
+    event.data.u64 = data;
 
-    // 非阻塞方式，配合边缘触发
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+    int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
     SYLAR_ASSERT(!rt);
+}
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, ReactorMode mode)
+    : Scheduler(threads, use_caller, name)
+    , m_id(++s_iomanager_id) {
+    if (mode == REACTOR_DEFAULT) {
+        mode = g_iomanager_sharded_epoll->getValue() ? REACTOR_SHARDED : REACTOR_SHARED;
+    }
+    m_sharded    = (mode == REACTOR_SHARDED);
+    m_persistent = g_iomanager_persistent_events->getValue();
+
+    // 每个调度线程的唤醒句柄，非阻塞方式，配合边缘触发
+    m_wakeFds.resize(getWorkerCount());
+    for (auto &fd : m_wakeFds) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(fd >= 0);
+    }
+    m_idleDeadlines = std::vector<std::atomic<uint64_t>>(getWorkerCount());
+
+    if (m_sharded) {
+        // 每个线程一个epoll句柄，自己的唤醒句柄也放进去
+        m_workerEpfds.resize(getWorkerCount());
+        for (size_t i = 0; i < m_workerEpfds.size(); ++i) {
+            m_workerEpfds[i] = epoll_create1(EPOLL_CLOEXEC);
+            SYLAR_ASSERT(m_workerEpfds[i] >= 0);
+            AddWakeFd(m_workerEpfds[i], m_wakeFds[i], m_wakeFds[i]);
+        }
+    } else {
+        m_epfd = epoll_create(5000);
+        SYLAR_ASSERT(m_epfd > 0);
+
+        // 领导者的唤醒句柄放在共享的epoll里，跟随者各自的唤醒句柄不加入epoll，唤醒一个跟随者不会惊动其他线程
+        m_leaderWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(m_leaderWakeFd >= 0);
+        AddWakeFd(m_epfd, m_leaderWakeFd, m_leaderWakeFd);
+    }
+
+    if (g_iomanager_io_uring->getValue()) {
+        // 每个调度线程一个io_uring，句柄放进这个线程会等待的epoll里，有完成项时唤醒
+        bool ok = IoUring::IsSupported();
+        for (size_t i = 0; ok && i < getWorkerCount(); ++i) {
+            m_rings.push_back(new IoUring);
+            ok = m_rings.back()->init(g_iomanager_io_uring_entries->getValue());
+        }
+        if (ok) {
+            m_ringSeqs.resize(m_rings.size(), 0);
+            for (size_t i = 0; i < m_rings.size(); ++i) {
+                AddWakeFd(m_sharded ? m_workerEpfds[i] : m_epfd, m_rings[i]->getFd(), RING_EVENT_TAG | i);
+            }
+        } else {
+            SYLAR_LOG_WARN(g_logger) << "io_uring unavailable, IOManager " << name << " falls back to epoll";
+            for (auto ring : m_rings) {
+                delete ring;
+            }
+            m_rings.clear();
+        }
+    }
 
-    contextResize(32);
+    initTimerShards(getWorkerCount());
+
+    if (m_persistent) {
+        PersistentRegistry &registry = GetPersistentRegistry();
+        RWMutex::WriteLock lock(registry.mutex);
+        registry.ioms.push_back(this);
+    }
 
     start();
 }
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    if (m_persistent) {
+        PersistentRegistry &registry = GetPersistentRegistry();
+        RWMutex::WriteLock lock(registry.mutex);
+        registry.ioms.erase(std::find(registry.ioms.begin(), registry.ioms.end(), this));
+    }
+    if (m_sharded) {
+        for (auto fd : m_workerEpfds) {
+            close(fd);
         }
+    } else {
+        close(m_epfd);
+        close(m_leaderWakeFd);
+    }
+    for (auto fd : m_wakeFds) {
+        close(fd);
     }
+    for (auto ring : m_rings) {
+        delete ring;
+    }
+    // 归还挂在FdCtx上的事件上下文，之后创建的IOManager可以复用
+    FdMgr::GetInstance()->releaseEventSlots(m_id, [](FdEventSlot *slot) {
+        FdContext *fd_ctx = static_cast<FdContext *>(slot);
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        fd_ctx->resetEventContext(fd_ctx->read);
+        fd_ctx->resetEventContext(fd_ctx->write);
+        fd_ctx->epfd       = -1;
+        fd_ctx->events     = NONE;
+        fd_ctx->registered = NONE;
+        fd_ctx->ready      = NONE;
+        fd_ctx->ringOps    = 0;
+        fd_ctx->ringMask   = 0;
+        fd_ctx->ringReqs   = nullptr;
+    });
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+IOManager::FdContext *IOManager::getFdContext(int fd) {
+    FdContext *fd_ctx = findFdContext(fd);
+    if (SYLAR_LIKELY(fd_ctx)) {
+        return fd_ctx;
+    }
+    return static_cast<FdContext *>(FdMgr::GetInstance()->getEventSlot(fd, m_id, [fd]() {
+        FdContext *fd_ctx = new FdContext;
+        fd_ctx->fd        = fd;
+        return fd_ctx;
+    }));
+}
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i]     = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
+int IOManager::selectEpfd() {
+    if (!m_sharded) {
+        return m_epfd;
     }
+    int index = getWorkerIndex();
+    if (index < 0) {
+        // caller线程只在stop时才参与调度，不给它分配
+        size_t first = (isUseCaller() && m_workerEpfds.size() > 1) ? 1 : 0;
+        index        = first + m_nextShard++ % (m_workerEpfds.size() - first);
+    }
+    return m_workerEpfds[index];
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     // 找到fd对应的FdContext，如果不存在，那就分配一个
-    FdContext *fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext *fd_ctx = getFdContext(fd);
+    if (SYLAR_UNLIKELY(!fd_ctx)) {
+        return -1;
     }
 
     // 同一个fd不允许重复添加相同的事件
@@ -173,19 +311,68 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
 
-    // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    if (m_persistent) {
+        if (fd_ctx->ready & event) {
+            // 上次等待之后epoll又报告过就绪，不用注册，就绪状态只用一次，调用方重试后还是EAGAIN的话再来等
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            ++m_readyHitCount;
+            if (!cb) {
+                return 1;
+            }
+            Scheduler::GetThis()->schedule(std::move(cb));
+            return 0;
+        }
+        if (!(fd_ctx->registered & event)) {
+            // 第一次等待这个事件，和已经注册的事件一起以边缘触发方式注册，之后一直保留到fd关闭
+            int op = fd_ctx->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            if (op == EPOLL_CTL_ADD) {
+                fd_ctx->epfd = selectEpfd();
+            }
+            epoll_event epevent;
+            epevent.events   = EPOLLET | EPOLLRDHUP | fd_ctx->registered | event;
+            epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                                  << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+            ++m_epollCtlCount;
+            int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+            if (rt && op == EPOLL_CTL_MOD && errno == ENOENT) {
+                // 之前的fd没有经过hook的close就关掉了(dup2、fclose、直接系统调用等)，内核里的注册随旧文件一起删掉了，
+                // 留下的注册和就绪状态都是旧文件的，丢掉之后重新添加
+                fd_ctx->registered = NONE;
+                fd_ctx->ready      = NONE;
+                fd_ctx->epfd       = selectEpfd();
+                op                 = EPOLL_CTL_ADD;
+                epevent.events     = EPOLLET | EPOLLRDHUP | event;
+                ++m_epollCtlCount;
+                rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+            }
+            if (rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                          << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                          << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->registered="
+                                          << (EPOLL_EVENTS)fd_ctx->registered;
+                return -1;
+            }
+            fd_ctx->registered = (Event)(fd_ctx->registered | event);
+        }
+    } else {
+            // 将新的事件加入epoll_wait，使用epoll_event的私有指针存储FdContext的位置
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (op == EPOLL_CTL_ADD) {
+            fd_ctx->epfd = selectEpfd();
+        }
+        epoll_event epevent;
+        epevent.events   = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                                      << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
     }
 
     // 待执行IO事件数加1
@@ -209,12 +396,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 
 bool IOManager::delEvent(int fd, Event event) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = findFdContext(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
@@ -222,18 +407,22 @@ bool IOManager::delEvent(int fd, Event event) {
     }
 
     // 清除指定的事件，表示不关心这个事件了，如果清除之后结果为0，则从epoll_wait中删除该文件描述符
+    // 持久注册模式下epoll里的注册保持不变，只清掉等待者
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistent) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 待执行事件数减1
@@ -247,31 +436,32 @@ bool IOManager::delEvent(int fd, Event event) {
 
 bool IOManager::cancelEvent(int fd, Event event) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = findFdContext(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
         return false;
     }
 
-    // 删除事件
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    // 删除事件，持久注册模式下不动epoll
+    if (!m_persistent) {
+        Event new_events = (Event)(fd_ctx->events & ~event);
+        int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 删除之前触发一次事件
@@ -281,32 +471,89 @@ bool IOManager::cancelEvent(int fd, Event event) {
     return true;
 }
 
+/**
+ * @brief 一次io_uring操作，放在发起操作的协程栈上，完成项的user_data指向它
+ */
+struct IOManager::IoRequest {
+    /// 等待操作完成的协程
+    Fiber::ptr fiber;
+    /// 操作的fd
+    FdContext *fd_ctx = nullptr;
+    /// 完成项的结果
+    int res = 0;
+    /// 还要收割几个完成项，带超时的操作还有超时项的，都收割完才能恢复协程
+    int waiting = 1;
+    /// 链接的超时项是否真的到期了
+    bool timedOut = false;
+    /// 提交到哪个调度线程的io_uring上
+    size_t index = 0;
+    /// 在这个io_uring上的序号
+    uint64_t seq = 0;
+    /// fd上还没完成的操作链表
+    IoRequest *prev = nullptr;
+    IoRequest *next = nullptr;
+};
+
 bool IOManager::cancelAll(int fd) {
     // 找到fd对应的FdContext
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = findFdContext(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if (SYLAR_UNLIKELY(fd_ctx->ringOps)) {
+        // 还有协程挂在io_uring操作上，到提交它们的io_uring上取消，被取消的操作照常由对应的线程收割，
+        // 取消时不持有fd的锁，收割线程需要它
+        if (IoUring::HasSyncCancel()) {
+            uint64_t mask = fd_ctx->ringMask;
+            lock2.unlock();
+            for (size_t i = 0; i < m_rings.size(); ++i) {
+                if (mask & (1ull << (i & 63))) {
+                    m_rings[i]->cancelFd(fd);
+                }
+            }
+        } else {
+            // 内核不支持同步取消，只能提交IORING_OP_ASYNC_CANCEL按user_data取消，提交项只能由io_uring所属的线程填写，
+            // 记下每个io_uring上要取消的最大序号，之后复用这个fd提交的操作序号更大，不会被误取消
+            std::vector<uint64_t> seqs(m_rings.size(), 0);
+            for (IoRequest *req = fd_ctx->ringReqs; req; req = req->next) {
+                seqs[req->index] = std::max(seqs[req->index], req->seq);
+            }
+            lock2.unlock();
+            int self = getWorkerIndex();
+            for (size_t i = 0; i < seqs.size(); ++i) {
+                if (!seqs[i]) {
+                    continue;
+                }
+                if ((int)i == self) {
+                    cancelRingOps(fd_ctx, i, seqs[i]);
+                } else {
+                    schedule(std::bind(&IOManager::cancelRingOps, this, fd_ctx, i, seqs[i]), getWorkerThreadId(i));
+                }
+            }
+        }
+        lock2.lock();
+    }
     if (!fd_ctx->events) {
         return false;
     }
 
-    // 删除全部事件
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = 0;
-    epevent.data.ptr = fd_ctx;
+    // 删除全部事件，持久注册模式下留到fd关闭时再从epoll删除
+    if (!m_persistent) {
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = 0;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                      << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     // 触发全部已注册的事件
@@ -327,18 +574,220 @@ IOManager *IOManager::GetThis() {
     return dynamic_cast<IOManager *>(Scheduler::GetThis());
 }
 
+int IOManager::submitIo(uint8_t opcode, int fd, const void *addr, uint32_t len, uint64_t off,
+                        uint32_t op_flags, uint64_t timeout_ms) {
+#ifdef SYLAR_HAS_IO_URING
+    int index = getWorkerIndex();
+    if (m_rings.empty() || index < 0) {
+        return -EAGAIN;
+    }
+    IoUring *ring    = m_rings[index];
+    bool has_timeout = (timeout_ms != ~0ull);
+    // 带超时的操作后面链接一个超时项，两个提交项必须在同一批里提交
+    if (ring->sqSpaceLeft() < (has_timeout ? 2u : 1u)) {
+        ring->submit();
+    }
+    io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        return -EAGAIN;
+    }
+
+    // 记录fd上还有哪些io_uring在执行它的操作，关闭fd时去取消
+    IoRequest req;
+    req.fd_ctx  = getFdContext(fd);
+    req.index   = index;
+    req.seq     = ++m_ringSeqs[index];
+    req.waiting = has_timeout ? 2 : 1;
+    {
+        FdContext::MutexType::Lock lock(req.fd_ctx->mutex);
+        ++req.fd_ctx->ringOps;
+        req.fd_ctx->ringMask |= 1ull << (index & 63);
+        req.next = req.fd_ctx->ringReqs;
+        if (req.next) {
+            req.next->prev = &req;
+        }
+        req.fd_ctx->ringReqs = &req;
+    }
+    req.fiber      = Fiber::GetThis();
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)addr;
+    sqe->len       = len;
+    sqe->off       = off;
+    sqe->msg_flags = op_flags;
+    sqe->user_data = (uint64_t)&req;
+
+    // 超时项的时间在提交时就被内核读走，放在栈上即可；超时后超时项以-ETIME完成，操作以-ECANCELED完成
+    __kernel_timespec ts;
+    if (has_timeout) {
+        sqe->flags |= IOSQE_IO_LINK;
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+        io_uring_sqe *timeout_sqe = ring->getSqe();
+        timeout_sqe->opcode       = IORING_OP_LINK_TIMEOUT;
+        timeout_sqe->addr         = (uint64_t)&ts;
+        timeout_sqe->len          = 1;
+        timeout_sqe->user_data    = (uint64_t)&req | RING_TIMEOUT_TAG;
+    }
+    ++m_pendingEventCount;
+
+    // 让出之后由afterTask或者idle提交，完成时由本线程收割并重新调度
+    Fiber::GetThis()->yield();
+
+    // 只有超时项真的到期才算超时，fd关闭时被取消的操作同样是-ECANCELED
+    if (req.timedOut && req.res == -ECANCELED) {
+        return -ETIMEDOUT;
+    }
+    return req.res;
+#else
+    return -EAGAIN;
+#endif
+}
+
+void IOManager::reapIoUring(size_t index, std::vector<ScheduleTask> &tasks) {
+#ifdef SYLAR_HAS_IO_URING
+    IoUring *ring = m_rings[index];
+    io_uring_cqe *cqe;
+    while ((cqe = ring->peekCqe())) {
+        uint64_t data = cqe->user_data;
+        int res       = cqe->res;
+        ring->cqeSeen();
+        if (!data) {
+            // cancelRingOps提交的取消项
+            continue;
+        }
+        IoRequest *req = (IoRequest *)(data & ~RING_TIMEOUT_TAG);
+        if (data & RING_TIMEOUT_TAG) {
+            // 链接的超时项，操作先完成时它以-ECANCELED完成
+            req->timedOut = (res == -ETIME);
+        } else {
+            req->res = res;
+        }
+        if (--req->waiting > 0) {
+            continue;
+        }
+        {
+            FdContext::MutexType::Lock lock(req->fd_ctx->mutex);
+            if (--req->fd_ctx->ringOps == 0) {
+                req->fd_ctx->ringMask = 0;
+            }
+            if (req->prev) {
+                req->prev->next = req->next;
+            } else {
+                req->fd_ctx->ringReqs = req->next;
+            }
+            if (req->next) {
+                req->next->prev = req->prev;
+            }
+        }
+        // 协程移出来之后就不能再访问req，协程恢复执行后它就失效了
+        tasks.push_back(ScheduleTask(&req->fiber, -1));
+        --m_pendingEventCount;
+    }
+#endif
+}
+
+void IOManager::cancelRingOps(FdContext *fd_ctx, size_t index, uint64_t seq) {
+#ifdef SYLAR_HAS_IO_URING
+    IoUring *ring = m_rings[index];
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    for (IoRequest *req = fd_ctx->ringReqs; req; req = req->next) {
+        if (req->index != index || req->seq > seq) {
+            continue;
+        }
+        io_uring_sqe *sqe = ring->getSqe();
+        if (!sqe) {
+            ring->submit();
+            sqe = ring->getSqe();
+            if (!sqe) {
+                break;
+            }
+        }
+        // 已经完成的操作取消时返回-ENOENT，完成项直接忽略
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->addr      = (uint64_t)req;
+        sqe->user_data = 0;
+    }
+    lock.unlock();
+    ring->submit();
+#endif
+}
+
+void IOManager::afterTask() {
+    if (m_rings.empty()) {
+        return;
+    }
+    int index = getWorkerIndex();
+    if (index < 0) {
+        return;
+    }
+    IoUring *ring = m_rings[index];
+    // 本地队列还有任务时先攒着，一批一起提交；没有任务了马上提交，避免延迟
+    uint32_t pending = ring->pendingSubmit();
+    if (pending && (pending >= IO_URING_SUBMIT_BATCH || !hasLocalTasks())) {
+        ring->submit();
+    }
+    std::vector<ScheduleTask> tasks;
+    reapIoUring(index, tasks);
+    if (!tasks.empty() && scheduleTasks(tasks)) {
+        tickle();
+    }
+}
+
+void IOManager::OnFdClosed(int fd) {
+    PersistentRegistry &registry = GetPersistentRegistry();
+    RWMutex::ReadLock lock(registry.mutex);
+    for (auto iom : registry.ioms) {
+        iom->forgetFd(fd);
+    }
+}
+
+void IOManager::forgetFd(int fd) {
+    FdContext *fd_ctx = findFdContext(fd);
+    if (!fd_ctx) {
+        return;
+    }
+
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if (fd_ctx->registered) {
+        ++m_epollCtlCount;
+        epoll_event epevent;
+        memset(&epevent, 0, sizeof(epevent));
+        int rt = epoll_ctl(fd_ctx->epfd, EPOLL_CTL_DEL, fd, &epevent);
+        // ENOENT说明旧文件没有经过hook的close就关掉了，内核里的注册已经没了
+        if (rt && errno != ENOENT) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                      << (EpollCtlOp)EPOLL_CTL_DEL << ", " << fd << "):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        }
+    }
+    fd_ctx->registered = NONE;
+    fd_ctx->ready      = NONE;
+}
+
 /**
  * 通知调度协程、也就是Scheduler::run()从idle中退出
  * Scheduler::run()每次从idle协程中退出之后，都会重新把任务队列里的所有任务执行完了再重新进入idle
  * 如果没有调度线程处理于idle状态，那也就没必要发通知了
  */
-void IOManager::tickle() {
-    SYLAR_LOG_DEBUG(g_logger) << "tickle";
-    if(!hasIdleThreads()) {
-        return;
-    }
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+/**
+ * @brief 清空eventfd的计数
+ */
+static void DrainEventFd(int fd) {
+    uint64_t dummy;
+    while (read(fd, &dummy, sizeof(dummy)) > 0)
+        ;
+}
+
+void IOManager::wakeWorker(size_t index) {
+    SYLAR_LOG_DEBUG(g_logger) << "wake worker " << index;
+    // 通知标志在调用前已经置位，目标线程先抢领导者再检查通知标志，两边按这个顺序读写，
+    // 这里读到的领导者不是它，它就一定能看到通知标志，不会阻塞在epoll_wait上。分片模式下eventfd就在它自己的epoll里
+    int fd       = (!m_sharded && m_leader == (int)index) ? m_leaderWakeFd : m_wakeFds[index];
+    uint64_t one = 1;
+    int rt       = write(fd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
 }
 
 bool IOManager::stopping() {
@@ -350,7 +799,7 @@ bool IOManager::stopping(uint64_t &timeout) {
     // 对于IOManager而言，必须等所有待调度的IO事件都执行完了才可以退出
     // 增加定时器功能后，还应该保证没有剩余的定时器待触发
     timeout = getNextTimer();
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    return timeout == ~0ull && !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 /**
@@ -367,51 +816,113 @@ void IOManager::idle() {
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event *ptr) {
         delete[] ptr;
     });
+    // 本轮超时的定时器和就绪的事件先攒起来，最后一次性加入调度
+    std::vector<std::function<void()>> cbs;
+    std::vector<ScheduleTask> tasks;
+
+    int index = getWorkerIndex();
+    SYLAR_ASSERT(index >= 0);
+
+    int wake_fd = m_sharded ? m_wakeFds[index] : m_leaderWakeFd;
 
     while (true) {
+        // 先登记为空闲线程再检查定时器和任务队列，保证这之后加入的任务或定时器一定会唤醒到某个空闲线程
+        idleBegin();
+        // 刷新线程缓存的时钟，计算超时和收集定时器都用它
+        RefreshCoarseClock();
+
         // 获取下一个定时器的超时时间，顺便判断调度器是否停止
         uint64_t next_timeout = 0;
         if( SYLAR_UNLIKELY(stopping(next_timeout))) {
             SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+            idleEnd();
+            // 阻塞在eventfd上的线程不会被IO事件唤醒，全部叫醒让它们也退出
+            tickleAll();
             break;
         }
 
-        // 阻塞在epoll_wait上，等待事件发生或定时器超时
-        int rt = 0;
-        do{
-            // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
-            static const int MAX_TIMEOUT = 5000;
-            if(next_timeout != ~0ull) {
-                next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
-            } else {
-                next_timeout = MAX_TIMEOUT;
-            }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
-            if(rt < 0 && errno == EINTR) {
-                continue;
-            } else {
-                break;
+        // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时，避免定时器超时时间太大时，epoll_wait一直阻塞
+        static const int MAX_TIMEOUT = 5000;
+        if(next_timeout != ~0ull) {
+            next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
+        } else {
+            next_timeout = MAX_TIMEOUT;
+        }
+        if (!m_rings.empty()) {
+            // 挂起的协程攒下的io_uring操作全部提交，已经完成的直接收割，有协程要恢复就不阻塞
+            m_rings[index]->submit();
+            reapIoUring(index, tasks);
+        }
+        bool block = !idleNotified() && !hasTasksForIdle() && tasks.empty();
+        if (block) {
+            // 先公布阻塞的截止时间再检查信箱，其他线程投递定时器之后再读截止时间，两边至少有一边能看到对方
+            m_idleDeadlines[index] = CoarseNowMS() + next_timeout;
+            block = !hasTimerShardChanges();
+        }
+
+        int rt         = 0;
+        int leader     = -1;
+        bool is_leader = false;
+        bool woken     = false;
+        if (m_sharded) {
+            // 分片模式，阻塞在自己的epoll句柄上，等待本线程的IO事件、定时器超时或被tickle
+            do {
+                ++m_epollWaitCount;
+                rt = epoll_wait(m_workerEpfds[index], events, MAX_EVNETS, block ? (int)next_timeout : 0);
+            } while (rt < 0 && errno == EINTR);
+        } else if ((is_leader = m_leader.compare_exchange_strong(leader, index))) {
+            // 成为领导者，阻塞在epoll_wait上，等待事件发生、定时器超时或被tickle；抢到之后再看一次通知标志
+            // 其他线程重置定时器时可能没看到自己成为领导者，信箱不为空时也不阻塞
+            int timeout = (block && !idleNotified() && !hasTimerShardChanges()) ? (int)next_timeout : 0;
+            do {
+                ++m_epollWaitCount;
+                rt = epoll_wait(m_epfd, events, MAX_EVNETS, timeout);
+            } while (rt < 0 && errno == EINTR);
+            m_leader = -1;
+        } else if (block) {
+            // 已经有领导者在等IO事件，阻塞在自己的eventfd上，等待被tickle；启用io_uring时同时等自己的完成队列
+            pollfd pfds[2];
+            pfds[0].fd     = m_wakeFds[index];
+            pfds[0].events = POLLIN;
+            nfds_t nfds    = 1;
+            if (!m_rings.empty()) {
+                pfds[1].fd     = m_rings[index]->getFd();
+                pfds[1].events = POLLIN;
+                nfds           = 2;
             }
-        } while(true);
+            while (poll(pfds, nfds, (int)next_timeout) < 0 && errno == EINTR)
+                ;
+            woken = pfds[0].revents & POLLIN;
+        }
+        if (!m_sharded && (woken || idleNotified())) {
+            // 被通知过的话自己的eventfd上可能有计数，读掉避免下次空转
+            DrainEventFd(m_wakeFds[index]);
+        }
+        m_idleDeadlines[index] = 0;
+        idleEnd();
+        RefreshCoarseClock();
+
+        if (!m_rings.empty()) {
+            reapIoUring(index, tasks);
+        }
 
         // 收集所有已超时的定时器，执行回调函数
-        std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            for(const auto &cb : cbs) {
-                schedule(cb);
-            }
-            cbs.clear();
+        for (auto &cb : cbs) {
+            tasks.push_back(ScheduleTask(std::move(cb), -1));
         }
+        cbs.clear();
         
         // 遍历所有发生的事件，根据epoll_event的私有指针找到对应的FdContext，进行事件处理
         for (int i = 0; i < rt; ++i) {
             epoll_event &event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                // ticklefd[0]用于通知协程调度，这时只需要把管道里的内容读完即可
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
-                    ;
+            if (event.data.u64 == (uint64_t)wake_fd) {
+                // wake_fd用于唤醒当前线程，这时只需要把计数读掉即可
+                DrainEventFd(wake_fd);
+                continue;
+            }
+            if (event.data.u64 & RING_EVENT_TAG) {
+                // io_uring有完成项，自己的上面已经收割过了，其他线程的由它们自己收割
                 continue;
             }
 
@@ -423,16 +934,33 @@ void IOManager::idle() {
              * 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
              */ 
             if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                event.events |= (EPOLLIN | EPOLLOUT) & (m_persistent ? fd_ctx->registered : fd_ctx->events);
             }
             int real_events = NONE;
-            if (event.events & EPOLLIN) {
+            if (event.events & (EPOLLIN | EPOLLRDHUP)) {
                 real_events |= READ;
             }
             if (event.events & EPOLLOUT) {
                 real_events |= WRITE;
             }
 
+            if (m_persistent) {
+                // 已经在关闭的fd不再记录就绪状态；注册保持不变，只记录就绪状态并唤醒等待者
+                if (fd_ctx->registered == NONE) {
+                    continue;
+                }
+                fd_ctx->ready = (Event)(fd_ctx->ready | real_events);
+                if (fd_ctx->events & real_events & READ) {
+                    fd_ctx->triggerEvent(READ, &tasks);
+                    --m_pendingEventCount;
+                }
+                if (fd_ctx->events & real_events & WRITE) {
+                    fd_ctx->triggerEvent(WRITE, &tasks);
+                    --m_pendingEventCount;
+                }
+                continue;
+            }
+
             if ((fd_ctx->events & real_events) == NONE) {
                 continue;
             }
@@ -442,9 +970,10 @@ void IOManager::idle() {
             int op          = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
             event.events    = EPOLLET | left_events;
 
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            ++m_epollCtlCount;
+            int rt2 = epoll_ctl(fd_ctx->epfd, op, fd_ctx->fd, &event);
             if (rt2) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
                                           << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
                                           << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
                 continue;
@@ -452,15 +981,25 @@ void IOManager::idle() {
 
             // 处理已经发生的事件，也就是让调度器调度指定的函数或协程
             if (real_events & READ) {
-                fd_ctx->triggerEvent(READ);
+                fd_ctx->triggerEvent(READ, &tasks);
                 --m_pendingEventCount;
             }
             if (real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
+                fd_ctx->triggerEvent(WRITE, &tasks);
                 --m_pendingEventCount;
             }
         } // end for
 
+        // 本轮所有的定时器回调和IO事件只做一次入队操作
+        // 领导者离开epoll_wait后，顺便唤醒一个空闲线程接替它，两件事合并成一次tickle
+        bool need_tickle = is_leader && hasIdleThreads();
+        if (!tasks.empty() && scheduleTasks(tasks)) {
+            need_tickle = true;
+        }
+        if (need_tickle) {
+            tickle();
+        }
+
         /**
          * 一旦处理完所有的事件，idle协程yield，这样可以让调度协程(Scheduler::run)重新检查是否有新任务要调度
          * 上面triggerEvent实际也只是把对应的fiber重新加入调度，要执行的话还要等idle协程退出
@@ -473,8 +1012,37 @@ void IOManager::idle() {
     } // end while(true)
 }
 
+int IOManager::getTimerShardIndex() {
+    int index = getWorkerIndex();
+    return (isUseCaller() && index == 0) ? -1 : index;
+}
+
+void IOManager::onTimerShardChanged(size_t index, uint64_t next_ms) {
+    // 目标线程没有阻塞，或者在新的执行时间之前就会醒来，回到idle时自然会处理信箱
+    uint64_t deadline = m_idleDeadlines[index];
+    if (!deadline || next_ms >= deadline) {
+        return;
+    }
+    // 目标线程可能阻塞在自己的eventfd上，也可能是领导者，分片模式下eventfd就在它自己的epoll里
+    uint64_t one = 1;
+    int rt       = write(m_wakeFds[index], &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+    if (!m_sharded && m_leader == (int)index) {
+        rt = write(m_leaderWakeFd, &one, sizeof(one));
+        SYLAR_ASSERT(rt == sizeof(one));
+    }
+}
+
 void IOManager::onTimerInsertedAtFront() {
-    tickle();
+    if (m_sharded) {
+        // 每个空闲线程都按定时器超时时间等待，唤醒其中一个重新计算即可
+        tickle();
+        return;
+    }
+    // 只有领导者按定时器超时时间等待，直接唤醒它；此时没有领导者也写一下，下一个领导者会立即返回并重新计算超时
+    uint64_t one = 1;
+    int rt       = write(m_leaderWakeFd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
 }
 
 } // end namespace sylar
\ No newline at end of file
@@ -8,6 +8,8 @@
 #ifndef __SYLAR_IOMANAGER_H__
 #define __SYLAR_IOMANAGER_H__
 
+#include "fd_manager.h"
+#include "io_uring.h"
 #include "scheduler.h"
 #include "timer.h"
 
@@ -31,12 +33,30 @@ public:
         WRITE = 0x4,
     };
 
+    /**
+     * @brief epoll的使用方式
+     */
+    enum ReactorMode {
+        /// 由配置iomanager.sharded_epoll决定
+        REACTOR_DEFAULT = 0,
+        /// 所有调度线程共享一个epoll句柄，同一时刻只有一个空闲线程在epoll_wait
+        REACTOR_SHARED = 1,
+        /// 每个调度线程一个epoll句柄，fd的事件只在注册它的线程上处理
+        REACTOR_SHARDED = 2,
+    };
+
 private:
+    /**
+     * @brief 一次io_uring操作
+     */
+    struct IoRequest;
+
     /**
      * @brief socket fd上下文类
-     * @details 每个socket fd都对应一个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下文
+     * @details 每个socket fd都对应一个FdContext，包括fd的值，fd上的事件，以及fd的读写事件上下文。
+     *          FdContext挂在FdManager表里的FdCtx上，每个IOManager一个
      */
-    struct FdContext {
+    struct FdContext : public FdEventSlot {
         typedef Mutex MutexType;
         /**
          * @brief 事件上下文类
@@ -69,8 +89,9 @@ private:
          * @brief 触发事件
          * @details 根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
          * @param[in] event 事件类型
+         * @param[out] batch 不为空时，属于当前调度器的任务先攒到batch里，由调用方批量调度
          */
-        void triggerEvent(Event event);
+        void triggerEvent(Event event, std::vector<ScheduleTask> *batch = nullptr);
 
         /// 读事件上下文
         EventContext read;
@@ -78,8 +99,20 @@ private:
         EventContext write;
         /// 事件关联的句柄
         int fd = 0;
+        /// fd注册在哪个epoll句柄上，分片模式下也就决定了由哪个调度线程处理它的事件，从epoll删除后下次添加时重新选择
+        int epfd = -1;
         /// 该fd添加了哪些事件的回调函数，或者说该fd关心哪些事件
         Event events = NONE;
+        /// 持久注册模式下已经注册到epoll里的事件，注册之后一直保留到fd关闭
+        Event registered = NONE;
+        /// 持久注册模式下epoll报告过、还没有被等待者消费的就绪事件
+        Event ready = NONE;
+        /// 还没完成的io_uring操作数量
+        uint32_t ringOps = 0;
+        /// 这些操作提交到了哪些调度线程的io_uring上，按下标对64取模
+        uint64_t ringMask = 0;
+        /// 还没完成的io_uring操作链表，内核不支持同步取消时按user_data逐个取消
+        IoRequest *ringReqs = nullptr;
         /// 事件的Mutex
         MutexType mutex;
     };
@@ -90,8 +123,10 @@ public:
      * @param[in] threads 线程数量
      * @param[in] use_caller 是否将调用线程包含进去
      * @param[in] name 调度器的名称
+     * @param[in] mode epoll的使用方式，默认读配置
      */
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager",
+              ReactorMode mode = REACTOR_DEFAULT);
 
     /**
      * @brief 析构函数
@@ -104,7 +139,9 @@ public:
      * @param[in] fd socket句柄
      * @param[in] event 事件类型
      * @param[in] cb 事件回调函数，如果为空，则默认把当前协程作为回调执行体
-     * @return 添加成功返回0,失败返回-1
+     * @details 持久注册模式下事件已经就绪时不会挂起等待：cb为空时返回1，由调用方直接重试IO；
+     *          cb不为空时立即调度cb，返回0
+     * @return 添加成功返回0,事件已就绪返回1,失败返回-1
      */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
@@ -139,12 +176,64 @@ public:
      */
     static IOManager *GetThis();
 
+    /**
+     * @brief fd即将被关闭
+     * @details 持久注册模式下fd会一直留在epoll里，关闭前要从所有IOManager中删除并清掉就绪状态，
+     *          否则同一个fd号被复用时不会重新注册
+     * @param[in] fd socket句柄
+     */
+    static void OnFdClosed(int fd);
+
+    /**
+     * @brief 是否使用io_uring执行hook的IO操作
+     * @details 由配置iomanager.io_uring决定，默认关闭，内核不支持时回退到epoll。
+     *          test_io_uring_webserver的压测里它的吞吐量还不如epoll，所以默认不开
+     */
+    bool isIoUring() const { return !m_rings.empty(); }
+
+    /**
+     * @brief 用io_uring执行一次IO操作，当前协程挂起直到操作完成
+     * @details 提交项先放到当前调度线程的io_uring里，等协程让出之后再提交给内核，完成项也由这个线程收割，
+     *          所以不会出现协程还没挂起就被其他线程唤醒的情况。只能在本调度器的调度线程上的协程里调用
+     * @param[in] opcode io_uring操作码
+     * @param[in] fd 句柄
+     * @param[in] addr 缓冲区或者地址
+     * @param[in] len 缓冲区长度
+     * @param[in] off 偏移，accept时是地址长度的指针，connect时是地址长度
+     * @param[in] op_flags 操作的标志，比如send/recv的flags
+     * @param[in] timeout_ms 超时时间，-1表示不超时
+     * @return 成功返回非负数，失败返回-errno，超时返回-ETIMEDOUT；返回-EAGAIN时调用方应回退到epoll方式
+     */
+    int submitIo(uint8_t opcode, int fd, const void *addr, uint32_t len, uint64_t off,
+                 uint32_t op_flags, uint64_t timeout_ms);
+
+    /**
+     * @brief 是否使用持久注册模式
+     */
+    bool isPersistent() const { return m_persistent; }
+
+    /**
+     * @brief 累计调用epoll_ctl的次数
+     */
+    uint64_t getEpollCtlCount() const { return m_epollCtlCount; }
+
+    /**
+     * @brief 累计调用epoll_wait的次数
+     */
+    uint64_t getEpollWaitCount() const { return m_epollWaitCount; }
+
+    /**
+     * @brief 持久注册模式下addEvent发现事件已经就绪、不需要等待的次数
+     */
+    uint64_t getReadyHitCount() const { return m_readyHitCount; }
+
 protected:
     /**
-     * @brief 通知调度器有任务要调度
-     * @details 写pipe让idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
+     * @brief 唤醒一个空闲的调度线程
+     * @details 目标线程是当前阻塞在epoll_wait上的领导者时写m_leaderWakeFd，否则写它自己的eventfd，
+     *          待idle协程yield之后Scheduler::run就可以调度其他任务
      */
-    void tickle() override;
+    void wakeWorker(size_t index) override;
 
     /**
      * @brief 判断是否可以停止
@@ -152,9 +241,17 @@ protected:
      */
     bool stopping() override;
 
+    /**
+     * @brief 任务协程让出之后提交它攒下的io_uring操作，顺便收割已经完成的操作
+     */
+    void afterTask() override;
+
     /**
      * @brief idle协程
-     * @details 对于IO协程调度来说，应阻塞在等待IO事件上，idle退出的时机是epoll_wait返回，对应的操作是tickle或注册的IO事件发生
+     * @details 对于IO协程调度来说，应阻塞在等待IO事件上，idle退出的时机是epoll_wait返回，对应的操作是tickle或注册的IO事件发生。
+     *          采用领导者/跟随者模式：同一时刻只有一个空闲线程(领导者)阻塞在epoll_wait上，其他空闲线程阻塞在各自的eventfd上，
+     *          tickle只会唤醒其中一个，避免所有空闲线程抢同一个epoll句柄造成惊群。领导者返回后如果还有空闲线程，唤醒一个接替它。
+     *          分片模式下每个线程阻塞在自己的epoll句柄上，只处理绑定到本线程的fd，唤醒的eventfd也注册在自己的epoll句柄里
      */
     void idle() override;
 
@@ -171,22 +268,91 @@ protected:
     void onTimerInsertedAtFront() override;
 
     /**
-     * @brief 重置socket句柄上下文的容器大小
-     * @param[in] size 容量大小
+     * @brief 当前调度线程私有定时器集合的下标
+     * @details use_caller的主线程只在stop时参与调度，它添加的定时器放在全局集合里，由其他线程按时触发
+     */
+    int getTimerShardIndex() override;
+
+    /**
+     * @brief 其他线程重置或重新启用了index线程的私有定时器，它阻塞的截止时间晚于next_ms时唤醒它重新计算超时
+     */
+    void onTimerShardChanged(size_t index, uint64_t next_ms) override;
+
+    /**
+     * @brief 为一个新注册的fd选择epoll句柄
+     * @details 共享模式下总是m_epfd；分片模式下绑定到当前调度线程，非调度线程注册的fd轮流分给各个线程
+     */
+    int selectEpfd();
+
+    /**
+     * @brief 从epoll中删除fd的持久注册并清空就绪状态
+     * @param[in] fd socket句柄
+     */
+    void forgetFd(int fd);
+
+    /**
+     * @brief 收割调度线程io_uring的完成项，把等待的协程放到tasks里
+     * @param[in] index 调度线程下标
+     * @param[out] tasks 被唤醒的协程
+     */
+    void reapIoUring(size_t index, std::vector<ScheduleTask> &tasks);
+
+    /**
+     * @brief 用IORING_OP_ASYNC_CANCEL取消fd提交到本线程io_uring上的操作，必须在下标为index的调度线程上调用
+     * @details 内核不支持同步取消时cancelAll用它代替IoUring::cancelFd
+     * @param[in] fd_ctx fd上下文
+     * @param[in] index 调度线程下标
+     * @param[in] seq 只取消序号不大于seq的操作，fd关闭之后复用同一个fd提交的操作不受影响
+     */
+    void cancelRingOps(FdContext *fd_ctx, size_t index, uint64_t seq);
+
+    /**
+     * @brief 获取fd对应的FdContext，不存在时创建
+     * @return fd超出FdTable的范围时返回nullptr
+     */
+    FdContext *getFdContext(int fd);
+
+    /**
+     * @brief 不加锁查找fd对应的FdContext
+     * @return 不存在时返回nullptr
      */
-    void contextResize(size_t size);
+    FdContext *findFdContext(int fd) const {
+        return static_cast<FdContext *>(FdMgr::GetInstance()->findEventSlot(fd, m_id));
+    }
 
 private:
     /// epoll 文件句柄
     int m_epfd = 0;
-    /// pipe 文件句柄，fd[0]读端，fd[1]写端
-    int m_tickleFds[2];
+    /// 是否每个调度线程一个epoll句柄
+    bool m_sharded = false;
+    /// 分片模式下每个调度线程的epoll句柄
+    std::vector<int> m_workerEpfds;
+    /// 分片模式下非调度线程注册fd时轮流选择的下标
+    std::atomic<size_t> m_nextShard = {0};
+    /// 唤醒领导者的eventfd，注册在m_epfd里
+    int m_leaderWakeFd = -1;
+    /// 每个调度线程一个eventfd，跟随者阻塞在自己的eventfd上，分片模式下注册在自己的epoll句柄里
+    std::vector<int> m_wakeFds;
+    /// 每个调度线程阻塞等待的截止时间，0表示没有阻塞
+    std::vector<std::atomic<uint64_t>> m_idleDeadlines;
+    /// 当前阻塞在epoll_wait上的调度线程下标，-1表示没有
+    std::atomic<int> m_leader = {-1};
     /// 当前等待执行的IO事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// IOManager的Mutex
-    RWMutexType m_mutex;
-    /// socket事件上下文的容器
-    std::vector<FdContext *> m_fdContexts;
+    /// 是否持久注册，fd第一次等待时以边缘触发方式注册，之后不再修改，就绪状态缓存在FdContext里
+    bool m_persistent = false;
+    /// epoll_ctl调用次数
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    /// epoll_wait调用次数
+    std::atomic<uint64_t> m_epollWaitCount = {0};
+    /// addEvent时事件已经就绪的次数
+    std::atomic<uint64_t> m_readyHitCount = {0};
+    /// 启用io_uring时每个调度线程一个，只由对应的线程提交和收割
+    std::vector<IoUring *> m_rings;
+    /// 每个io_uring上操作的序号，只由对应的线程修改
+    std::vector<uint64_t> m_ringSeqs;
+    /// 编号，从1开始，不复用，用来在FdCtx上找到自己的FdContext
+    uint64_t m_id = 0;
 };
 
 } // end namespace sylar
@@ -9,6 +9,11 @@
 #include "log.h"
 #include "config.h"
 #include "env.h"
+#include "thread.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
 
 namespace sylar {
 
@@ -68,6 +73,21 @@ LogEvent::LogEvent(const std::string &logger_name, LogLevel::Level level, const
     , m_loggerName(logger_name) {
 }
 
+/**
+ * 写入位置就是内容长度，从头读出来直接拷到out里
+ */
+void LogEvent::appendContent(std::string &out) {
+    std::streambuf *buf = m_ss.rdbuf();
+    std::streamoff len  = buf->pubseekoff(0, std::ios::cur, std::ios::out);
+    if(len <= 0) {
+        return;
+    }
+    size_t offset = out.size();
+    out.resize(offset + len);
+    buf->pubseekpos(0, std::ios::in);
+    buf->sgetn(&out[offset], len);
+}
+
 void LogEvent::printf(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
@@ -84,136 +104,12 @@ void LogEvent::vprintf(const char *fmt, va_list ap) {
     }
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getContent();
-    }
-};
-
-class LevelFormatItem : public LogFormatter::FormatItem {
-public:
-    LevelFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << LogLevel::ToString(event->getLevel());
-    }
-};
-
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getElapse();
-    }
-};
-
-class LoggerNameFormatItem : public LogFormatter::FormatItem {
-public:
-    LoggerNameFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getLoggerName();
-    }
-};
-
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getThreadId();
-    }
-};
-
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getFiberId();
-    }
-};
-
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadNameFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getThreadName();
-    }
-};
-
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format) {
-        if(m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
-        }
-    }
-
-    void format(std::ostream& os, LogEvent::ptr event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
-    }
-private:
-    std::string m_format;
-};
-
-class FileNameFormatItem : public LogFormatter::FormatItem {
-public:
-    FileNameFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getFile();
-    }
-};
-
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << event->getLine();
-    }
-};
-
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << std::endl;
-    }
-};
-
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const std::string& str)
-        :m_string(str) {}
-    void format(std::ostream& os, LogEvent::ptr event) override {
-        os << m_string;
-    }
-private:
-    std::string m_string;
-};
-
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << "\t";
-    }
-};
-
-class PercentSignFormatItem : public LogFormatter::FormatItem {
-public:
-    PercentSignFormatItem(const std::string &str) {}
-    void format(std::ostream &os, LogEvent::ptr event) override {
-        os << "%";
-    }
-};
+/// 用来给LogFormatter编号
+static std::atomic<uint64_t> s_formatter_id{0};
 
 LogFormatter::LogFormatter(const std::string &pattern)
-    : m_pattern(pattern) {
+    : m_pattern(pattern)
+    , m_id(++s_formatter_id) {
     init();
 }
 
@@ -321,40 +217,52 @@ void LogFormatter::init() {
     // }
     // std::cout << "dataformat = " << dateformat << std::endl;
     
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)> > s_format_items = {
-#define XX(str, C)  {#str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt));} }
-
-        XX(m, MessageFormatItem),           // m:消息
-        XX(p, LevelFormatItem),             // p:日志级别
-        XX(c, LoggerNameFormatItem),        // c:日志器名称
-//        XX(d, DateTimeFormatItem),          // d:日期时间
-        XX(r, ElapseFormatItem),            // r:累计毫秒数
-        XX(f, FileNameFormatItem),          // f:文件名
-        XX(l, LineFormatItem),              // l:行号
-        XX(t, ThreadIdFormatItem),          // t:编程号
-        XX(F, FiberIdFormatItem),           // F:协程号
-        XX(N, ThreadNameFormatItem),        // N:线程名称
-        XX(%, PercentSignFormatItem),       // %:百分号
-        XX(T, TabFormatItem),               // T:制表符
-        XX(n, NewLineFormatItem),           // n:换行符
-#undef XX
-    };
-
+    // 编译成模板项，相邻的常规字符串合并成一项
     for(auto &v : patterns) {
+        std::string literal;
         if(v.first == 0) {
-            m_items.push_back(FormatItem::ptr(new StringFormatItem(v.second)));
-        } else if( v.second =="d") {
-            m_items.push_back(FormatItem::ptr(new DateTimeFormatItem(dateformat)));
+            literal = v.second;
         } else {
-            auto it = s_format_items.find(v.second);
-            if(it == s_format_items.end()) {
+            char type = v.second[0];
+            switch(type) {
+            case '%':   // %:百分号
+                literal = "%";
+                break;
+            case 'T':   // T:制表符
+                literal = "\t";
+                break;
+            case 'n':   // n:换行符
+                literal = "\n";
+                m_newLine = true;
+                break;
+            case 'd':   // d:日期时间
+                m_items.push_back(Item{type, dateformat.empty() ? "%Y-%m-%d %H:%M:%S" : dateformat});
+                continue;
+            case 'm':   // m:消息
+            case 'p':   // p:日志级别
+            case 'c':   // c:日志器名称
+            case 'r':   // r:累计毫秒数
+            case 'f':   // f:文件名
+            case 'l':   // l:行号
+            case 't':   // t:线程号
+            case 'F':   // F:协程号
+            case 'N':   // N:线程名称
+                m_items.push_back(Item{type, ""});
+                continue;
+            default:
                 std::cout << "[ERROR] LogFormatter::init() " << "pattern: [" << m_pattern << "] " << 
                 "unknown format item: " << v.second << std::endl;
                 error = true;
                 break;
-            } else {
-                m_items.push_back(it->second(v.second));
             }
+            if(error) {
+                break;
+            }
+        }
+        if(!m_items.empty() && m_items.back().type == 0) {
+            m_items.back().str += literal;
+        } else {
+            m_items.push_back(Item{0, literal});
         }
     }
 
@@ -364,17 +272,97 @@ void LogFormatter::init() {
     }
 }
 
-std::string LogFormatter::format(LogEvent::ptr event) {
-    std::stringstream ss;
-    for(auto &i:m_items) {
-        i->format(ss, event);
+void LogFormatter::appendDateTime(std::string &out, size_t index, time_t time) {
+    // 线程局部的缓存，按格式器编号和模板项下标区分，几个格式器交替使用时也不容易互相挤掉
+    struct DateTimeCache {
+        uint64_t id  = 0;
+        size_t index = 0;
+        time_t time  = 0;
+        std::string text;
+    };
+    static thread_local DateTimeCache t_caches[4];
+
+    DateTimeCache &cache = t_caches[(m_id + index) & 3];
+    if(cache.id != m_id || cache.index != index || cache.time != time) {
+        struct tm tm;
+        localtime_r(&time, &tm);
+        char buf[64];
+        size_t len = strftime(buf, sizeof(buf), m_items[index].str.c_str(), &tm);
+        cache.text.assign(buf, len);
+        cache.id    = m_id;
+        cache.index = index;
+        cache.time  = time;
     }
-    return ss.str();
+    out.append(cache.text);
+}
+
+void LogFormatter::format(std::string &out, const LogEvent::ptr &event) {
+    for(size_t i = 0; i < m_items.size(); ++i) {
+        const Item &item = m_items[i];
+        switch(item.type) {
+        case 0:
+            out.append(item.str);
+            break;
+        case 'm':
+            event->appendContent(out);
+            break;
+        case 'p':
+            out.append(LogLevel::ToString(event->getLevel()));
+            break;
+        case 'c':
+            out.append(event->getLoggerName());
+            break;
+        case 'r':
+            AppendInt(out, event->getElapse());
+            break;
+        case 'f':
+            if(event->getFile()) {
+                out.append(event->getFile());
+            }
+            break;
+        case 'l':
+            AppendInt(out, event->getLine());
+            break;
+        case 't':
+            AppendUint(out, event->getThreadId());
+            break;
+        case 'F':
+            AppendUint(out, event->getFiberId());
+            break;
+        case 'N':
+            out.append(event->getThreadName());
+            break;
+        case 'd':
+            appendDateTime(out, i, event->getTime());
+            break;
+        }
+    }
+}
+
+/**
+ * 缓冲区偶尔被一条很长的日志撑大时，下次用之前释放掉，不一直占着
+ */
+const std::string &LogFormatter::formatToBuffer(const LogEvent::ptr &event) {
+    static thread_local std::string t_buffer;
+    if(t_buffer.capacity() > 64 * 1024) {
+        std::string().swap(t_buffer);
+    }
+    t_buffer.clear();
+    format(t_buffer, event);
+    return t_buffer;
+}
+
+std::string LogFormatter::format(LogEvent::ptr event) {
+    std::string str;
+    format(str, event);
+    return str;
 }
 
 std::ostream &LogFormatter::format(std::ostream &os, LogEvent::ptr event) {
-    for(auto &i:m_items) {
-        i->format(os, event);
+    const std::string &str = formatToBuffer(event);
+    os.write(str.data(), str.size());
+    if(m_newLine) {
+        os.flush();
     }
     return os;
 }
@@ -386,6 +374,7 @@ LogAppender::LogAppender(LogFormatter::ptr default_formatter)
 void LogAppender::setFormatter(LogFormatter::ptr val) {
     MutexType::Lock lock(m_mutex);
     m_formatter = val;
+    m_formatterVersion.fetch_add(1, std::memory_order_release);
 }
 
 LogFormatter::ptr LogAppender::getFormatter() {
@@ -397,13 +386,14 @@ StdoutLogAppender::StdoutLogAppender()
     : LogAppender(LogFormatter::ptr(new LogFormatter)) {
 }
 
+/**
+ * 格式化在锁外做，锁内只写一次
+ */
 void StdoutLogAppender::log(LogEvent::ptr event) {
+    const std::string &str = getFormatter()->formatToBuffer(event);
     MutexType::Lock lock(m_mutex);
-    if(m_formatter) {
-        m_formatter->format(std::cout, event);
-    } else {
-        m_defaultFormatter->format(std::cout, event);
-    }
+    std::cout.write(str.data(), str.size());
+    std::cout.flush();
 }
 
 std::string StdoutLogAppender::toYamlString() {
@@ -440,17 +430,11 @@ void FileLogAppender::log(LogEvent::ptr event) {
     if(m_reopenError) {
         return;
     }
+    const std::string &str = getFormatter()->formatToBuffer(event);
     MutexType::Lock lock(m_mutex);
-    if(m_formatter) {
-        if(!m_formatter->format(m_filestream, event)) {
-            std::cout << "[ERROR] FileLogAppender::log() format error" << std::endl;
-        }
-    } else {
-        if(!m_defaultFormatter->format(m_filestream, event)) {
-            std::cout << "[ERROR] FileLogAppender::log() format error" << std::endl;
-        }
+    if(!m_filestream.write(str.data(), str.size()).flush()) {
+        std::cout << "[ERROR] FileLogAppender::log() format error" << std::endl;
     }
-    
 }
 
 bool FileLogAppender::reopen() {
@@ -474,6 +458,391 @@ std::string FileLogAppender::toYamlString() {
     return ss.str();
 }
 
+/**
+ * @brief AsyncFileLogAppender的单线程缓冲区，一个生产者一个消费者的字节环
+ * @details head只有所属线程写，tail只有后台线程写，日志整条放进去以后才更新head，
+ *          后台线程拿到的总是完整的日志
+ */
+struct AsyncFileLogAppender::Buffer {
+    Buffer(size_t size) {
+        capacity = 1;
+        while(capacity < size) {
+            capacity <<= 1;
+        }
+        data = new char[capacity];
+    }
+
+    ~Buffer() {
+        delete[] data;
+    }
+
+    /**
+     * @brief 放入一条日志，剩余空间不够时返回false
+     */
+    bool push(const char *p, size_t len) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if(capacity - (h - tail.load(std::memory_order_acquire)) < len) {
+            return false;
+        }
+        size_t offset = h & (capacity - 1);
+        size_t first  = std::min(len, capacity - offset);
+        memcpy(data + offset, p, first);
+        memcpy(data, p + first, len - first);
+        head.store(h + len, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 已使用的字节数
+     */
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    /// 数据区
+    char *data = nullptr;
+    /// 容量，2的幂
+    size_t capacity = 0;
+    /// 写入位置，只增不减
+    std::atomic<uint64_t> head{0};
+    /// 避免head和tail在同一个缓存行
+    char pad[64];
+    /// 读取位置，只增不减
+    std::atomic<uint64_t> tail{0};
+    /// 所属线程缓存的日志格式器，只有所属线程访问，写日志时不用加锁取格式器
+    LogFormatter::ptr formatter;
+    /// formatter对应的日志格式器版本
+    uint64_t formatterVersion = (uint64_t)-1;
+    /// 所属线程已退出，写完后由后台线程回收
+    std::atomic<bool> closed{false};
+    /// Appender已析构，所属线程下次查找时回收
+    std::atomic<bool> detached{false};
+};
+
+/// 用来给AsyncFileLogAppender编号
+static std::atomic<uint64_t> s_async_appender_id{0};
+
+const char *AsyncFileLogAppender::OverflowToString(Overflow overflow) {
+    switch(overflow) {
+    case DROP:
+        return "drop";
+    case COUNT:
+        return "count";
+    default:
+        return "block";
+    }
+}
+
+AsyncFileLogAppender::Overflow AsyncFileLogAppender::OverflowFromString(const std::string &str) {
+    if(str == "drop") {
+        return DROP;
+    }
+    if(str == "count") {
+        return COUNT;
+    }
+    return BLOCK;
+}
+
+AsyncFileLogAppender::AsyncFileLogAppender(const std::string &file, Overflow overflow, size_t buffer_size)
+    : LogAppender(LogFormatter::ptr(new LogFormatter))
+    , m_id(++s_async_appender_id)
+    , m_filename(file)
+    , m_overflow(overflow)
+    , m_bufferSize(buffer_size) {
+    reopen();
+    m_thread.reset(new Thread(std::bind(&AsyncFileLogAppender::run, this), "log_async"));
+}
+
+AsyncFileLogAppender::~AsyncFileLogAppender() {
+    m_stopping = true;
+    m_sem.notify();
+    m_thread->join();
+    for(auto &i : m_buffers) {
+        i->detached = true;
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+/**
+ * 线程局部的缓冲区表，按Appender编号查找。线程退出时把自己的缓冲区标记为closed，
+ * Appender析构后留下的缓冲区在下次新建缓冲区时顺便清掉
+ */
+AsyncFileLogAppender::Buffer *AsyncFileLogAppender::getBuffer() {
+    struct ThreadBuffers {
+        ~ThreadBuffers() {
+            for(auto &i : buffers) {
+                i.second->closed = true;
+            }
+        }
+        std::vector<std::pair<uint64_t, std::shared_ptr<Buffer> > > buffers;
+    };
+    static thread_local ThreadBuffers t_buffers;
+
+    for(auto &i : t_buffers.buffers) {
+        if(i.first == m_id) {
+            return i.second.get();
+        }
+    }
+    auto &buffers = t_buffers.buffers;
+    for(size_t i = 0; i < buffers.size();) {
+        if(buffers[i].second->detached) {
+            buffers[i] = buffers.back();
+            buffers.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    std::shared_ptr<Buffer> buffer(new Buffer(m_bufferSize));
+    {
+        MutexType::Lock lock(m_buffersMutex);
+        m_buffers.push_back(buffer);
+        ++m_buffersVersion;
+    }
+    buffers.push_back(std::make_pair(m_id, buffer));
+    return buffer.get();
+}
+
+void AsyncFileLogAppender::wake() {
+    if(!m_notified.exchange(true)) {
+        m_sem.notify();
+    }
+}
+
+/**
+ * 后台线程每一轮把登记的等待者清零，每个等待者释放一次信号量，等待者自己不用注销。
+ * 超时返回的等待者之后收到的多余信号只会让下一次等待提前返回一次
+ */
+void AsyncFileLogAppender::waitDrain() {
+    ++m_drainWaiters;
+    wake();
+    m_drained.waitFor(10);
+}
+
+/**
+ * 缓冲区用过一半或者是ERROR及以上级别的日志时唤醒后台线程，其余的等后台线程定时醒来再写，
+ * 写日志的线程一般不需要系统调用
+ */
+void AsyncFileLogAppender::log(LogEvent::ptr event) {
+    Buffer *buffer   = getBuffer();
+    uint64_t version = m_formatterVersion.load(std::memory_order_acquire);
+    if(buffer->formatterVersion != version) {
+        buffer->formatter        = getFormatter();
+        buffer->formatterVersion = version;
+    }
+    const std::string &str = buffer->formatter->formatToBuffer(event);
+    if(!buffer->push(str.c_str(), str.size())) {
+        if(m_overflow != BLOCK) {
+            ++m_dropped;
+            wake();
+            return;
+        }
+        if(str.size() > buffer->capacity) {
+            // 整个缓冲区都放不下，先等本线程之前的日志写完，再直接写文件，保持本线程的顺序
+            while(buffer->size() && !m_stopping) {
+                waitDrain();
+            }
+            struct iovec iov;
+            iov.iov_base = (void *)str.data();
+            iov.iov_len  = str.size();
+            Mutex::Lock lock(m_writeMutex);
+            writeFile(&iov, 1);
+            return;
+        }
+        while(!buffer->push(str.c_str(), str.size())) {
+            waitDrain();
+        }
+    }
+    if(event->getLevel() <= LogLevel::ERROR || buffer->size() > buffer->capacity / 2) {
+        wake();
+    }
+    if(event->getLevel() == LogLevel::FATAL) {
+        flush();
+    }
+}
+
+void AsyncFileLogAppender::flush() {
+    std::vector<std::pair<std::shared_ptr<Buffer>, uint64_t> > marks;
+    {
+        MutexType::Lock lock(m_buffersMutex);
+        for(auto &i : m_buffers) {
+            marks.push_back(std::make_pair(i, i->head.load(std::memory_order_acquire)));
+        }
+    }
+    for(auto &i : marks) {
+        while(i.first->tail.load(std::memory_order_acquire) < i.second && !m_stopping) {
+            waitDrain();
+        }
+    }
+}
+
+void AsyncFileLogAppender::writeFile(struct iovec *iov, int iovcnt) {
+    if(m_fd < 0) {
+        return;
+    }
+    while(iovcnt > 0) {
+        ssize_t rt = ::writev(m_fd, iov, iovcnt);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cout << "[ERROR] AsyncFileLogAppender write " << m_filename << " error, errno=" << errno
+                      << std::endl;
+            return;
+        }
+        size_t n = rt;
+        while(iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+ * 每个缓冲区最多两段数据，凑满IOV_MAX或者一轮扫完就写一次，写完再推进各缓冲区的tail
+ */
+size_t AsyncFileLogAppender::drain(const std::vector<std::shared_ptr<Buffer> > &buffers) {
+    struct iovec iovs[IOV_MAX];
+    std::pair<Buffer *, uint64_t> heads[IOV_MAX / 2];
+    size_t total = 0;
+    size_t i     = 0;
+    while(i < buffers.size()) {
+        int iovcnt   = 0;
+        size_t count = 0;
+        for(; i < buffers.size() && iovcnt + 2 <= IOV_MAX; ++i) {
+            Buffer *b  = buffers[i].get();
+            uint64_t t = b->tail.load(std::memory_order_relaxed);
+            uint64_t h = b->head.load(std::memory_order_acquire);
+            if(h == t) {
+                continue;
+            }
+            size_t offset = t & (b->capacity - 1);
+            size_t len    = h - t;
+            size_t first  = std::min(len, b->capacity - offset);
+            iovs[iovcnt].iov_base   = b->data + offset;
+            iovs[iovcnt++].iov_len  = first;
+            if(len > first) {
+                iovs[iovcnt].iov_base  = b->data;
+                iovs[iovcnt++].iov_len = len - first;
+            }
+            heads[count++] = std::make_pair(b, h);
+            total += len;
+        }
+        if(!iovcnt) {
+            continue;
+        }
+        {
+            Mutex::Lock lock(m_writeMutex);
+            writeFile(iovs, iovcnt);
+        }
+        for(size_t j = 0; j < count; ++j) {
+            heads[j].first->tail.store(heads[j].second, std::memory_order_release);
+        }
+    }
+    return total;
+}
+
+/**
+ * 和FileLogAppender一样，有日志写入且距离上次打开超过3秒就重新打开一次文件，
+ * 没有数据时最多睡100ms
+ */
+void AsyncFileLogAppender::run() {
+    std::vector<std::shared_ptr<Buffer> > buffers;
+    uint64_t version   = (uint64_t)-1;
+    time_t last_reopen = time(0);
+    bool written       = false;
+    while(true) {
+        m_notified = false;
+        bool stopping = m_stopping;
+        if(version != m_buffersVersion) {
+            MutexType::Lock lock(m_buffersMutex);
+            buffers = m_buffers;
+            version = m_buffersVersion;
+        }
+        size_t n = drain(buffers);
+        uint64_t dropped = m_dropped;
+        if(m_overflow == COUNT && dropped > m_reported) {
+            std::string msg = "[AsyncFileLogAppender] " + std::to_string(dropped - m_reported) +
+                              " log records dropped\n";
+            struct iovec iov;
+            iov.iov_base = &msg[0];
+            iov.iov_len  = msg.size();
+            Mutex::Lock lock(m_writeMutex);
+            writeFile(&iov, 1);
+            m_reported = dropped;
+            n += msg.size();
+        }
+        written = written || n;
+        for(int i = m_drainWaiters.exchange(0); i > 0; --i) {
+            m_drained.notify();
+        }
+
+        time_t now = time(0);
+        if(written && now >= last_reopen + 3) {
+            reopen();
+            last_reopen = now;
+            written     = false;
+
+            // 回收已退出线程的缓冲区
+            MutexType::Lock lock(m_buffersMutex);
+            for(size_t i = 0; i < m_buffers.size();) {
+                if(m_buffers[i]->closed && !m_buffers[i]->size()) {
+                    m_buffers[i] = m_buffers.back();
+                    m_buffers.pop_back();
+                    ++m_buffersVersion;
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        if(n) {
+            continue;
+        }
+        if(stopping) {
+            break;
+        }
+        m_sem.waitFor(100);
+    }
+}
+
+void AsyncFileLogAppender::reopen() {
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        // 和FileLogAppender一样只提示，打开失败期间的日志丢弃
+        if(!m_reopenError) {
+            std::cout << "reopen file " << m_filename << " error" << std::endl;
+        }
+        m_reopenError = true;
+        return;
+    }
+    m_reopenError = false;
+    Mutex::Lock lock(m_writeMutex);
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = fd;
+}
+
+std::string AsyncFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"]        = "AsyncFileLogAppender";
+    node["file"]        = m_filename;
+    node["pattern"]     = m_formatter ? m_formatter->getPattern() : m_defaultFormatter->getPattern();
+    node["overflow"]    = OverflowToString(m_overflow);
+    node["buffer_size"] = m_bufferSize;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
 Logger::Logger(const std::string &name)
     : m_name(name)
     , m_level(LogLevel::INFO)
@@ -583,12 +952,16 @@ std::string LoggerManager::toYamlString() {
  * @brief 日志输出器配置结构体定义
  */
 struct LogAppenderDefine {
-    int type = 0; // 1 File, 2 Stdout
+    int type = 0; // 1 File, 2 Stdout, 3 AsyncFile
     std::string pattern;
     std::string file;
+    // 以下只对AsyncFile有效
+    AsyncFileLogAppender::Overflow overflow = AsyncFileLogAppender::BLOCK;
+    size_t buffer_size = 1 << 20;
 
     bool operator==(const LogAppenderDefine &oth) const {
-        return type == oth.type && pattern == oth.pattern && file == oth.file;
+        return type == oth.type && pattern == oth.pattern && file == oth.file && overflow == oth.overflow &&
+               buffer_size == oth.buffer_size;
     }
 };
 
@@ -645,6 +1018,22 @@ public:
                     if(a["pattern"].IsDefined()) {
                         lad.pattern = a["pattern"].as<std::string>();
                     }
+                } else if(type == "AsyncFileLogAppender") {
+                    lad.type = 3;
+                    if(!a["file"].IsDefined()) {
+                        std::cout << "log appender config error: file appender file is null, " << a << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if(a["pattern"].IsDefined()) {
+                        lad.pattern = a["pattern"].as<std::string>();
+                    }
+                    if(a["overflow"].IsDefined()) {
+                        lad.overflow = AsyncFileLogAppender::OverflowFromString(a["overflow"].as<std::string>());
+                    }
+                    if(a["buffer_size"].IsDefined()) {
+                        lad.buffer_size = a["buffer_size"].as<size_t>();
+                    }
                 } else if(type == "StdoutLogAppender") {
                     lad.type = 2;
                     if(a["pattern"].IsDefined()) {
@@ -675,6 +1064,11 @@ public:
                 na["file"] = a.file;
             } else if(a.type == 2) {
                 na["type"] = "StdoutLogAppender";
+            } else if(a.type == 3) {
+                na["type"] = "AsyncFileLogAppender";
+                na["file"] = a.file;
+                na["overflow"] = AsyncFileLogAppender::OverflowToString(a.overflow);
+                na["buffer_size"] = a.buffer_size;
             }
             if(!a.pattern.empty()) {
                 na["pattern"] = a.pattern;
@@ -714,6 +1108,8 @@ struct LogIniter {
                     sylar::LogAppender::ptr ap;
                     if(a.type == 1) {
                         ap.reset(new FileLogAppender(a.file));
+                    } else if(a.type == 3) {
+                        ap.reset(new AsyncFileLogAppender(a.file, a.overflow, a.buffer_size));
                     } else if(a.type == 2) {
                         // 如果以daemon方式运行，则不需要创建终端appender
                         if(!sylar::EnvMgr::GetInstance()->has("d")) {
@@ -17,6 +17,8 @@
 #include <cstdarg>
 #include <list>
 #include <map>
+#include <atomic>
+#include <sys/uio.h>
 #include "util.h"
 #include "mutex.h"
 #include "singleton.h"
@@ -31,16 +33,32 @@
  */
 #define SYLAR_LOG_NAME(name) sylar::LoggerMgr::GetInstance()->getLogger(name)
 
+/**
+ * @brief 编译期保留的最详细的日志级别，取LogLevel::Level的枚举名，默认DEBUG即全部保留
+ * @details 比它更详细的日志调用，判断条件是常量false，整条语句在编译时被去掉，流式参数也不会求值。
+ *          CMake中用-DLOG_MIN_LEVEL=INFO指定
+ */
+#ifndef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL DEBUG
+#endif
+
+/**
+ * @brief 日志器是否输出level级别的日志
+ * @details 先比较编译期级别，再读日志器的级别，都在分配日志事件之前，被过滤掉的调用没有任何内存分配
+ */
+#define SYLAR_LOG_ENABLED(logger, level) \
+    ((level) <= sylar::LogLevel::SYLAR_LOG_MIN_LEVEL && (level) <= (logger)->getLevel())
+
 /**
  * @brief 使用流式方式将日志级别level的日志写入到logger
  * @details 构造一个LogEventWrap对象，包裹包含日志器和日志事件，在对象析构时调用日志器写日志事件
  * @todo 协程id未实现，暂时写0
  */
 #define SYLAR_LOG_LEVEL(logger , level) \
-    if(level <= logger->getLevel()) \
-        sylar::LogEventWrap(logger, sylar::LogEvent::ptr(new sylar::LogEvent(logger->getName(), \
-            level, __FILE__, __LINE__, sylar::GetElapsedMS() - logger->getCreateTime(), \
-            sylar::GetThreadId(), sylar::GetFiberId(), time(0), sylar::GetThreadName()))).getLogEvent()->getSS()
+    if(SYLAR_LOG_ENABLED(logger, level)) \
+        sylar::LogEventWrap(logger, std::make_shared<sylar::LogEvent>(logger->getName(), \
+            level, __FILE__, __LINE__, sylar::CoarseNowMS() - logger->getCreateTime(), \
+            sylar::GetThreadId(), sylar::GetFiberId(), sylar::CoarseWallMS() / 1000, sylar::GetThreadName())).getLogEvent()->getSS()
 
 #define SYLAR_LOG_FATAL(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::FATAL)
 
@@ -64,10 +82,10 @@
  * @todo 协程id未实现，暂时写0
  */
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-    if(level <= logger->getLevel()) \
-        sylar::LogEventWrap(logger, sylar::LogEvent::ptr(new sylar::LogEvent(logger->getName(), \
-            level, __FILE__, __LINE__, sylar::GetElapsedMS() - logger->getCreateTime(), \
-            sylar::GetThreadId(), sylar::GetFiberId(), time(0), sylar::GetThreadName()))).getLogEvent()->printf(fmt, __VA_ARGS__)
+    if(SYLAR_LOG_ENABLED(logger, level)) \
+        sylar::LogEventWrap(logger, std::make_shared<sylar::LogEvent>(logger->getName(), \
+            level, __FILE__, __LINE__, sylar::CoarseNowMS() - logger->getCreateTime(), \
+            sylar::GetThreadId(), sylar::GetFiberId(), sylar::CoarseWallMS() / 1000, sylar::GetThreadName())).getLogEvent()->printf(fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
 
@@ -164,10 +182,15 @@ public:
      */
     std::string getContent() const { return m_ss.str(); }
 
+    /**
+     * @brief 把日志内容追加到out后面，直接从流的缓冲区拷贝，不产生临时字符串
+     */
+    void appendContent(std::string &out);
+
     /**
      * @brief 获取文件名
      */
-    std::string getFile() const { return m_file; }
+    const char *getFile() const { return m_file; }
 
     /**
      * @brief 获取行号
@@ -295,38 +318,53 @@ public:
      * @param[in] event 日志事件
      * @param[in] os 日志输出流
      * @return 格式化日志流
+     * @note 模板里有%%n时和原来的std::endl一样会刷新os
      */
     std::ostream &format(std::ostream &os, LogEvent::ptr event);
 
+    /**
+     * @brief 对日志事件进行格式化，追加到out后面
+     */
+    void format(std::string &out, const LogEvent::ptr &event);
+
+    /**
+     * @brief 格式化到当前线程的缓冲区，缓冲区反复使用，稳定后不再分配内存
+     * @return 当前线程的缓冲区，本线程下次格式化之前有效
+     */
+    const std::string &formatToBuffer(const LogEvent::ptr &event);
+
     /**
      * @brief 获取pattern
      */
     std::string getPattern() const { return m_pattern; }
 
-public:
+private:
     /**
-     * @brief 日志内容格式化项，虚基类，用于派生出不同的格式化项
-     */
-    class FormatItem {
-    public:
-        typedef std::shared_ptr<FormatItem> ptr;
-        
-        /**
-         * @brief 析构函数
-         */
-        virtual ~FormatItem() {}
-
-        /**
-         * @brief 格式化日志事件
-         */
-        virtual void format(std::ostream &os, LogEvent::ptr event) = 0;
-    };
+     * @brief 追加日期时间，同一秒内复用上次strftime的结果
+     * @param[in] index 日期项在m_items中的下标
+     */
+    void appendDateTime(std::string &out, size_t index, time_t time);
 
 private:
+    /**
+     * @brief 编译后的模板项
+     * @details 相邻的常规字符、%%T、%%n、%%%都合并成一个常规字符串，格式化时按type分派，不经过虚函数和流
+     */
+    struct Item {
+        /// 模板字符，常规字符串为0
+        char type;
+        /// 常规字符串，或者%%d的时间格式
+        std::string str;
+    };
+
     /// 日志格式模板
     std::string m_pattern;
-    /// 解析后的格式模板数组
-    std::vector<FormatItem::ptr> m_items;
+    /// 编译后的模板项
+    std::vector<Item> m_items;
+    /// 格式器编号，区分线程局部日期缓存属于哪个格式器
+    uint64_t m_id;
+    /// 模板里是否有%%n
+    bool m_newLine = false;
     /// 是否出错
     bool m_error = false;
 };
@@ -378,6 +416,8 @@ protected:
     LogFormatter::ptr m_formatter;
     /// 默认日志格式器
     LogFormatter::ptr m_defaultFormatter;
+    /// 日志格式器版本，每次设置加一，缓存了格式器的子类据此判断是否过期
+    std::atomic<uint64_t> m_formatterVersion{0};
 };
 
 /**
@@ -443,6 +483,152 @@ private:
     bool m_reopenError = false;
 };
 
+class Thread;
+
+/**
+ * @brief 异步输出到文件的Appender
+ * @details 调用线程把日志格式化好后放进本线程自己的环形缓冲区，每个缓冲区只有一个生产者和一个消费者，
+ *          不加锁；后台线程把所有缓冲区里的数据攒成一批用writev写入文件，定期重新打开文件也在后台线程里做，
+ *          写日志的线程不会等磁盘。缓冲区满时按溢出策略处理。
+ *          同一线程的日志在文件里保持顺序，不同线程的日志按批交错
+ */
+class AsyncFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncFileLogAppender> ptr;
+
+    /**
+     * @brief 缓冲区满时的处理方式
+     */
+    enum Overflow {
+        /// 等后台线程腾出空间，不丢日志
+        BLOCK = 0,
+        /// 丢弃这条日志，只累加丢弃计数
+        DROP  = 1,
+        /// 丢弃这条日志，后台线程在文件里补一行丢弃的条数
+        COUNT = 2
+    };
+
+    /**
+     * @brief 溢出策略转字符串，block/drop/count
+     */
+    static const char *OverflowToString(Overflow overflow);
+
+    /**
+     * @brief 字符串转溢出策略，不认识的按block处理
+     */
+    static Overflow OverflowFromString(const std::string &str);
+
+    /**
+     * @brief 构造函数
+     * @param[in] file 日志文件路径
+     * @param[in] overflow 缓冲区满时的处理方式
+     * @param[in] buffer_size 每个线程的缓冲区大小，向上取整到2的幂
+     */
+    AsyncFileLogAppender(const std::string &file, Overflow overflow = BLOCK, size_t buffer_size = 1 << 20);
+
+    /**
+     * @brief 析构函数，把缓冲区里剩下的日志写完再退出后台线程
+     */
+    ~AsyncFileLogAppender();
+
+    /**
+     * @brief 写日志
+     * @details 只格式化和拷贝进缓冲区，FATAL级别的日志会等写入文件后才返回
+     */
+    void log(LogEvent::ptr event) override;
+
+    /**
+     * @brief 等调用之前写的日志都写入文件
+     */
+    void flush();
+
+    /**
+     * @brief 因缓冲区满丢弃的日志条数
+     */
+    uint64_t getDropped() const { return m_dropped; }
+
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    std::string toYamlString() override;
+
+private:
+    struct Buffer;
+
+    /**
+     * @brief 当前线程在这个Appender上的缓冲区，第一次写日志时创建
+     */
+    Buffer *getBuffer();
+
+    /**
+     * @brief 唤醒后台线程
+     */
+    void wake();
+
+    /**
+     * @brief 唤醒后台线程并等它写完一轮，最多等10ms，调用方重新检查条件
+     */
+    void waitDrain();
+
+    /**
+     * @brief 后台线程执行函数
+     */
+    void run();
+
+    /**
+     * @brief 把各缓冲区当前的数据用writev写出去，返回写出的字节数
+     */
+    size_t drain(const std::vector<std::shared_ptr<Buffer> > &buffers);
+
+    /**
+     * @brief 写入文件，处理部分写入
+     */
+    void writeFile(struct iovec *iov, int iovcnt);
+
+    /**
+     * @brief 重新打开日志文件
+     */
+    void reopen();
+
+private:
+    /// Appender编号，线程局部的缓冲区表按它查找
+    uint64_t m_id;
+    /// 文件路径
+    std::string m_filename;
+    /// 溢出策略
+    Overflow m_overflow;
+    /// 每个线程的缓冲区大小
+    size_t m_bufferSize;
+    /// 文件描述符
+    int m_fd = -1;
+    /// 文件打开错误标识
+    bool m_reopenError = false;
+    /// 保护m_fd，后台线程写文件和超长日志直接写文件时持有
+    Mutex m_writeMutex;
+    /// 保护m_buffers
+    MutexType m_buffersMutex;
+    /// 所有线程的缓冲区
+    std::vector<std::shared_ptr<Buffer> > m_buffers;
+    /// m_buffers的版本，后台线程据此判断要不要重新拷贝
+    std::atomic<uint64_t> m_buffersVersion{0};
+    /// 后台线程是否已被唤醒
+    std::atomic<bool> m_notified{false};
+    /// 唤醒后台线程
+    Semaphore m_sem;
+    /// 登记等后台线程腾出空间或者等flush的次数
+    std::atomic<int> m_drainWaiters{0};
+    /// 后台线程每写完一轮按m_drainWaiters释放
+    Semaphore m_drained;
+    /// 是否正在停止
+    std::atomic<bool> m_stopping{false};
+    /// 丢弃的日志条数
+    std::atomic<uint64_t> m_dropped{0};
+    /// 已经写进文件的丢弃条数，只在后台线程访问
+    uint64_t m_reported = 0;
+    /// 后台线程
+    std::shared_ptr<Thread> m_thread;
+};
+
 /**
  * @brief 日志器类
  * @note 日志器类不带root logger
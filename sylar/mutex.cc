@@ -7,6 +7,8 @@
 
 #include "mutex.h"
 #include<stdexcept>
+#include <errno.h>
+#include <time.h>
 namespace sylar {
 
 Semaphore::Semaphore(uint32_t count) {
@@ -25,6 +27,26 @@ void Semaphore::wait() {
     }
 }
 
+bool Semaphore::waitFor(uint64_t timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    while(sem_timedwait(&m_semaphore, &ts)) {
+        if(errno == ETIMEDOUT) {
+            return false;
+        }
+        if(errno != EINTR) {
+            throw std::logic_error("sem_timedwait error");
+        }
+    }
+    return true;
+}
+
 void Semaphore::notify() {
     if(sem_post(&m_semaphore)) {
         throw std::logic_error("sem_post error");
@@ -41,6 +41,12 @@ public:
      */
     void wait();
 
+    /**
+     * @brief 获取信号量，最多等待timeout_ms毫秒
+     * @return 超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
     /**
      * @brief 释放信号量
      */
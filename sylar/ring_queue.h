@@ -0,0 +1,135 @@
+/**
+ * @file ring_queue.h
+ * @brief 可扩容的环形队列
+ * @version 0.1
+ * @date 2021-06-15
+ */
+
+#ifndef __SYLAR_RING_QUEUE_H__
+#define __SYLAR_RING_QUEUE_H__
+
+#include <new>
+#include <stddef.h>
+#include <utility>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 连续内存的环形队列
+ * @details 元素放在一块连续内存里，容量不够时翻倍扩容，出队不释放内存，
+ *          稳定运行后入队出队都不会再分配内存。元素只需要支持移动，不是线程安全的
+ * @tparam T 元素类型
+ */
+template <class T>
+class RingQueue : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 初始容量，向上取整到2的幂
+     */
+    explicit RingQueue(size_t capacity = 64) {
+        m_capacity = 1;
+        while (m_capacity < capacity) {
+            m_capacity <<= 1;
+        }
+        m_data = static_cast<T *>(::operator new(m_capacity * sizeof(T)));
+    }
+
+    ~RingQueue() {
+        clear();
+        ::operator delete(m_data);
+    }
+
+    /**
+     * @brief 元素个数
+     */
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief 是否为空
+     */
+    bool empty() const { return m_size == 0; }
+
+    /**
+     * @brief 从队头开始数的第i个元素
+     */
+    T &operator[](size_t i) { return m_data[(m_head + i) & (m_capacity - 1)]; }
+
+    /**
+     * @brief 队头元素
+     */
+    T &front() { return (*this)[0]; }
+
+    /**
+     * @brief 入队
+     */
+    void push_back(T &&v) {
+        if (m_size == m_capacity) {
+            grow();
+        }
+        new (&(*this)[m_size]) T(std::move(v));
+        ++m_size;
+    }
+
+    /**
+     * @brief 队头出队
+     */
+    void pop_front() {
+        front().~T();
+        m_head = (m_head + 1) & (m_capacity - 1);
+        --m_size;
+    }
+
+    /**
+     * @brief 删除第i个元素，前面的元素依次后移一位
+     */
+    void erase(size_t i) {
+        for (; i > 0; --i) {
+            (*this)[i] = std::move((*this)[i - 1]);
+        }
+        pop_front();
+    }
+
+    /**
+     * @brief 清空
+     */
+    void clear() {
+        while (m_size) {
+            pop_front();
+        }
+        m_head = 0;
+    }
+
+private:
+    /**
+     * @brief 容量翻倍，元素按顺序搬到新内存的开头
+     */
+    void grow() {
+        size_t capacity = m_capacity << 1;
+        T *data         = static_cast<T *>(::operator new(capacity * sizeof(T)));
+        for (size_t i = 0; i < m_size; i++) {
+            T &v = (*this)[i];
+            new (&data[i]) T(std::move(v));
+            v.~T();
+        }
+        ::operator delete(m_data);
+        m_data     = data;
+        m_capacity = capacity;
+        m_head     = 0;
+    }
+
+private:
+    /// 元素存储区
+    T *m_data = nullptr;
+    /// 容量，2的幂
+    size_t m_capacity = 0;
+    /// 队头下标
+    size_t m_head = 0;
+    /// 元素个数
+    size_t m_size = 0;
+};
+
+} // namespace sylar
+
+#endif
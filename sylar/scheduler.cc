@@ -4,24 +4,185 @@
  * @version 0.1
  * @date 2021-06-15
  */
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include "scheduler.h"
+#include "config.h"
 #include "macro.h"
 #include "hook.h"
+#include "work_steal_queue.h"
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    Config::Lookup<bool>("scheduler.work_stealing", false, "per-thread run queues with work stealing");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_local_queue_size =
+    Config::Lookup<uint32_t>("scheduler.local_queue_size", 256, "capacity of per-thread run queue");
+
+/// 调度线程一直有任务不进idle时，每执行这么多个任务刷新一次缓存的时钟
+static const uint32_t COARSE_CLOCK_REFRESH_TASKS = 64;
+
+/**
+ * @brief 在futex上等待，*addr不等于expected时立即返回
+ */
+static void FutexWait(std::atomic<int> *addr, int expected) {
+    syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief 唤醒一个在futex上等待的线程
+ */
+static void FutexWake(std::atomic<int> *addr) {
+    syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief 本地队列节点的线程局部缓存
+ * @details 本地队列里存放的是任务指针，节点用完后放回释放它的线程的缓存，稳定运行后不再分配内存。
+ *          只用POD类型，保证线程退出过程中其他thread_local对象析构时释放节点仍然安全
+ */
+struct TaskNodeCache {
+    /// 空闲节点链表，节点的前8个字节存放next指针
+    void *head;
+    /// 空闲节点数量
+    uint32_t count;
+    /// 线程已退出，不再缓存
+    bool exited;
+};
+
+/// 每个线程最多缓存的空闲节点数量
+static const uint32_t MAX_CACHED_TASK_NODES = 1024;
+
+static thread_local TaskNodeCache t_task_node_cache = {nullptr, 0, false};
+
+/**
+ * @brief 线程退出时释放缓存的节点
+ */
+struct TaskNodeReaper {
+    ~TaskNodeReaper() {
+        TaskNodeCache &cache = t_task_node_cache;
+        while (cache.head) {
+            void *node = cache.head;
+            cache.head = *static_cast<void **>(node);
+            ::operator delete(node);
+        }
+        cache.count  = 0;
+        cache.exited = true;
+    }
+    /// 首次缓存节点时置位，确保本线程的reaper被构造，从而在线程退出时析构
+    bool armed = false;
+};
+
+static thread_local TaskNodeReaper t_task_node_reaper;
+
+/**
+ * @brief 调度线程的私有数据
+ */
+struct SchedulerWorker {
+    typedef Scheduler::ScheduleTask ScheduleTask;
+    typedef Scheduler::MutexType MutexType;
+
+    SchedulerWorker(Scheduler *s, size_t idx, uint32_t capacity)
+        : scheduler(s)
+        , index(idx)
+        , local(capacity)
+        , seed((uint32_t)idx * 2654435761u + 1) {
+    }
+
+    ~SchedulerWorker() {
+        ScheduleTask *task = nullptr;
+        while (local.pop(task)) {
+            FreeTaskNode(task);
+        }
+    }
+
+    /**
+     * @brief 分配一个本地队列节点，优先从当前线程的缓存里取
+     */
+    static ScheduleTask *NewTaskNode(ScheduleTask &&task) {
+        TaskNodeCache &cache = t_task_node_cache;
+        void *node           = cache.head;
+        if (node) {
+            cache.head = *static_cast<void **>(node);
+            --cache.count;
+        } else {
+            node = ::operator new(sizeof(ScheduleTask));
+        }
+        return new (node) ScheduleTask(std::move(task));
+    }
+
+    /**
+     * @brief 释放本地队列节点，优先放回当前线程的缓存
+     */
+    static void FreeTaskNode(ScheduleTask *task) {
+        task->~ScheduleTask();
+        TaskNodeCache &cache = t_task_node_cache;
+        if (cache.exited || cache.count >= MAX_CACHED_TASK_NODES) {
+            ::operator delete(task);
+            return;
+        }
+        t_task_node_reaper.armed        = true;
+        *reinterpret_cast<void **>(task) = cache.head;
+        cache.head                       = task;
+        ++cache.count;
+    }
+
+    /**
+     * @brief 随机选一个窃取对象的起始下标
+     */
+    size_t nextRandom(size_t n) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed % n;
+    }
+
+    /// 所属调度器
+    Scheduler *scheduler;
+    /// 在调度器中的下标
+    size_t index;
+    /// 线程id，线程开始调度后才有效
+    std::atomic<int> threadId = {-1};
+    /// 本地队列，只有本线程放入，所有线程都可以取
+    WorkStealQueue<ScheduleTask *> local;
+    /// 指定在本线程执行的任务，任何线程都可以放入
+    RingQueue<ScheduleTask> inbox;
+    /// inbox的长度，用于不加锁判断是否为空
+    std::atomic<size_t> inboxCount = {0};
+    /// 保护inbox
+    MutexType inboxMutex;
+    /// 随机数状态
+    uint32_t seed;
+    /// 是否在调度器的空闲列表里，由m_idleMutex保护写入
+    std::atomic<bool> idle = {false};
+    /// 登记为空闲之后是否被通知过
+    std::atomic<bool> notified = {false};
+    /// 基类idle阻塞用的futex，1表示有唤醒
+    std::atomic<int> futex = {0};
+};
+
 /// 当前线程的调度器，同一个调度器下的所有线程共享同一个实例
 static thread_local Scheduler *t_scheduler = nullptr;
 /// 当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+/// 当前线程对应的调度线程私有数据
+static thread_local SchedulerWorker *t_worker = nullptr;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
     SYLAR_ASSERT(threads > 0);
 
-    m_useCaller = use_caller;
-    m_name      = name;
+    m_useCaller    = use_caller;
+    m_name         = name;
+    m_workStealing = g_scheduler_work_stealing->getValue();
+
+    uint32_t queue_size = g_scheduler_local_queue_size->getValue();
+    for (size_t i = 0; i < threads; i++) {
+        m_workers.push_back(new SchedulerWorker(this, i, queue_size));
+    }
 
     if (use_caller) {
         --threads;
@@ -39,6 +200,10 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
         t_scheduler_fiber = m_rootFiber.get();
         m_rootThread      = sylar::GetThreadId();
         m_threadIds.push_back(m_rootThread);
+
+        // caller线程固定使用下标0
+        m_workers[0]->threadId = m_rootThread;
+        m_nextWorker           = 1;
     } else {
         m_rootThread = -1;
     }
@@ -63,6 +228,9 @@ Scheduler::~Scheduler() {
     if (GetThis() == this) {
         t_scheduler = nullptr;
     }
+    for (auto i : m_workers) {
+        delete i;
+    }
 }
 
 void Scheduler::start() { //初始化调度线程池
@@ -81,20 +249,389 @@ void Scheduler::start() { //初始化调度线程池
     }
 }
 
+std::vector<int> Scheduler::getWorkerThreadIds() {
+    MutexType::Lock lock(m_mutex);
+    std::vector<int> ids;
+    for (auto i : m_threadIds) {
+        if (i != m_rootThread) {
+            ids.push_back(i);
+        }
+    }
+    return ids;
+}
+
+bool Scheduler::hasPendingTasks() {
+    if (m_taskCount > 0) {
+        return true;
+    }
+    for (auto i : m_workers) {
+        if (i->inboxCount > 0 || !i->local.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex); //所有任务执行完调度器才停止
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    // 所有任务执行完调度器才停止，调度线程在取任务之前就会增加活跃线程数，所以这里先检查队列再检查活跃线程数。
+    // 外部等待先放回协程再减计数，所以先检查它再检查队列
+    return m_stopping && m_externalWaitCount == 0 && !hasPendingTasks() && m_activeThreadCount == 0;
+}
+
+SchedulerWorker *Scheduler::getWorker(int thread) {
+    for (auto i : m_workers) {
+        if (i->threadId == thread) {
+            return i;
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::scheduleGlobal(ScheduleTask &&task) {
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = m_tasks.empty();
+    m_tasks.push_back(std::move(task));
+    ++m_taskCount;
+    return need_tickle;
+}
+
+void Scheduler::schedulePinned(SchedulerWorker *worker, ScheduleTask &&task) {
+    {
+        MutexType::Lock lock(worker->inboxMutex);
+        worker->inbox.push_back(std::move(task));
+        ++worker->inboxCount;
+    }
+    notifyWorker(worker);
+}
+
+bool Scheduler::scheduleTask(ScheduleTask &&task) {
+    if (task.thread != -1) {
+        // 指定了线程的任务放到目标线程的inbox并只唤醒它，两种模式都一样。目标线程还没开始调度时先放全局队列，它开始调度后自己会取
+        SchedulerWorker *worker = getWorker(task.thread);
+        if (!worker) {
+            return scheduleGlobal(std::move(task));
+        }
+        schedulePinned(worker, std::move(task));
+        return false;
+    }
+    if (!m_workStealing) {
+        return scheduleGlobal(std::move(task));
+    }
+
+    SchedulerWorker *worker = t_worker;
+    if (worker && worker->scheduler == this) {
+        // 调度线程上新产生的任务优先放本地队列，不加锁，有空闲线程时通知它来窃取
+        ScheduleTask *t = SchedulerWorker::NewTaskNode(std::move(task));
+        if (worker->local.push(t)) {
+            // 入队与读空闲线程数之间加全屏障，与run()里先增加空闲线程数再检查队列配对，避免丢失唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return hasIdleThreads();
+        }
+        task = std::move(*t);
+        SchedulerWorker::FreeTaskNode(t);
+    }
+    return scheduleGlobal(std::move(task));
+}
+
+bool Scheduler::scheduleTasks(std::vector<ScheduleTask> &tasks) {
+    bool need_tickle        = false;
+    SchedulerWorker *worker = t_worker;
+    if (worker && worker->scheduler != this) {
+        worker = nullptr;
+    }
+
+    // 指定线程的任务和能放进本地队列的任务先处理掉，剩下的原地挪到vector前面，再一次加锁放入全局队列
+    size_t global = 0;
+    for (auto &task : tasks) {
+        if (task.thread != -1) {
+            SchedulerWorker *target = getWorker(task.thread);
+            if (target) {
+                schedulePinned(target, std::move(task));
+                continue;
+            }
+        } else if (m_workStealing && worker) {
+            ScheduleTask *t = SchedulerWorker::NewTaskNode(std::move(task));
+            if (worker->local.push(t)) {
+                continue;
+            }
+            task = std::move(*t);
+            SchedulerWorker::FreeTaskNode(t);
+        }
+        if (&tasks[global] != &task) {
+            tasks[global] = std::move(task);
+        }
+        ++global;
+    }
+
+    if (worker && !worker->local.empty()) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        need_tickle |= hasIdleThreads();
+    }
+    if (global) {
+        MutexType::Lock lock(m_mutex);
+        need_tickle |= m_tasks.empty();
+        for (size_t i = 0; i < global; i++) {
+            m_tasks.push_back(std::move(tasks[i]));
+        }
+        m_taskCount += global;
+    }
+    tasks.clear();
+    return need_tickle;
+}
+
+bool Scheduler::takeGlobal(SchedulerWorker *worker, ScheduleTask &task, bool &tickle_me) {
+    if (m_taskCount == 0) {
+        return false;
+    }
+
+    bool found = false;
+    MutexType::Lock lock(m_mutex);
+    size_t i = 0;
+    // 遍历所有调度任务
+    while (i < m_tasks.size()) {
+        ScheduleTask &it = m_tasks[i];
+        if (it.thread != -1 && it.thread != sylar::GetThreadId()) {
+            // 指定了调度线程，但不是在当前线程上调度，跳过这个任务，继续下一个。
+            // 入队时已经直接通知了目标线程，目标线程还没开始调度的话开始后自己会取，这里不用再通知别的线程
+            ++i;
+            continue;
+        }
+
+        // 找到一个未指定线程，或是指定了当前线程的任务
+        SYLAR_ASSERT(it.fiber || it.cb);
+
+        // [BUG FIX]: hook IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
+        // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
+        // 这里简单地跳过这种情况，以损失一点性能为代价，否则整个协程框架都要大改
+        // 跳过的任务要通知其他线程稍后再来取，否则所有线程都睡下之后这个协程就没人调度了
+        if (it.fiber && it.fiber->getState() == Fiber::RUNNING) {
+            ++i;
+            tickle_me = true;
+            continue;
+        }
+
+        if (!found) {
+            // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除
+            task = std::move(it);
+            m_tasks.erase(i);
+            --m_taskCount;
+            found = true;
+            if (!worker) {
+                break;
+            }
+            continue;
+        }
+
+        // 顺便搬一部分任务到本地队列，按线程数均分，减少后面抢全局锁的次数
+        if (it.thread != -1 || worker->local.size() * m_workers.size() >= m_taskCount) {
+            break;
+        }
+        ScheduleTask *t = SchedulerWorker::NewTaskNode(std::move(it));
+        if (!worker->local.push(t)) {
+            it = std::move(*t);
+            SchedulerWorker::FreeTaskNode(t);
+            break;
+        }
+        m_tasks.erase(i);
+        --m_taskCount;
+    }
+    // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
+    tickle_me |= (i < m_tasks.size());
+    return found;
+}
+
+bool Scheduler::takeTask(SchedulerWorker *worker, ScheduleTask &task, bool &tickle_me) {
+    // 1. 指定在本线程执行的任务
+    if (worker->inboxCount > 0) {
+        MutexType::Lock lock(worker->inboxMutex);
+        if (!worker->inbox.empty()) {
+            task = std::move(worker->inbox.front());
+            worker->inbox.pop_front();
+            --worker->inboxCount;
+            return true;
+        }
+    }
+    if (!m_workStealing) {
+        return takeGlobal(nullptr, task, tickle_me);
+    }
+
+    ScheduleTask *t = nullptr;
+
+    // 2. 本地队列
+    if (!worker->local.pop(t)) {
+        // 3. 全局队列
+        if (takeGlobal(worker, task, tickle_me)) {
+            return true;
+        }
+
+        // 4. 从随机一个线程开始，依次尝试窃取其他线程的本地队列
+        size_t n     = m_workers.size();
+        size_t start = worker->nextRandom(n);
+        for (size_t i = 0; i < n && !t; i++) {
+            SchedulerWorker *victim = m_workers[(start + i) % n];
+            if (victim != worker) {
+                victim->local.pop(t);
+            }
+        }
+        if (!t) {
+            // 其他线程inbox里的任务在放入时已经直接唤醒了目标线程，这里不用管
+            return false;
+        }
+    }
+
+    task = std::move(*t);
+    SchedulerWorker::FreeTaskNode(t);
+    if (task.fiber && task.fiber->getState() == Fiber::RUNNING) {
+        // 同takeGlobal里的BUG FIX，协程还没来得及yield，放回全局队列稍后再调度
+        scheduleGlobal(std::move(task));
+        task.reset();
+        tickle_me = true;
+        return false;
+    }
+    // 本地队列还有任务并且有空闲线程，通知它们来窃取
+    tickle_me |= !worker->local.empty() && hasIdleThreads();
+    return true;
+}
+
+void Scheduler::tickle() {
+    SYLAR_LOG_DEBUG(g_logger) << "tickle";
+    // 与idle线程先增加空闲线程数、再登记、再检查队列配对，这里读到0说明对方一定能看到刚加入的任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!hasIdleThreads()) {
+        return;
+    }
+    SchedulerWorker *worker = nullptr;
+    {
+        MutexType::Lock lock(m_idleMutex);
+        if (m_idleWorkers.empty()) {
+            return;
+        }
+        worker = m_idleWorkers.back();
+        m_idleWorkers.pop_back();
+        worker->idle = false;
+    }
+    worker->notified = true;
+    wakeWorker(worker->index);
+}
+
+void Scheduler::tickleAll() {
+    std::vector<SchedulerWorker *> workers;
+    {
+        MutexType::Lock lock(m_idleMutex);
+        workers.swap(m_idleWorkers);
+        for (auto i : workers) {
+            i->idle = false;
+        }
+    }
+    for (auto i : workers) {
+        i->notified = true;
+        wakeWorker(i->index);
+    }
+}
+
+void Scheduler::notifyWorker(SchedulerWorker *worker) {
+    // inboxCount的自增与这里读idle构成屏障配对，目标线程先置idle再检查inbox，两边至少有一边能看到对方
+    if (!worker->idle) {
+        return;
+    }
+    {
+        MutexType::Lock lock(m_idleMutex);
+        if (!worker->idle) {
+            return;
+        }
+        for (auto it = m_idleWorkers.begin(); it != m_idleWorkers.end(); ++it) {
+            if (*it == worker) {
+                m_idleWorkers.erase(it);
+                break;
+            }
+        }
+        worker->idle = false;
+    }
+    worker->notified = true;
+    wakeWorker(worker->index);
+}
+
+void Scheduler::wakeWorker(size_t index) {
+    SchedulerWorker *worker = m_workers[index];
+    worker->futex           = 1;
+    FutexWake(&worker->futex);
 }
 
-void Scheduler::tickle() { 
-    SYLAR_LOG_DEBUG(g_logger) << "ticlke"; 
+void Scheduler::idleBegin() {
+    SchedulerWorker *worker = t_worker;
+    worker->notified        = false;
+    MutexType::Lock lock(m_idleMutex);
+    m_idleWorkers.push_back(worker);
+    worker->idle = true;
+}
+
+void Scheduler::idleEnd() {
+    SchedulerWorker *worker = t_worker;
+    if (!worker->idle) {
+        return;
+    }
+    MutexType::Lock lock(m_idleMutex);
+    if (!worker->idle) {
+        return;
+    }
+    for (auto it = m_idleWorkers.begin(); it != m_idleWorkers.end(); ++it) {
+        if (*it == worker) {
+            m_idleWorkers.erase(it);
+            break;
+        }
+    }
+    worker->idle = false;
+}
+
+bool Scheduler::idleNotified() {
+    return t_worker->notified;
+}
+
+bool Scheduler::hasTasksForIdle() {
+    if (m_taskCount > 0 || t_worker->inboxCount > 0) {
+        return true;
+    }
+    if (m_workStealing) {
+        for (auto i : m_workers) {
+            if (!i->local.empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool Scheduler::hasLocalTasks() {
+    SchedulerWorker *worker = t_worker;
+    return worker && (worker->inboxCount > 0 || !worker->local.empty());
+}
+
+int Scheduler::getWorkerIndex() {
+    SchedulerWorker *worker = t_worker;
+    return (worker && worker->scheduler == this) ? (int)worker->index : -1;
+}
+
+int Scheduler::getWorkerThreadId(size_t index) {
+    return index < m_workers.size() ? m_workers[index]->threadId.load() : -1;
 }
 
 void Scheduler::idle() {
     SYLAR_LOG_DEBUG(g_logger) << "idle";
+    SchedulerWorker *worker = t_worker;
     while (!stopping()) {
+        idleBegin();
+        if (!idleNotified() && !hasTasksForIdle() && !stopping()) {
+            // 阻塞到被tickle为止，futex上残留的唤醒最多导致一次空转
+            while (worker->futex.exchange(0) == 0) {
+                FutexWait(&worker->futex, 0);
+            }
+        }
+        idleEnd();
+        RefreshCoarseClock();
         sylar::Fiber::GetThis()->yield();
     }
+    // 最后一个任务执行完时其他线程可能已经阻塞了，全部叫醒让它们也退出
+    tickleAll();
 }
 
 void Scheduler::stop() {
@@ -111,13 +648,7 @@ void Scheduler::stop() {
         SYLAR_ASSERT(GetThis() != this);
     }
 
-    for (size_t i = 0; i < m_threadCount; i++) {
-        tickle();
-    }
-
-    if (m_rootFiber) {
-        tickle();
-    }
+    tickleAll();
 
     /// 在use caller情况下，调度器协程结束时，应该返回caller协程
     if (m_rootFiber) {
@@ -139,9 +670,18 @@ void Scheduler::run() {
     SYLAR_LOG_DEBUG(g_logger) << "run";
     set_hook_enable(true);
     setThis();
+    SchedulerWorker *worker = nullptr;
     if (sylar::GetThreadId() != m_rootThread) {
         t_scheduler_fiber = sylar::Fiber::GetThis().get();
+        worker            = m_workers[m_nextWorker++];
+        worker->threadId  = sylar::GetThreadId();
+    } else {
+        worker = m_workers[0];
     }
+    t_worker = worker;
+    // 调度线程使用缓存的时钟，每轮空闲循环刷新一次，一直不空闲时每执行一批任务刷新一次
+    RefreshCoarseClock();
+    uint32_t busy_tasks = 0;
 
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
@@ -150,63 +690,41 @@ void Scheduler::run() {
     while (true) {
         task.reset();
         bool tickle_me = false; // 是否tickle其他线程进行任务调度
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            // 遍历所有调度任务
-            while (it != m_tasks.end()) {
-                if (it->thread != -1 && it->thread != sylar::GetThreadId()) {
-                    // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，然后跳过这个任务，继续下一个
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                // 找到一个未指定线程，或是指定了当前线程的任务
-                SYLAR_ASSERT(it->fiber || it->cb);
-
-                // if (it->fiber) {
-                //     // 任务队列时的协程一定是READY状态，谁会把RUNNING或TERM状态的协程加入调度呢？
-                //     SYLAR_ASSERT(it->fiber->getState() == Fiber::READY);
-                // }
-
-                // [BUG FIX]: hook IO相关的系统调用时，在检测到IO未就绪的情况下，会先添加对应的读写事件，再yield当前协程，等IO就绪后再resume当前协程
-                // 多线程高并发情境下，有可能发生刚添加事件就被触发的情况，如果此时当前协程还未来得及yield，则这里就有可能出现协程状态仍为RUNNING的情况
-                // 这里简单地跳过这种情况，以损失一点性能为代价，否则整个协程框架都要大改
-                if(it->fiber && it->fiber->getState() == Fiber::RUNNING) {
-                    ++it;
-                    continue;
-                }
-                
-                // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-                task = *it;
-                m_tasks.erase(it++);
-                ++m_activeThreadCount;
-                break;
-            }
-            // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
-            tickle_me |= (it != m_tasks.end());
+        // 先增加活跃线程数再取任务，保证stopping()不会在任务出队但还没执行时误判
+        ++m_activeThreadCount;
+        if (!takeTask(worker, task, tickle_me)) {
+            --m_activeThreadCount;
         }
 
         if (tickle_me) {
             tickle();
         }
 
+        if ((task.fiber || task.cb) && ++busy_tasks >= COARSE_CLOCK_REFRESH_TASKS) {
+            busy_tasks = 0;
+            RefreshCoarseClock();
+        }
         if (task.fiber) {
             // resume协程，resume返回时，协程要么执行完了，要么半路yield了，总之这个任务就算完成了，活跃线程数减一
             task.fiber->resume();
             --m_activeThreadCount;
             task.reset();
+            afterTask();
         } else if (task.cb) {
             if (cb_fiber) {
-                cb_fiber->reset(task.cb);
+                cb_fiber->reset(std::move(task.cb));
             } else {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(std::move(task.cb)));
             }
             task.reset();
             cb_fiber->resume();
             --m_activeThreadCount;
-            cb_fiber.reset();
+            afterTask();
+            // 回调执行完了，协程留着给下一个回调复用；回调中途yield了，协程被别人持有，这里放手。
+            // 中途yield的协程可能已经被其他线程resume并执行完，所以只有没有其他持有者时才能根据状态判断是不是在这里结束的
+            if (cb_fiber.use_count() != 1 || cb_fiber->getState() != Fiber::TERM) {
+                cb_fiber.reset();
+            }
         } else {
             // 进到这个分支情况一定是任务队列空了，调度idle协程即可
             if (idle_fiber->getState() == Fiber::TERM) {
@@ -217,8 +735,11 @@ void Scheduler::run() {
             ++m_idleThreadCount;
             idle_fiber->resume();
             --m_idleThreadCount;
+            busy_tasks = 0;
         }
     }
+    t_worker = nullptr;
+    DisableCoarseClock();
     SYLAR_LOG_DEBUG(g_logger) << "Scheduler::run() exit";
 }
 
@@ -13,15 +13,23 @@
 #include <memory>
 #include <string>
 #include "fiber.h"
+#include "inline_function.h"
 #include "log.h"
+#include "ring_queue.h"
 #include "thread.h"
 
 namespace sylar {
 
+struct SchedulerWorker;
+
 /**
  * @brief 协程调度器
  * @details 封装的是N-M的协程调度器
  *          内部有一个线程池,支持协程在线程池里面切换
+ *          默认所有调度线程共用一个全局任务队列。
+ *          配置scheduler.work_stealing为true时每个调度线程有一个本地的无锁队列，调度线程上新加的任务优先放到本地队列，
+ *          外部线程加的任务放到全局队列，指定了线程的任务直接放到目标线程的队列；线程没任务时先取全局队列，
+ *          再随机从其他线程的本地队列窃取。目前的压测里窃取模式吞吐还不如全局队列，所以默认不开
  */
 class Scheduler {
 public:
@@ -46,6 +54,11 @@ public:
      */
     const std::string &getName() const { return m_name; }
 
+    /**
+     * @brief 调度线程的线程ID，不包括use_caller的主线程，它只在stop时参与调度
+     */
+    std::vector<int> getWorkerThreadIds();
+
     /**
      * @brief 获取当前线程调度器指针
      */
@@ -64,17 +77,66 @@ public:
      */
     template <class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+        ScheduleTask task(std::move(fc), thread);
+        if (task.fiber || task.cb) {
+            if (scheduleTask(std::move(task))) {
+                tickle(); // 唤醒idle协程
+            }
+        }
+    }
+
+    /**
+     * @brief 批量添加调度任务，所有任务只加一次锁，最多tickle一次
+     * @tparam InputIterator 迭代器类型，元素为协程对象或函数
+     * @param[in] begin 起始迭代器
+     * @param[in] end 结束迭代器
+     */
+    template <class InputIterator>
+    void schedule(InputIterator begin, InputIterator end) {
+        std::vector<ScheduleTask> tasks;
+        while (begin != end) {
+            ScheduleTask task(*begin, -1);
+            if (task.fiber || task.cb) {
+                tasks.push_back(std::move(task));
+            }
+            ++begin;
+        }
+        if (scheduleTasks(tasks)) {
+            tickle();
         }
+    }
 
-        if (need_tickle) {
-            tickle(); // 唤醒idle协程
+    /**
+     * @brief 批量添加调度任务，任务从容器中移走
+     * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数
+     * @param[in] fcs 协程或函数列表，调用后被清空
+     */
+    template <class FiberOrCb>
+    void scheduleBatch(std::vector<FiberOrCb> &&fcs) {
+        std::vector<ScheduleTask> tasks;
+        tasks.reserve(fcs.size());
+        for (auto &i : fcs) {
+            ScheduleTask task(std::move(i), -1);
+            if (task.fiber || task.cb) {
+                tasks.push_back(std::move(task));
+            }
+        }
+        fcs.clear();
+        if (scheduleTasks(tasks)) {
+            tickle();
         }
     }
 
+    /**
+     * @brief 有协程挂起等待调度器之外的事件时调用，比如交给阻塞调用线程池，计数不为0时调度器不会停止
+     */
+    void addExternalWait() { ++m_externalWaitCount; }
+
+    /**
+     * @brief 外部事件完成，协程已经重新加入调度之后调用
+     */
+    void doneExternalWait() { --m_externalWaitCount; }
+
     /**
      * @brief 启动调度器
      */
@@ -88,9 +150,23 @@ public:
 protected:
     /**
      * @brief 通知协程调度器有任务了
+     * @details 从空闲列表中取出一个线程唤醒，没有空闲线程时什么也不做
      */
     virtual void tickle();
 
+    /**
+     * @brief 唤醒所有空闲线程，调度器停止时使用
+     */
+    void tickleAll();
+
+    /**
+     * @brief 唤醒一个指定的空闲线程
+     * @details 调用前目标线程已经从空闲列表中摘下并设置了通知标志，基类通过futex唤醒阻塞在idle里的线程，
+     *          子类可以重写成自己的等待方式
+     * @param[in] index 调度线程下标
+     */
+    virtual void wakeWorker(size_t index);
+
     /**
      * @brief 协程调度函数
      */
@@ -101,6 +177,12 @@ protected:
      */
     virtual void idle();
 
+    /**
+     * @brief 调度线程执行完一个任务后调用，这时任务协程已经结束或者让出了执行权
+     * @details 子类可以在这里提交协程挂起前攒下的操作，保证操作完成时协程已经处于挂起状态
+     */
+    virtual void afterTask() {}
+
     /**
      * @brief 返回是否可以停止
      */
@@ -117,46 +199,94 @@ protected:
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
-private:
     /**
-     * @brief 添加调度任务，无锁
-     * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
-     * @param[] fc 协程对象或指针
-     * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     * @brief 当前线程登记到空闲列表
+     * @details idle协程在阻塞之前调用，登记之后必须再用hasTasksForIdle检查一次，避免与添加任务的线程之间丢失唤醒
      */
-    template <class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if (task.fiber || task.cb) {
-            m_tasks.push_back(task);
-        }
-        return need_tickle;
-    }
+    void idleBegin();
+
+    /**
+     * @brief 当前线程从空闲列表中移除，被唤醒时已经移除的不做任何事
+     */
+    void idleEnd();
+
+    /**
+     * @brief 当前线程登记为空闲之后是否已经被通知过
+     */
+    bool idleNotified();
 
-private:
+    /**
+     * @brief 当前线程是否有可以执行的任务，包括全局队列、自己的inbox和可以窃取的本地队列
+     */
+    bool hasTasksForIdle();
+
+    /**
+     * @brief 当前调度线程的本地队列或inbox里是否还有任务
+     */
+    bool hasLocalTasks();
+
+    /**
+     * @brief 当前线程在调度器中的下标，不是本调度器的调度线程时返回-1
+     */
+    int getWorkerIndex();
+
+    /**
+     * @brief 下标为index的调度线程的线程ID，还没开始调度时返回-1
+     */
+    int getWorkerThreadId(size_t index);
+
+    /**
+     * @brief 调度线程数量，包括use_caller的主线程
+     */
+    size_t getWorkerCount() const { return m_workers.size(); }
+
+    /**
+     * @brief 是否把创建调度器的线程也作为调度线程，是的话它固定使用下标0，只在stop时参与调度
+     */
+    bool isUseCaller() const { return m_useCaller; }
+
+    /**
+     * @brief 返回是否还有未执行的任务，包括全局队列和所有线程的本地队列
+     */
+    bool hasPendingTasks();
+
+protected:
     /**
      * @brief 调度任务，协程/函数二选一，可指定在哪个线程上调度
+     * @details 只能移动，回调函数使用内联存储，入队出队不会分配内存，也没有智能指针引用计数的开销。
+     *          协程没有指定线程时使用它绑定的线程，挂起的协程被IO事件或定时器唤醒时也回到原来的线程
      */
     struct ScheduleTask {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        InlineFunction cb;
         int thread;
 
-        ScheduleTask(Fiber::ptr f, int thr) {
-            fiber  = f;
-            thread = thr;
+        ScheduleTask(Fiber::ptr f, int thr)
+            : fiber(std::move(f))
+            , thread(thr) {
+            if (thread == -1 && fiber) {
+                thread = fiber->getThread();
+            }
         }
-        ScheduleTask(Fiber::ptr *f, int thr) {
+        ScheduleTask(Fiber::ptr *f, int thr)
+            : thread(thr) {
             fiber.swap(*f);
-            thread = thr;
+            if (thread == -1 && fiber) {
+                thread = fiber->getThread();
+            }
         }
-        ScheduleTask(std::function<void()> f, int thr) {
-            cb     = f;
-            thread = thr;
+        template <class F, class = typename std::enable_if<
+                               !std::is_convertible<F, Fiber::ptr>::value
+                               && !std::is_convertible<F, Fiber::ptr *>::value>::type>
+        ScheduleTask(F &&f, int thr)
+            : cb(std::forward<F>(f))
+            , thread(thr) {
         }
         ScheduleTask() { thread = -1; }
 
+        ScheduleTask(ScheduleTask &&) = default;
+        ScheduleTask &operator=(ScheduleTask &&) = default;
+
         void reset() {
             fiber  = nullptr;
             cb     = nullptr;
@@ -164,6 +294,60 @@ private:
         }
     };
 
+    /**
+     * @brief 批量添加调度任务
+     * @details 指定线程的任务放到目标线程的inbox，调度线程上添加的任务放本地队列，其余的一次加锁全部放入全局队列
+     * @param[in] tasks 任务列表
+     * @return 是否需要tickle
+     */
+    bool scheduleTasks(std::vector<ScheduleTask> &tasks);
+
+private:
+    friend struct SchedulerWorker;
+
+    /**
+     * @brief 添加调度任务，根据任务和当前线程选择放到哪个队列
+     * @return 是否需要tickle
+     */
+    bool scheduleTask(ScheduleTask &&task);
+
+    /**
+     * @brief 添加到全局队列
+     * @return 是否需要tickle
+     */
+    bool scheduleGlobal(ScheduleTask &&task);
+
+    /**
+     * @brief 指定了线程的任务放到目标线程的inbox并唤醒它
+     * @details 不进全局队列，其他空闲线程不会因为取不了的任务而空转
+     */
+    void schedulePinned(SchedulerWorker *worker, ScheduleTask &&task);
+
+    /**
+     * @brief 根据线程id找到对应的调度线程，找不到返回nullptr
+     */
+    SchedulerWorker *getWorker(int thread);
+
+    /**
+     * @brief 有指定在worker上执行的任务时调用，worker空闲时唤醒它
+     */
+    void notifyWorker(SchedulerWorker *worker);
+
+    /**
+     * @brief 从全局队列里取一个当前线程可以执行的任务，顺便搬一部分到本地队列
+     * @param[in] worker 当前调度线程，为nullptr时不搬运
+     * @param[out] task 取到的任务
+     * @param[out] tickle_me 取完之后全局队列是否还有其他线程可以执行的任务
+     * @return 是否取到
+     */
+    bool takeGlobal(SchedulerWorker *worker, ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 为当前线程取下一个要执行的任务
+     * @return 是否取到
+     */
+    bool takeTask(SchedulerWorker *worker, ScheduleTask &task, bool &tickle_me);
+
 private:
     /// 协程调度器名称
     std::string m_name;
@@ -171,8 +355,18 @@ private:
     MutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 任务队列
-    std::list<ScheduleTask> m_tasks;
+    /// 全局任务队列
+    RingQueue<ScheduleTask> m_tasks;
+    /// 全局任务队列的长度，用于不加锁判断队列是否为空
+    std::atomic<size_t> m_taskCount = {0};
+    /// 挂起等待调度器之外事件的协程数
+    std::atomic<size_t> m_externalWaitCount = {0};
+    /// 是否启用每线程本地队列和工作窃取
+    bool m_workStealing = true;
+    /// 调度线程，use_caller时下标0为caller线程
+    std::vector<SchedulerWorker *> m_workers;
+    /// 下一个待认领的调度线程下标
+    std::atomic<size_t> m_nextWorker = {0};
     /// 线程池的线程ID数组
     std::vector<int> m_threadIds;
     /// 工作线程数量，不包含use_caller的主线程
@@ -181,6 +375,10 @@ private:
     std::atomic<size_t> m_activeThreadCount = {0};
     /// idle线程数
     std::atomic<size_t> m_idleThreadCount = {0};
+    /// 阻塞在idle里等待唤醒的调度线程，后进先出，优先唤醒刚空闲的线程
+    std::vector<SchedulerWorker *> m_idleWorkers;
+    /// 保护m_idleWorkers
+    MutexType m_idleMutex;
 
     /// 是否use caller
     bool m_useCaller;
@@ -98,6 +98,17 @@ void Socket::setRecvTimeout(int64_t v) {
     setOption(SOL_SOCKET, SO_RCVTIMEO, tv);
 }
 
+bool Socket::setReusePort(bool v) {
+    if (!isValid()) {
+        newSock();
+        if (SYLAR_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = v ? 1 : 0;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::getOption(int level, int option, void *result, socklen_t *len) {
     int rt = getsockopt(m_sock, level, option, result, (socklen_t *)len);
     if (rt) {
@@ -121,10 +132,15 @@ bool Socket::setOption(int level, int option, const void *result, socklen_t len)
 
 Socket::ptr Socket::accept() {
     Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sock, nullptr, nullptr);
+    // 新连接直接设成非阻塞，登记FdCtx时不用再调fcntl
+    int newsock = ::accept4(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (newsock == -1) {
-        SYLAR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
-                                  << errno << " errstr=" << strerror(errno);
+        // fd用尽由调用方处理，连接风暴时不在这里刷日志；
+        // 监听socket被close()时挂起的accept返回EBADF/ECANCELED，是正常的停止流程，由调用方决定要不要记录
+        if (errno != EMFILE && errno != ENFILE && errno != EBADF && errno != ECANCELED) {
+            SYLAR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
+                                      << errno << " errstr=" << strerror(errno);
+        }
         return nullptr;
     }
     if (sock->init(newsock)) {
@@ -150,6 +150,12 @@ public:
         return setOption(level, option, &value, sizeof(T));
     }
 
+    /**
+     * @brief 设置SO_REUSEPORT，多个socket可以监听同一个地址，由内核在它们之间分配连接
+     * @details 需要在bind之前调用，socket还没有创建时先创建
+     */
+    bool setReusePort(bool v);
+
     /**
      * @brief 接收connect链接
      * @return 成功返回新连接的socket,失败返回nullptr
@@ -1,4 +1,5 @@
 #include "socket_stream.h"
+#include <sys/sendfile.h>
 #include "../util.h"
 
 namespace sylar {
@@ -58,6 +59,49 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     return rt;
 }
 
+int64_t SocketStream::sendFile(int fd, uint64_t offset, uint64_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    off_t off = offset;
+    uint64_t left = length;
+    while(left > 0) {
+        // sendfile走hook，发送缓冲区满时在socket的可写事件上挂起
+        ssize_t n = ::sendfile(m_socket->getSocket(), fd, &off, left);
+        if(n <= 0) {
+            return n;
+        }
+        left -= n;
+    }
+    return length;
+}
+
+int64_t SocketStream::writevFixSize(iovec* buffers, size_t count) {
+    if(!isConnected()) {
+        return -1;
+    }
+    int64_t total = 0;
+    while(count > 0) {
+        int rt = m_socket->send(buffers, count);
+        if(rt <= 0) {
+            return rt;
+        }
+        total += rt;
+        // 跳过已经发完的块，调整没发完的那一块
+        size_t n = rt;
+        while(count > 0 && n >= buffers->iov_len) {
+            n -= buffers->iov_len;
+            ++buffers;
+            --count;
+        }
+        if(count > 0) {
+            buffers->iov_base = (char*)buffers->iov_base + n;
+            buffers->iov_len -= n;
+        }
+    }
+    return total;
+}
+
 void SocketStream::close() {
     if(m_socket) {
         m_socket->close();
@@ -80,6 +80,30 @@ public:
      */
     virtual int write(ByteArray::ptr ba, size_t length) override;
 
+    /**
+     * @brief 用sendfile把文件的一段直接发送到socket，数据不经过用户空间
+     * @details 发送缓冲区满时挂起当前协程等待可写，直到全部发完或出错
+     * @param[in] fd 文件句柄
+     * @param[in] offset 文件中的起始偏移，不会修改fd自己的读写位置
+     * @param[in] length 发送的长度
+     * @return
+     *      @retval >0 全部发送成功，返回length
+     *      @retval =0 socket被远端关闭或者文件提前结束
+     *      @retval <0 socket错误
+     */
+    int64_t sendFile(int fd, uint64_t offset, uint64_t length);
+
+    /**
+     * @brief 用一次writev发送多块数据，没有发完时继续发剩下的部分
+     * @param[in, out] buffers 待发送数据的iovec数组，发送过程中会被修改
+     * @param[in] count iovec数组长度
+     * @return
+     *      @retval >0 全部发送成功，返回发送的总长度
+     *      @retval =0 socket被远端关闭
+     *      @retval <0 socket错误
+     */
+    int64_t writevFixSize(iovec* buffers, size_t count);
+
     /**
      * @brief 关闭socket
      */
@@ -1,5 +1,10 @@
 #include "tcp_server.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include "config.h"
+#include "hook.h"
 #include "log.h"
 
 namespace sylar {
@@ -10,6 +15,35 @@ static sylar::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     sylar::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+static sylar::ConfigVar<bool>::ptr g_tcp_server_reuseport =
+    sylar::Config::Lookup("tcp_server.reuseport", false,
+            "one SO_REUSEPORT listener per io worker thread, works best with iomanager.sharded_epoll");
+
+static sylar::ConfigVar<bool>::ptr g_tcp_server_incoming_cpu =
+    sylar::Config::Lookup("tcp_server.incoming_cpu", false,
+            "pin reuseport io workers to cpus and set SO_INCOMING_CPU on their listeners");
+
+static sylar::ConfigVar<uint32_t>::ptr g_tcp_server_max_connections =
+    sylar::Config::Lookup("tcp_server.max_connections", (uint32_t)0,
+            "max connections being handled, stop accepting when reached, 0 means unlimited");
+
+/// fd用尽又没有待接受的连接时，accept协程休眠的时间
+static const uint64_t s_emfile_sleep_us = 50 * 1000;
+
+/**
+ * @brief 把当前线程绑定到cpu
+ */
+static void PinThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rt) {
+        SYLAR_LOG_WARN(g_logger) << "pin thread to cpu " << cpu
+            << " fail errno=" << rt << " errstr=" << strerror(rt);
+    }
+}
+
 TcpServer::TcpServer(sylar::IOManager* io_worker,
                     sylar::IOManager* accept_worker)
     :m_ioWorker(io_worker)
@@ -17,7 +51,11 @@ TcpServer::TcpServer(sylar::IOManager* io_worker,
     ,m_recvTimeout(g_tcp_server_read_timeout->getValue())
     ,m_name("sylar/1.0.0")
     ,m_type("tcp")
-    ,m_isStop(true) {
+    ,m_isStop(true)
+    ,m_reusePort(g_tcp_server_reuseport->getValue())
+    ,m_incomingCpu(g_tcp_server_incoming_cpu->getValue())
+    ,m_maxConnections(g_tcp_server_max_connections->getValue()) {
+    m_reserveFd = open_f("/dev/null", O_RDONLY | O_CLOEXEC);
 }
 
 TcpServer::~TcpServer() {
@@ -25,6 +63,16 @@ TcpServer::~TcpServer() {
         i->close();
     }
     m_socks.clear();
+    m_acceptThreads.clear();
+    m_acceptCpus.clear();
+    if(m_reserveFd != -1) {
+        close_f(m_reserveFd);
+    }
+}
+
+void TcpServer::setMaxConnections(uint32_t v) {
+    m_maxConnections = v;
+    wakeAcceptors();
 }
 
 bool TcpServer::bind(sylar::Address::ptr addr) {
@@ -36,27 +84,65 @@ bool TcpServer::bind(sylar::Address::ptr addr) {
 
 bool TcpServer::bind(const std::vector<Address::ptr>& addrs
                         ,std::vector<Address::ptr>& fails ) {
+    // reuseport模式下每个IO调度线程一个监听socket，否则每个地址一个，由accept_worker接受
+    std::vector<int> threads;
+    if(m_reusePort) {
+        threads = m_ioWorker->getWorkerThreadIds();
+    }
+    if(threads.empty()) {
+        threads.push_back(-1);
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
     for(auto& addr : addrs) {
-        Socket::ptr sock = Socket::CreateTCP(addr);
-        if(!sock->bind(addr)) {
-            SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if(!sock->listen()) {
-            SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        // 端口为0时由内核给第一个socket分配端口，同一组的其他socket绑定到同一个端口
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0; i < threads.size(); ++i) {
+            Socket::ptr sock = Socket::CreateTCP(bind_addr);
+            if(m_reusePort && !sock->setReusePort(true)) {
+                SYLAR_LOG_ERROR(g_logger) << "set SO_REUSEPORT fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)) {
+                SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->listen()) {
+                SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            int cpu = -1;
+#ifdef SO_INCOMING_CPU
+            if(m_reusePort && m_incomingCpu && threads[i] != -1 && cpus > 0) {
+                cpu = i % cpus;
+                if(!sock->setOption(SOL_SOCKET, SO_INCOMING_CPU, cpu)) {
+                    SYLAR_LOG_WARN(g_logger) << "set SO_INCOMING_CPU fail errno="
+                        << errno << " errstr=" << strerror(errno)
+                        << " addr=[" << addr->toString() << "]";
+                    cpu = -1;
+                }
+            }
+#endif
+            bind_addr = sock->getLocalAddress();
+            m_socks.push_back(sock);
+            m_acceptThreads.push_back(threads[i]);
+            m_acceptCpus.push_back(cpu);
         }
-        m_socks.push_back(sock);
     }
 
     if(!fails.empty()) {
         m_socks.clear();
+        m_acceptThreads.clear();
+        m_acceptCpus.clear();
         return false;
     }
 
@@ -69,40 +155,147 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
 }
 
 void TcpServer::startAccept(Socket::ptr sock) {
+    auto self = shared_from_this();
+    // hook的accept先直接调用accept4，EAGAIN时才等待可读，所以每次可读之后会一直接受到backlog取空
     while(!m_isStop) {
+        if(!waitForCapacity()) {
+            break;
+        }
         Socket::ptr client = sock->accept();
         if(client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
-        } else {
+            ++m_connections;
+            // reuseport模式下连接留在接受它的线程上处理
+            m_ioWorker->schedule([self, client]() {
+                self->handleClient(client);
+                self->releaseConnection();
+            }, m_reusePort ? sylar::GetThreadId() : -1);
+        } else if(errno == EMFILE || errno == ENFILE) {
+            shedConnection(sock);
+        } else if(!m_isStop) {
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
         }
     }
 }
 
+bool TcpServer::waitForCapacity() {
+    MutexType::Lock lock(m_mutex);
+    if(m_isStop) {
+        return false;
+    }
+    uint32_t max_connections = m_maxConnections;
+    if(!max_connections || m_connections < max_connections) {
+        return true;
+    }
+    // 协程不在调度器的任何队列里，要让调度器等它回来再停止
+    IOManager* worker = listenWorker();
+    worker->addExternalWait();
+    Fiber::ptr fiber = Fiber::GetThis();
+    Fiber* raw_ptr = fiber.get();
+    m_parked.push_back(std::make_pair(std::move(fiber)
+                , m_reusePort ? sylar::GetThreadId() : -1));
+    lock.unlock();
+
+    raw_ptr->yield();
+    return !m_isStop;
+}
+
+void TcpServer::releaseConnection() {
+    uint32_t count           = --m_connections;
+    uint32_t max_connections = m_maxConnections;
+    if(max_connections && count < max_connections) {
+        wakeAcceptors();
+    }
+}
+
+void TcpServer::wakeAcceptors() {
+    std::vector<std::pair<Fiber::ptr, int> > parked;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_parked.empty()) {
+            return;
+        }
+        parked.swap(m_parked);
+    }
+    // 挂起的accept协程很少，全部唤醒，各自重新检查连接数
+    IOManager* worker = listenWorker();
+    for(auto& i : parked) {
+        worker->schedule(std::move(i.first), i.second);
+        worker->doneExternalWait();
+    }
+}
+
+void TcpServer::shedConnection(Socket::ptr sock) {
+    int fd = -1;
+    {
+        MutexType::Lock lock(m_reserveMutex);
+        if(m_reserveFd != -1) {
+            close_f(m_reserveFd);
+            fd = accept4_f(sock->getSocket(), nullptr, nullptr, SOCK_CLOEXEC);
+            if(fd != -1) {
+                close_f(fd);
+            }
+            m_reserveFd = open_f("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+    }
+    if(fd == -1) {
+        // backlog已经取空，或者连备用句柄都被占用了，accept4会一直返回EMFILE而不等待，休眠一会儿再试
+        usleep(s_emfile_sleep_us);
+        return;
+    }
+    uint64_t count = ++m_shedCount;
+    uint64_t now   = sylar::GetCurrentMS();
+    uint64_t last  = m_lastShedLog;
+    if(now - last >= 1000 && m_lastShedLog.compare_exchange_strong(last, now)) {
+        SYLAR_LOG_WARN(g_logger) << "too many open files, shed connection on " << *sock
+            << " total shed=" << count << " connections=" << m_connections;
+    }
+}
+
 bool TcpServer::start() {
     if(!m_isStop) {
         return true;
     }
     m_isStop = false;
-    for(auto& sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
-                    shared_from_this(), sock));
+    if(!m_reusePort) {
+        for(auto& sock : m_socks) {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
+                        shared_from_this(), sock));
+        }
+        return true;
+    }
+    auto self = shared_from_this();
+    for(size_t i = 0; i < m_socks.size(); ++i) {
+        Socket::ptr sock = m_socks[i];
+        int cpu = m_acceptCpus[i];
+        m_ioWorker->schedule([self, sock, cpu]() {
+            if(cpu >= 0) {
+                PinThread(cpu);
+            }
+            // accept协程绑定在这个线程上，等待可读之后被唤醒也回到这里，接受的连接才留在对应的线程
+            Fiber::GetThis()->setThread(sylar::GetThreadId());
+            self->startAccept(sock);
+        }, m_acceptThreads[i]);
     }
     return true;
 }
 
 void TcpServer::stop() {
-    m_isStop = true;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_isStop = true;
+    }
+    wakeAcceptors();
     auto self = shared_from_this();
-    m_acceptWorker->schedule([this, self]() {
+    listenWorker()->schedule([this, self]() {
         for(auto& sock : m_socks) {
             sock->cancelAll();
             sock->close();
         }
         m_socks.clear();
+        m_acceptThreads.clear();
+        m_acceptCpus.clear();
     });
 }
 
@@ -116,7 +309,11 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name
        << " io_worker=" << (m_ioWorker ? m_ioWorker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
-       << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
+       << " recv_timeout=" << m_recvTimeout
+       << " reuseport=" << m_reusePort
+       << " max_connections=" << m_maxConnections
+       << " connections=" << m_connections
+       << " shed=" << m_shedCount << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_socks) {
         ss << pfx << pfx << *i << std::endl;
@@ -25,6 +25,7 @@ class TcpServer : public std::enable_shared_from_this<TcpServer>
                     , Noncopyable {
 public:
     typedef std::shared_ptr<TcpServer> ptr;
+    typedef Mutex MutexType;
     /**
      * @brief 构造函数
      * @param[in] name 服务器名称
@@ -86,6 +87,45 @@ public:
      */
     virtual void setName(const std::string& v) { m_name = v;}
 
+    /**
+     * @brief 是否每个IO调度线程一个SO_REUSEPORT监听socket
+     */
+    bool isReusePort() const { return m_reusePort;}
+
+    /**
+     * @brief 设置是否每个IO调度线程一个SO_REUSEPORT监听socket，需要在bind之前设置
+     * @details 开启后每个IO调度线程在自己的监听socket上accept，新连接留在这个线程处理，
+     *          由内核在监听socket之间分配连接，不再经过accept_worker转交
+     */
+    void setReusePort(bool v) { m_reusePort = v;}
+
+    /**
+     * @brief 设置reuseport模式下是否用SO_INCOMING_CPU按CPU分配连接，需要在bind之前设置
+     * @details 第i个IO调度线程绑定到第i个CPU，它的监听socket只接收在这个CPU上收到的连接
+     */
+    void setIncomingCpu(bool v) { m_incomingCpu = v;}
+
+    /**
+     * @brief 返回最大连接数，0表示不限制
+     */
+    uint32_t getMaxConnections() const { return m_maxConnections;}
+
+    /**
+     * @brief 设置最大连接数，0表示不限制
+     * @details 连接数到上限时停止accept，新连接留在内核的backlog里，直到有连接处理完
+     */
+    void setMaxConnections(uint32_t v);
+
+    /**
+     * @brief 返回正在处理的连接数，从accept到handleClient返回
+     */
+    uint32_t getConnectionCount() const { return m_connections;}
+
+    /**
+     * @brief 返回fd用尽时接受后立即关闭的连接数
+     */
+    uint64_t getShedCount() const { return m_shedCount;}
+
     /**
      * @brief 是否停止
      */
@@ -106,7 +146,35 @@ protected:
      * @brief 开始接受连接
      */
     virtual void startAccept(Socket::ptr sock);
-    
+
+    /**
+     * @brief 停止时取消和关闭监听socket的调度器，reuseport模式下监听socket在IO调度器上
+     */
+    IOManager* listenWorker() const { return m_reusePort ? m_ioWorker : m_acceptWorker;}
+
+private:
+    /**
+     * @brief 连接数到上限时挂起当前accept协程，直到有连接处理完
+     * @return 服务停止时返回false
+     */
+    bool waitForCapacity();
+
+    /**
+     * @brief 一个连接处理完，连接数降到上限以下时唤醒挂起的accept协程
+     */
+    void releaseConnection();
+
+    /**
+     * @brief 唤醒所有挂起的accept协程
+     */
+    void wakeAcceptors();
+
+    /**
+     * @brief fd用尽时关闭备用句柄腾出一个fd，接受一个连接后立即关闭，再重新打开备用句柄
+     * @details 这样对端马上收到关闭，而不是一直留在backlog里，accept也不会因为EMFILE空转
+     */
+    void shedConnection(Socket::ptr sock);
+
 protected:
     /// 监听Socket数组
     std::vector<Socket::ptr> m_socks;
@@ -122,6 +190,30 @@ protected:
     std::string m_type;
     /// 服务是否停止
     bool m_isStop;
+    /// 是否每个IO调度线程一个SO_REUSEPORT监听socket
+    bool m_reusePort;
+    /// reuseport模式下是否设置SO_INCOMING_CPU
+    bool m_incomingCpu;
+    /// 每个监听socket接受连接的线程，与m_socks一一对应，-1表示由accept_worker任意线程接受
+    std::vector<int> m_acceptThreads;
+    /// 每个监听socket所在线程要绑定的CPU，与m_socks一一对应，-1表示不绑定
+    std::vector<int> m_acceptCpus;
+    /// 最大连接数，0表示不限制，可以在任意线程修改
+    std::atomic<uint32_t> m_maxConnections;
+    /// 正在处理的连接数
+    std::atomic<uint32_t> m_connections{0};
+    /// 保护m_parked
+    MutexType m_mutex;
+    /// 因为连接数到上限而挂起的accept协程和它们所在的线程
+    std::vector<std::pair<Fiber::ptr, int> > m_parked;
+    /// fd用尽时腾出一个fd的备用句柄
+    int m_reserveFd;
+    /// 保护m_reserveFd
+    MutexType m_reserveMutex;
+    /// fd用尽时接受后立即关闭的连接数
+    std::atomic<uint64_t> m_shedCount{0};
+    /// 上次输出关闭连接日志的时间，避免连接风暴时刷屏
+    std::atomic<uint64_t> m_lastShedLog{0};
 };
 
 }
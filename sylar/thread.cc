@@ -71,7 +71,7 @@ void *Thread::run(void *arg) {
     t_thread       = thread;
     t_thread_name  = thread->m_name;
     thread->m_id   = sylar::GetThreadId();
-    pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+    sylar::SetThreadName(thread->m_name);
 
     std::function<void()> cb;
     cb.swap(thread->m_cb);
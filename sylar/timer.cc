@@ -1,9 +1,410 @@
 #include "timer.h"
+#include <string.h>
+#include <algorithm>
 #include "util.h"
 #include "macro.h"
+#include "config.h"
 
 namespace sylar {
 
+static sylar::ConfigVar<bool>::ptr g_timer_timing_wheel =
+    sylar::Config::Lookup("timer.timing_wheel", true, "timer use hierarchical timing wheel instead of std::set");
+
+static sylar::ConfigVar<bool>::ptr g_timer_per_thread =
+    sylar::Config::Lookup("timer.per_thread", true, "worker threads keep their own lock-free timer sets");
+
+/**
+ * @brief 分层时间轮
+ * @details 第0层256个槽，每槽1ms；往上4层每层64个槽，每槽是下一层一整圈的时间，最大约49.7天，更远的定时器先放在最高层。
+ *          每个槽是侵入式双向链表，添加和删除都是O(1)；时间走到高层槽的起点时把整个槽降级到低层。
+ *          每层用位图记录非空的槽，查找最近的到期时间不需要遍历。不加锁，由TimerManager的锁保护
+ */
+class TimingWheel {
+public:
+    /// 层数
+    static const int LEVELS = 5;
+    /// 第0层的位数和槽数
+    static const int ROOT_BITS  = 8;
+    static const int ROOT_SLOTS = 1 << ROOT_BITS;
+    /// 其他层的位数和槽数
+    static const int LEVEL_BITS  = 6;
+    static const int LEVEL_SLOTS = 1 << LEVEL_BITS;
+    /// 槽总数
+    static const int SLOTS = ROOT_SLOTS + (LEVELS - 1) * LEVEL_SLOTS;
+
+    TimingWheel(uint64_t now_ms)
+        :m_current(now_ms) {
+        memset(m_slots, 0, sizeof(m_slots));
+        memset(m_bits, 0, sizeof(m_bits));
+    }
+
+    ~TimingWheel() {
+        for(int i = 0; i < SLOTS; ++i) {
+            while(m_slots[i]) {
+                Timer::ptr timer = unlink(m_slots[i]);
+            }
+        }
+    }
+
+    /**
+     * @brief 定时器数量
+     */
+    size_t size() const { return m_count; }
+
+    /**
+     * @brief 按timer->m_next放入对应的槽，已经过期的放在当前槽
+     */
+    void add(const Timer::ptr& timer) {
+        uint64_t when = std::max(timer->m_next, m_current);
+        uint64_t delta = when - m_current;
+        int slot = 0;
+        if(delta < (uint64_t)ROOT_SLOTS) {
+            slot = when & (ROOT_SLOTS - 1);
+        } else {
+            int level = 1;
+            while(level < LEVELS - 1 && delta >= (1ull << Shift(level + 1))) {
+                ++level;
+            }
+            if(delta >= (1ull << Shift(level + 1))) {
+                // 超出最高层范围的先放到最高层最远的槽，降级时重新计算
+                when = m_current + (1ull << Shift(level + 1)) - 1;
+            }
+            slot = ROOT_SLOTS + (level - 1) * LEVEL_SLOTS
+                    + ((when >> Shift(level)) & (LEVEL_SLOTS - 1));
+        }
+        Timer* head = m_slots[slot];
+        timer->m_slotPrev = nullptr;
+        timer->m_slotNext = head;
+        if(head) {
+            head->m_slotPrev = timer.get();
+        }
+        m_slots[slot] = timer.get();
+        m_bits[slot >> 6] |= 1ull << (slot & 63);
+        timer->m_slot = slot;
+        timer->m_self = timer;
+        ++m_count;
+    }
+
+    /**
+     * @brief 从槽中摘下定时器，返回时间轮持有的引用
+     */
+    Timer::ptr unlink(Timer* timer) {
+        int slot = timer->m_slot;
+        if(timer->m_slotPrev) {
+            timer->m_slotPrev->m_slotNext = timer->m_slotNext;
+        } else {
+            m_slots[slot] = timer->m_slotNext;
+            if(!m_slots[slot]) {
+                m_bits[slot >> 6] &= ~(1ull << (slot & 63));
+            }
+        }
+        if(timer->m_slotNext) {
+            timer->m_slotNext->m_slotPrev = timer->m_slotPrev;
+        }
+        timer->m_slotPrev = timer->m_slotNext = nullptr;
+        timer->m_slot = -1;
+        --m_count;
+        Timer::ptr self;
+        self.swap(timer->m_self);
+        return self;
+    }
+
+    /**
+     * @brief 把now_ms及之前到期的定时器按槽整批取出
+     */
+    void expire(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+        while(m_current <= now_ms) {
+            if(!m_count) {
+                m_current = now_ms + 1;
+                break;
+            }
+            int cur = m_current & (ROOT_SLOTS - 1);
+            int next = FindBit(m_bits, cur, ROOT_SLOTS);
+            if(next < 0) {
+                // 第0层这一圈没有定时器了，直接跳到下一圈的起点
+                uint64_t boundary = m_current - cur + ROOT_SLOTS;
+                if(boundary > now_ms + 1) {
+                    m_current = now_ms + 1;
+                    break;
+                }
+                m_current = boundary;
+                cascade();
+                continue;
+            }
+            if(m_current + (next - cur) > now_ms) {
+                // 不能越过now_ms，否则之后添加的更早的定时器会被推迟
+                m_current = now_ms + 1;
+                break;
+            }
+            m_current += next - cur;
+            while(m_slots[next]) {
+                expired.push_back(unlink(m_slots[next]));
+            }
+            ++m_current;
+            if(!(m_current & (ROOT_SLOTS - 1))) {
+                cascade();
+            }
+        }
+    }
+
+    /**
+     * @brief 最近需要处理的时间，第0层的是准确的到期时间，高层的是降级的时间，没有定时器时返回~0ull
+     */
+    uint64_t nextExpire() const {
+        if(!m_count) {
+            return ~0ull;
+        }
+        uint64_t best = ~0ull;
+        int cur = m_current & (ROOT_SLOTS - 1);
+        uint64_t base = m_current - cur;
+        int i = FindBit(m_bits, cur, ROOT_SLOTS);
+        if(i >= 0) {
+            best = base + i;
+        } else if((i = FindBit(m_bits, 0, cur)) >= 0) {
+            best = base + ROOT_SLOTS + i;
+        }
+        for(int level = 1; level < LEVELS; ++level) {
+            uint64_t bits = m_bits[(ROOT_SLOTS >> 6) + level - 1];
+            if(!bits) {
+                continue;
+            }
+            // 当前下标的槽在这一圈已经降级过，再有定时器就是下一圈的
+            uint64_t round = m_current >> Shift(level);
+            int idx = round & (LEVEL_SLOTS - 1);
+            uint64_t rotated = (bits >> idx) | (idx ? bits << (LEVEL_SLOTS - idx) : 0);
+            rotated &= ~1ull;
+            int k = rotated ? __builtin_ctzll(rotated) : LEVEL_SLOTS;
+            best = std::min(best, (round + k) << Shift(level));
+        }
+        return best;
+    }
+
+private:
+    /**
+     * @brief 第level层每个槽的时间跨度的位数
+     */
+    static int Shift(int level) {
+        return ROOT_BITS + (level - 1) * LEVEL_BITS;
+    }
+
+    /**
+     * @brief 在[from, to)范围内找第一个置位的下标，没有返回-1
+     */
+    static int FindBit(const uint64_t* bits, int from, int to) {
+        while(from < to) {
+            uint64_t word = bits[from >> 6] >> (from & 63);
+            if(word) {
+                int pos = from + __builtin_ctzll(word);
+                return pos < to ? pos : -1;
+            }
+            from = (from | 63) + 1;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief 时间走到第0层一圈的起点时，把高层对应的槽降级，某层下标回到0时继续降级上一层
+     */
+    void cascade() {
+        for(int level = 1; level < LEVELS; ++level) {
+            int idx = (m_current >> Shift(level)) & (LEVEL_SLOTS - 1);
+            int slot = ROOT_SLOTS + (level - 1) * LEVEL_SLOTS + idx;
+            Timer* list = m_slots[slot];
+            m_slots[slot] = nullptr;
+            m_bits[slot >> 6] &= ~(1ull << (slot & 63));
+            while(list) {
+                Timer* timer = list;
+                list = list->m_slotNext;
+                Timer::ptr self;
+                self.swap(timer->m_self);
+                --m_count;
+                add(self);
+            }
+            if(idx) {
+                break;
+            }
+        }
+    }
+
+private:
+    /// 下一个要处理的毫秒，之前到期的都已经取出
+    uint64_t m_current;
+    /// 定时器数量
+    size_t m_count = 0;
+    /// 每个槽的链表头
+    Timer* m_slots[SLOTS];
+    /// 非空槽的位图
+    uint64_t m_bits[SLOTS / 64];
+};
+
+/**
+ * @brief 定时器的存储，std::set或时间轮二选一，不加锁
+ */
+class TimerStore {
+public:
+    TimerStore(bool timing_wheel, uint64_t now_ms) {
+        if(timing_wheel) {
+            m_wheel.reset(new TimingWheel(now_ms));
+        }
+    }
+
+    /**
+     * @brief 定时器数量
+     */
+    size_t size() const {
+        return m_wheel ? m_wheel->size() : m_timers.size();
+    }
+
+    /**
+     * @brief 添加定时器
+     */
+    void add(const Timer::ptr& timer) {
+        if(m_wheel) {
+            m_wheel->add(timer);
+        } else {
+            m_timers.insert(timer);
+        }
+    }
+
+    /**
+     * @brief 删除定时器
+     * @return 定时器是否在存储中
+     */
+    bool remove(const Timer::ptr& timer) {
+        if(m_wheel) {
+            if(timer->m_slot < 0) {
+                return false;
+            }
+            m_wheel->unlink(timer.get());
+            return true;
+        }
+        auto it = m_timers.find(timer);
+        if(it == m_timers.end()) {
+            return false;
+        }
+        m_timers.erase(it);
+        return true;
+    }
+
+    /**
+     * @brief 最近一个定时器的执行时间，没有定时器时返回~0ull
+     * @details 时间轮模式下高层的槽只能知道最早什么时候需要降级，返回的是不晚于实际执行时间的值
+     */
+    uint64_t nextExpire() const {
+        if(m_wheel) {
+            return m_wheel->nextExpire();
+        }
+        return m_timers.empty() ? ~0ull : (*m_timers.begin())->m_next;
+    }
+
+    /**
+     * @brief 取出now_ms及之前到期的定时器
+     */
+    void expire(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+        if(m_wheel) {
+            // 时间轮按槽整批取出
+            m_wheel->expire(now_ms, expired);
+            return;
+        }
+        if(m_timers.empty() || (*m_timers.begin())->m_next > now_ms) {
+            return;
+        }
+        Timer::ptr now_timer(new Timer(now_ms));
+        auto it = m_timers.lower_bound(now_timer);
+        while(it != m_timers.end() && (*it)->m_next == now_ms) {
+            ++it;
+        }
+        expired.insert(expired.end(), m_timers.begin(), it);
+        m_timers.erase(m_timers.begin(), it);
+    }
+
+private:
+    /// 按执行时间排序的定时器集合
+    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    /// 时间轮，为空时使用m_timers
+    std::unique_ptr<TimingWheel> m_wheel;
+};
+
+/**
+ * @brief 投递给所属线程的重置请求
+ */
+struct TimerMessage {
+    /// 目标定时器
+    Timer::ptr timer;
+    /// 是否refresh
+    bool refresh = false;
+    /// reset的参数
+    uint64_t ms = 0;
+    bool from_now = false;
+    /// 投递时的时间
+    uint64_t now = 0;
+    /// 信箱链表的下一个
+    TimerMessage* next = nullptr;
+};
+
+/**
+ * @brief 调度线程私有的定时器集合
+ * @details store只有所属线程访问；信箱是无锁栈，任意线程压入，所属线程整体取出。
+ *          取消和重新启用不分配消息，直接把定时器自己串进posted，一个定时器同时最多在里面一次
+ */
+struct TimerShard {
+    TimerShard(bool timing_wheel, uint64_t now_ms)
+        :store(timing_wheel, now_ms) {
+    }
+
+    ~TimerShard() {
+        TimerMessage* msg = mailbox.exchange(nullptr);
+        while(msg) {
+            TimerMessage* next = msg->next;
+            delete msg;
+            msg = next;
+        }
+        Timer* timer = posted.exchange(nullptr);
+        while(timer) {
+            Timer* next = timer->m_postNext;
+            Timer::ptr hold;
+            hold.swap(timer->m_postSelf);
+            timer->m_posted.store(false);
+            timer = next;
+        }
+    }
+
+    /**
+     * @brief 所属线程修改store之后同步数量，给其他线程的hasTimer用
+     */
+    void syncCount() {
+        count.store(store.size(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 压入信箱，任意线程调用
+     */
+    void post(TimerMessage* msg) {
+        // 与所属线程检查信箱的顺序有关，用默认的顺序一致性
+        msg->next = mailbox.load(std::memory_order_relaxed);
+        while(!mailbox.compare_exchange_weak(msg->next, msg)) {
+        }
+    }
+
+    /**
+     * @brief 把定时器压入posted，任意线程调用，调用方已经把m_posted置位
+     */
+    void post(Timer* timer) {
+        timer->m_postNext = posted.load(std::memory_order_relaxed);
+        while(!posted.compare_exchange_weak(timer->m_postNext, timer)) {
+        }
+    }
+
+    /// 定时器存储
+    TimerStore store;
+    /// 定时器数量
+    std::atomic<size_t> count{0};
+    /// 其他线程投递的请求
+    std::atomic<TimerMessage*> mailbox{nullptr};
+    /// 其他线程取消或重新启用的定时器
+    std::atomic<Timer*> posted{nullptr};
+};
+
 bool Timer::Comparator::operator()(const Timer::ptr& lhs
                         ,const Timer::ptr& rhs) const {
     if(!lhs && !rhs) {
@@ -31,7 +432,7 @@ Timer::Timer(uint64_t ms, std::function<void()> cb,
     ,m_ms(ms)
     ,m_cb(cb)
     ,m_manager(manager) {
-    m_next = sylar::GetElapsedMS() + m_ms;
+    m_next = sylar::CoarseNowMS() + m_ms;
 }
 
 Timer::Timer(uint64_t next)
@@ -39,32 +440,39 @@ Timer::Timer(uint64_t next)
 }
 
 bool Timer::cancel() {
+    if(m_shard >= 0) {
+        return m_manager->cancelShardTimer(shared_from_this());
+    }
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if(m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        m_manager->m_store->remove(shared_from_this());
         return true;
     }
     return false;
 }
 
 bool Timer::refresh() {
+    if(m_shard >= 0) {
+        return m_manager->resetShardTimer(shared_from_this(), 0, false, true);
+    }
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if(!m_cb) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    Timer::ptr self = shared_from_this();
+    if(!m_manager->m_store->remove(self)) {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    m_next = sylar::GetElapsedMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_next = sylar::CoarseNowMS() + m_ms;
+    m_manager->m_store->add(self);
     return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now) {
+    if(m_shard >= 0) {
+        return m_manager->resetShardTimer(shared_from_this(), ms, from_now, false);
+    }
     if(ms == m_ms && !from_now) {
         return true;
     }
@@ -72,34 +480,73 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     if(!m_cb) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    Timer::ptr self = shared_from_this();
+    if(!m_manager->m_store->remove(self)) {
         return false;
     }
-    m_manager->m_timers.erase(it);
     uint64_t start = 0;
     if(from_now) {
-        start = sylar::GetElapsedMS();
+        start = sylar::CoarseNowMS();
     } else {
         start = m_next - m_ms;
     }
     m_ms = ms;
     m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
+    m_manager->addTimer(self, lock);
     return true;
 
 }
 
-TimerManager::TimerManager() {
-    m_previouseTime = sylar::GetElapsedMS();
+TimerManager::TimerManager()
+    :TimerManager(g_timer_timing_wheel->getValue()) {
+}
+
+TimerManager::TimerManager(bool timing_wheel)
+    :m_timingWheel(timing_wheel) {
+    m_store.reset(new TimerStore(timing_wheel, sylar::CoarseNowMS()));
 }
 
 TimerManager::~TimerManager() {
+    for(auto i : m_shards) {
+        delete i;
+    }
+}
+
+void TimerManager::initTimerShards(size_t count) {
+    SYLAR_ASSERT(m_shards.empty());
+    if(!g_timer_per_thread->getValue()) {
+        return;
+    }
+    uint64_t now_ms = sylar::CoarseNowMS();
+    for(size_t i = 0; i < count; ++i) {
+        m_shards.push_back(new TimerShard(m_timingWheel, now_ms));
+    }
+}
+
+TimerShard* TimerManager::getCurrentShard() {
+    if(m_shards.empty()) {
+        return nullptr;
+    }
+    int index = getTimerShardIndex();
+    return (index >= 0 && index < (int)m_shards.size()) ? m_shards[index] : nullptr;
+}
+
+bool TimerManager::hasTimerShardChanges() {
+    TimerShard* shard = getCurrentShard();
+    return shard && (shard->mailbox.load() != nullptr || shard->posted.load() != nullptr);
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
                                   ,bool recurring) {
     Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    TimerShard* shard = getCurrentShard();
+    if(shard) {
+        // 调度线程自己正在运行，回到idle时会重新计算超时，不需要唤醒
+        timer->m_shard = getTimerShardIndex();
+        shard->store.add(timer);
+        shard->syncCount();
+        return timer;
+    }
     RWMutexType::WriteLock lock(m_mutex);
     addTimer(timer, lock);
     return timer;
@@ -118,58 +565,256 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
     return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
 }
 
+bool TimerManager::rearmTimer(const Timer::ptr& timer, uint64_t ms, std::function<void()> cb) {
+    if(timer->m_manager != this || timer->m_recurring) {
+        return false;
+    }
+    uint64_t next = sylar::CoarseNowMS() + ms;
+    if(timer->m_shard < 0) {
+        RWMutexType::WriteLock lock(m_mutex);
+        // 回调不为空说明还在集合里等待执行
+        if(timer->m_cb) {
+            return false;
+        }
+        timer->m_cb = std::move(cb);
+        timer->m_ms = ms;
+        timer->m_next = next;
+        addTimer(timer, lock);
+        return true;
+    }
+    if(timer->m_shard >= (int)m_shards.size()) {
+        return false;
+    }
+    // 只有执行过或取消了的定时器可以重新启用。先占成FIRING，写回调期间所属线程和其他线程都不会碰它；
+    // 所属线程正在释放被取消的定时器的回调时也是FIRING，这时返回false由调用方重新创建
+    int expected = Timer::EXPIRED;
+    if(!timer->m_state.compare_exchange_strong(expected, Timer::FIRING)) {
+        expected = Timer::CANCELLED;
+        if(!timer->m_state.compare_exchange_strong(expected, Timer::FIRING)) {
+            return false;
+        }
+    }
+    TimerShard* shard = m_shards[timer->m_shard];
+    if(getTimerShardIndex() == timer->m_shard) {
+        if(timer->m_posted.load()) {
+            drainShardMailbox(shard);
+        }
+        shard->store.remove(timer);
+        timer->m_cb = std::move(cb);
+        timer->m_ms = ms;
+        timer->m_next = next;
+        timer->m_state.store(Timer::ACTIVE);
+        shard->store.add(timer);
+        shard->syncCount();
+        return true;
+    }
+    // 先写好参数再改状态，所属线程处理信箱时按新的时间加入
+    timer->m_cb = std::move(cb);
+    timer->m_wantMs.store(ms, std::memory_order_relaxed);
+    timer->m_wantNext.store(next, std::memory_order_relaxed);
+    timer->m_state.store(Timer::ACTIVE);
+    postShardTimer(timer);
+    onTimerShardChanged(timer->m_shard, next);
+    return true;
+}
+
+void TimerManager::postShardTimer(const Timer::ptr& timer) {
+    // 所属线程先清掉m_posted再读状态，这里先改状态再置位，没有投递成功的那次一定会被看到
+    if(!timer->m_posted.exchange(true)) {
+        timer->m_postSelf = timer;
+        m_shards[timer->m_shard]->post(timer.get());
+    }
+}
+
+bool TimerManager::cancelShardTimer(const Timer::ptr& timer) {
+    // 所属线程要释放回调，先占成FIRING，释放完再改成CANCELLED，避免和其他线程的重新启用竞争
+    bool owner = (getTimerShardIndex() == timer->m_shard);
+    int expected = Timer::ACTIVE;
+    if(!timer->m_state.compare_exchange_strong(expected, owner ? Timer::FIRING : Timer::CANCELLED)) {
+        return false;
+    }
+    TimerShard* shard = m_shards[timer->m_shard];
+    if(owner) {
+        if(timer->m_posted.load()) {
+            drainShardMailbox(shard);
+        }
+        shard->store.remove(timer);
+        shard->syncCount();
+        timer->m_cb = nullptr;
+        timer->m_state.store(Timer::CANCELLED);
+        return true;
+    }
+    // 状态已经是CANCELLED，不会再执行。所属线程可能正在复制循环定时器的回调，这里不碰回调，
+    // 由所属线程处理信箱时从集合里摘掉并释放，不用唤醒它
+    postShardTimer(timer);
+    return true;
+}
+
+bool TimerManager::resetShardTimer(const Timer::ptr& timer, uint64_t ms, bool from_now, bool refresh) {
+    if(timer->m_state.load() != Timer::ACTIVE) {
+        return false;
+    }
+    TimerShard* shard = m_shards[timer->m_shard];
+    if(getTimerShardIndex() == timer->m_shard) {
+        if(timer->m_posted.load()) {
+            drainShardMailbox(shard);
+        }
+        return applyShardReset(shard, timer, ms, from_now, refresh, sylar::CoarseNowMS());
+    }
+    TimerMessage* msg = new TimerMessage;
+    msg->timer = timer;
+    msg->refresh = refresh;
+    msg->ms = ms;
+    msg->from_now = from_now;
+    msg->now = sylar::CoarseNowMS();
+    shard->post(msg);
+    onTimerShardChanged(timer->m_shard, 0);
+    return true;
+}
+
+bool TimerManager::applyShardReset(TimerShard* shard, const Timer::ptr& timer, uint64_t ms,
+                                   bool from_now, bool refresh, uint64_t now_ms) {
+    if(timer->m_state.load() != Timer::ACTIVE) {
+        return false;
+    }
+    if(!refresh && ms == timer->m_ms && !from_now) {
+        return true;
+    }
+    if(!shard->store.remove(timer)) {
+        return false;
+    }
+    uint64_t start = (refresh || from_now) ? now_ms : timer->m_next - timer->m_ms;
+    if(!refresh) {
+        timer->m_ms = ms;
+    }
+    timer->m_next = start + timer->m_ms;
+    shard->store.add(timer);
+    return true;
+}
+
+void TimerManager::drainShardMailbox(TimerShard* shard) {
+    Timer* timer = shard->posted.exchange(nullptr);
+    while(timer) {
+        Timer* next = timer->m_postNext;
+        Timer::ptr hold;
+        hold.swap(timer->m_postSelf);
+        // 先清标志再读状态，之后别的线程重新启用会再投递一次
+        timer->m_posted.store(false);
+        shard->store.remove(hold);
+        if(timer->m_state.load() == Timer::ACTIVE) {
+            timer->m_ms = timer->m_wantMs.load(std::memory_order_relaxed);
+            timer->m_next = timer->m_wantNext.load(std::memory_order_relaxed);
+            shard->store.add(hold);
+        } else {
+            // 其他线程取消的定时器，回调在这里释放；占不到说明已经被重新启用了，之后会再投递过来
+            int expected = Timer::CANCELLED;
+            if(timer->m_state.compare_exchange_strong(expected, Timer::FIRING)) {
+                timer->m_cb = nullptr;
+                timer->m_state.store(Timer::CANCELLED);
+            }
+        }
+        timer = next;
+    }
+
+    TimerMessage* msg = shard->mailbox.exchange(nullptr, std::memory_order_acquire);
+    if(!msg) {
+        shard->syncCount();
+        return;
+    }
+    // 信箱是后进先出的，反转之后按投递顺序处理
+    TimerMessage* list = nullptr;
+    while(msg) {
+        TimerMessage* next = msg->next;
+        msg->next = list;
+        list = msg;
+        msg = next;
+    }
+    while(list) {
+        TimerMessage* next = list->next;
+        applyShardReset(shard, list->timer, list->ms, list->from_now, list->refresh, list->now);
+        delete list;
+        list = next;
+    }
+    shard->syncCount();
+}
+
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if(m_timers.empty()) {
+    uint64_t next = ~0ull;
+    TimerShard* shard = getCurrentShard();
+    if(shard) {
+        drainShardMailbox(shard);
+        next = shard->store.nextExpire();
+    }
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        m_tickled = false;
+        next = std::min(next, m_store->nextExpire());
+    }
+    if(next == ~0ull) {
         return ~0ull;
     }
 
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = sylar::GetElapsedMS();
-    if(now_ms >= next->m_next) {
+    uint64_t now_ms = sylar::CoarseNowMS();
+    if(now_ms >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_ms;
     }
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-    uint64_t now_ms = sylar::GetElapsedMS();
+    uint64_t now_ms = sylar::CoarseNowMS();
     std::vector<Timer::ptr> expired;
+
+    TimerShard* shard = getCurrentShard();
+    if(shard) {
+        drainShardMailbox(shard);
+        shard->store.expire(now_ms, expired);
+        for(auto& timer : expired) {
+            if(timer->m_posted.load()) {
+                // 其他线程取消或重新启用过，交给信箱处理
+                continue;
+            }
+            if(timer->m_recurring) {
+                if(timer->m_state.load() == Timer::ACTIVE) {
+                    cbs.push_back(timer->m_cb);
+                    timer->m_next = now_ms + timer->m_ms;
+                    shard->store.add(timer);
+                    continue;
+                }
+                timer->m_cb = nullptr;
+            } else {
+                // 与其他线程的取消竞争，抢到的才执行；取出回调之前是FIRING，其他线程不能重新启用
+                int expected = Timer::ACTIVE;
+                if(timer->m_state.compare_exchange_strong(expected, Timer::FIRING)) {
+                    cbs.push_back(std::move(timer->m_cb));
+                    timer->m_cb = nullptr;
+                    timer->m_state.store(Timer::EXPIRED);
+                }
+            }
+        }
+        shard->syncCount();
+        expired.clear();
+    }
+
     {
         RWMutexType::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
+        if(m_timingWheel ? m_store->nextExpire() > now_ms : m_store->size() == 0) {
             return;
         }
     }
     RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
-        return;
-    }
-    bool rollover = false;
-    if(SYLAR_UNLIKELY(detectClockRollover(now_ms))) {
-        // 使用clock_gettime(CLOCK_MONOTONIC_RAW)，应该不可能出现时间回退的问题
-        rollover = true;
-    }
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    if(m_store->size() == 0) {
         return;
     }
-
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+    m_store->expire(now_ms, expired);
+    cbs.reserve(cbs.size() + expired.size());
 
     for(auto& timer : expired) {
         cbs.push_back(timer->m_cb);
         if(timer->m_recurring) {
             timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            m_store->add(timer);
         } else {
             timer->m_cb = nullptr;
         }
@@ -177,8 +822,9 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
 }
 
 void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
+    uint64_t prev = m_store->nextExpire();
+    m_store->add(val);
+    bool at_front = (val->m_next < prev) && !m_tickled;
     if(at_front) {
         m_tickled = true;
     }
@@ -189,19 +835,14 @@ void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
     }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if(now_ms < m_previouseTime &&
-            now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-        rollover = true;
-    }
-    m_previouseTime = now_ms;
-    return rollover;
-}
-
 bool TimerManager::hasTimer() {
+    for(auto i : m_shards) {
+        if(i->count.load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
     RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    return m_store->size() > 0;
 }
 
 }
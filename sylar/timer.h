@@ -9,6 +9,8 @@
 #ifndef __SYLAR_TIMER_H__
 #define __SYLAR_TIMER_H__
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 #include <set>
@@ -17,11 +19,17 @@
 namespace sylar {
 
 class TimerManager;
+class TimingWheel;
+class TimerStore;
+struct TimerShard;
 /**
  * @brief 定时器
  */
 class Timer : public std::enable_shared_from_this<Timer> {
 friend class TimerManager;
+friend class TimingWheel;
+friend class TimerStore;
+friend struct TimerShard;
 public:
     /// 定时器的智能指针类型
     typedef std::shared_ptr<Timer> ptr;
@@ -58,6 +66,14 @@ private:
      */
     Timer(uint64_t next);
 private:
+    /// 线程私有定时器的状态，其他线程取消时只修改状态
+    enum State {
+        ACTIVE    = 0,
+        CANCELLED = 1,
+        EXPIRED   = 2,
+        /// 有线程正在读写非ACTIVE定时器的回调：所属线程取出到期的回调或释放取消的回调，或者重新启用时写回调
+        FIRING    = 3,
+    };
     /// 是否循环定时器
     bool m_recurring = false;
     /// 执行周期
@@ -68,6 +84,26 @@ private:
     std::function<void()> m_cb;
     /// 定时器管理器
     TimerManager* m_manager = nullptr;
+    /// 时间轮模式下所在槽的链表前后节点
+    Timer* m_slotPrev = nullptr;
+    Timer* m_slotNext = nullptr;
+    /// 时间轮模式下所在的槽，-1表示不在时间轮里
+    int m_slot = -1;
+    /// 在时间轮里时持有自己，直到到期或被取消
+    Timer::ptr m_self;
+    /// 所属调度线程的下标，-1表示放在全局的定时器集合里
+    int m_shard = -1;
+    /// 线程私有定时器的状态
+    std::atomic<int> m_state{ACTIVE};
+    /// 其他线程取消或重新启用后投递给所属线程，是否已经在信箱里
+    std::atomic<bool> m_posted{false};
+    /// 信箱链表的下一个
+    Timer* m_postNext = nullptr;
+    /// 在信箱里时持有自己
+    Timer::ptr m_postSelf;
+    /// 其他线程重新启用时期望的执行时间和周期，由所属线程生效
+    std::atomic<uint64_t> m_wantNext{0};
+    std::atomic<uint64_t> m_wantMs{0};
 private:
     /**
      * @brief 定时器比较仿函数
@@ -84,6 +120,10 @@ private:
 
 /**
  * @brief 定时器管理器
+ * @details 定时器可以放在按执行时间排序的std::set里，也可以放在分层时间轮里。
+ *          时间轮添加和取消都是O(1)，到期时整槽取出；std::set的实现保留用于对比，由配置timer.timing_wheel选择。
+ *          子类调用initTimerShards之后，调度线程上添加的定时器放在该线程私有的集合里，添加、取消和到期都不加锁；
+ *          其他线程取消或重置这些定时器时投递到所属线程的无锁信箱，由所属线程处理。非调度线程添加的定时器仍放在加锁的全局集合里
  */
 class TimerManager {
 friend class Timer;
@@ -92,10 +132,16 @@ public:
     typedef RWMutex RWMutexType;
 
     /**
-     * @brief 构造函数
+     * @brief 构造函数，按配置选择定时器的存储方式
      */
     TimerManager();
 
+    /**
+     * @brief 构造函数
+     * @param[in] timing_wheel 是否使用时间轮，否则使用std::set
+     */
+    explicit TimerManager(bool timing_wheel);
+
     /**
      * @brief 析构函数
      */
@@ -121,13 +167,25 @@ public:
                         ,std::weak_ptr<void> weak_cond
                         ,bool recurring = false);
 
+    /**
+     * @brief 重新启用一个已经取消或执行过的单次定时器，复用定时器对象，不分配内存
+     * @details 可以在任意线程调用，其他线程的私有定时器投递给所属线程生效
+     * @param[in] timer 由本管理器创建的定时器
+     * @param[in] ms 定时器执行间隔时间
+     * @param[in] cb 定时器回调函数
+     * @return 定时器不属于本管理器、是循环定时器或者还在等待执行时返回false，调用方应改用addTimer
+     */
+    bool rearmTimer(const Timer::ptr& timer, uint64_t ms, std::function<void()> cb);
+
     /**
      * @brief 到最近一个定时器执行的时间间隔(毫秒)
+     * @details 包括全局集合和当前线程私有的定时器，其他线程私有的不计算在内
      */
     uint64_t getNextTimer();
 
     /**
      * @brief 获取需要执行的定时器的回调函数列表
+     * @details 包括全局集合和当前线程私有的定时器
      * @param[out] cbs 回调函数数组
      */
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
@@ -136,6 +194,11 @@ public:
      * @brief 是否有定时器
      */
     bool hasTimer();
+
+    /**
+     * @brief 是否使用时间轮
+     */
+    bool isTimingWheel() const { return m_timingWheel; }
 protected:
 
     /**
@@ -143,24 +206,77 @@ protected:
      */
     virtual void onTimerInsertedAtFront() = 0;
 
+    /**
+     * @brief 为每个调度线程创建私有的定时器集合，只能在开始使用定时器之前调用一次
+     * @param[in] count 调度线程数量
+     */
+    void initTimerShards(size_t count);
+
+    /**
+     * @brief 当前线程私有定时器集合的下标，不是调度线程时返回-1
+     */
+    virtual int getTimerShardIndex() { return -1; }
+
+    /**
+     * @brief 其他线程重置或重新启用了index线程的私有定时器，需要时唤醒它重新计算超时
+     * @param[in] next_ms 新的执行时间，0表示不确定
+     */
+    virtual void onTimerShardChanged(size_t index, uint64_t next_ms) {}
+
+    /**
+     * @brief 当前线程的信箱里是否有还没处理的取消或重置
+     */
+    bool hasTimerShardChanges();
+
     /**
      * @brief 将定时器添加到管理器中
      */
     void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
 private:
     /**
-     * @brief 检测服务器时间是否被调后了
+     * @brief 当前线程私有的定时器集合，不是调度线程时返回nullptr
+     */
+    TimerShard* getCurrentShard();
+
+    /**
+     * @brief 取消线程私有的定时器，所属线程直接删除，其他线程投递到信箱
+     */
+    bool cancelShardTimer(const Timer::ptr& timer);
+
+    /**
+     * @brief 刷新或重置线程私有的定时器，所属线程直接修改，其他线程投递到信箱
+     * @param[in] refresh 为true时是refresh，忽略ms和from_now
      */
-    bool detectClockRollover(uint64_t now_ms);
+    bool resetShardTimer(const Timer::ptr& timer, uint64_t ms, bool from_now, bool refresh);
+
+    /**
+     * @brief 在所属线程上执行刷新或重置
+     * @param[in] now_ms 发起操作时的时间
+     */
+    bool applyShardReset(TimerShard* shard, const Timer::ptr& timer, uint64_t ms,
+                         bool from_now, bool refresh, uint64_t now_ms);
+
+    /**
+     * @brief 把其他线程取消或重新启用的定时器投递给所属线程，已经在信箱里的不重复投递
+     */
+    void postShardTimer(const Timer::ptr& timer);
+
+    /**
+     * @brief 处理当前线程信箱里的取消、重置和重新启用
+     */
+    void drainShardMailbox(TimerShard* shard);
+
 private:
     /// Mutex
     RWMutexType m_mutex;
-    /// 定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    /// 是否使用时间轮
+    bool m_timingWheel = true;
+    /// 全局定时器集合，非调度线程添加的定时器放在这里
+    std::unique_ptr<TimerStore> m_store;
+    /// 每个调度线程私有的定时器集合
+    std::vector<TimerShard*> m_shards;
     /// 是否触发onTimerInsertedAtFront
     bool m_tickled = false;
-    /// 上次执行时间
-    uint64_t m_previouseTime = 0;
 };
 
 }
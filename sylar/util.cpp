@@ -37,14 +37,24 @@ uint64_t GetElapsedMS() {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-std::string GetThreadName() {
-    char thread_name[16] = {0};
-    pthread_getname_np(pthread_self(), thread_name, 16);
-    return std::string(thread_name);
+/// 线程名称缓存，SetThreadName时同步更新
+static thread_local std::string t_thread_name;
+static thread_local bool t_thread_name_cached = false;
+
+const std::string &GetThreadName() {
+    if (!t_thread_name_cached) {
+        char thread_name[16] = {0};
+        pthread_getname_np(pthread_self(), thread_name, 16);
+        t_thread_name        = thread_name;
+        t_thread_name_cached = true;
+    }
+    return t_thread_name;
 }
 
 void SetThreadName(const std::string &name) {
-    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    t_thread_name        = name.substr(0, 15);
+    t_thread_name_cached = true;
+    pthread_setname_np(pthread_self(), t_thread_name.c_str());
 }
 
 static std::string demangle(const char *str) {
@@ -106,6 +116,39 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+/**
+ * @brief 线程缓存的时钟
+ */
+struct CoarseClock {
+    /// 是否使用缓存
+    bool enabled = false;
+    /// 启动毫秒数
+    uint64_t elapsed_ms = 0;
+    /// 当前时间毫秒数
+    uint64_t wall_ms = 0;
+};
+
+static thread_local CoarseClock t_coarse_clock;
+
+uint64_t CoarseNowMS() {
+    return t_coarse_clock.enabled ? t_coarse_clock.elapsed_ms : GetElapsedMS();
+}
+
+uint64_t CoarseWallMS() {
+    return t_coarse_clock.enabled ? t_coarse_clock.wall_ms : GetCurrentMS();
+}
+
+uint64_t RefreshCoarseClock() {
+    t_coarse_clock.enabled    = true;
+    t_coarse_clock.elapsed_ms = GetElapsedMS();
+    t_coarse_clock.wall_ms    = GetCurrentMS();
+    return t_coarse_clock.elapsed_ms;
+}
+
+void DisableCoarseClock() {
+    t_coarse_clock.enabled = false;
+}
+
 std::string ToUpper(const std::string &name) {
     std::string rt = name;
     std::transform(rt.begin(), rt.end(), rt.begin(), ::toupper);
@@ -118,6 +161,44 @@ std::string ToLower(const std::string &name) {
     return rt;
 }
 
+/**
+ * 两位一组的十进制数字表
+ */
+static const char s_digits[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/**
+ * 每次除以100查表出两位
+ */
+void AppendUint(std::string &out, uint64_t v) {
+    char buf[20];
+    char *end = buf + sizeof(buf);
+    char *p   = end;
+    while (v >= 100) {
+        size_t i = (v % 100) * 2;
+        v /= 100;
+        *--p = s_digits[i + 1];
+        *--p = s_digits[i];
+    }
+    if (v >= 10) {
+        *--p = s_digits[v * 2 + 1];
+        *--p = s_digits[v * 2];
+    } else {
+        *--p = '0' + v;
+    }
+    out.append(p, end - p);
+}
+
+void AppendInt(std::string &out, int64_t v) {
+    if (v < 0) {
+        out.push_back('-');
+        AppendUint(out, -(uint64_t)v);
+    } else {
+        AppendUint(out, v);
+    }
+}
+
 std::string Time2Str(time_t ts, const std::string &format) {
     struct tm tm;
     localtime_r(&ts, &tm);
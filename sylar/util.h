@@ -37,8 +37,9 @@ uint64_t GetElapsedMS();
 
 /**
  * @brief 获取线程名称，参考pthread_getname_np(3)
+ * @details 第一次调用时从内核取一次，之后返回线程局部的缓存，每条日志都要用到，不能每次都做系统调用
  */
-std::string GetThreadName();
+const std::string &GetThreadName();
 
 /**
  * @brief 设置线程名称，参考pthread_setname_np(3)
@@ -72,6 +73,29 @@ uint64_t GetCurrentMS();
  */
 uint64_t GetCurrentUS();
 
+/**
+ * @brief 当前线程缓存的启动毫秒数，与GetElapsedMS是同一个单调时钟
+ * @details 调度线程在idle每轮循环时刷新(IOManager是每轮事件循环)，一直有任务不空闲时每执行64个任务刷新一次，
+ *          适合定时器、日志时间这类读得很频繁又不需要精确的地方；不在调度线程里时直接读真实时钟。需要精确时间用GetElapsedMS
+ */
+uint64_t CoarseNowMS();
+
+/**
+ * @brief 当前线程缓存的当前时间毫秒数，与CoarseNowMS同时刷新；需要精确时间用GetCurrentMS
+ */
+uint64_t CoarseWallMS();
+
+/**
+ * @brief 刷新当前线程缓存的时钟，第一次调用后当前线程开始使用缓存
+ * @return 刷新后的启动毫秒数
+ */
+uint64_t RefreshCoarseClock();
+
+/**
+ * @brief 当前线程停止使用缓存的时钟，之后CoarseNowMS/CoarseWallMS直接读真实时钟
+ */
+void DisableCoarseClock();
+
 /**
  * @brief 字符串转大写
  */
@@ -82,6 +106,16 @@ std::string ToUpper(const std::string &name);
  */
 std::string ToLower(const std::string &name);
 
+/**
+ * @brief 十进制追加无符号整数，不经过流和临时字符串
+ */
+void AppendUint(std::string &out, uint64_t v);
+
+/**
+ * @brief 十进制追加有符号整数
+ */
+void AppendInt(std::string &out, int64_t v);
+
 /**
  * @brief 日期时间转字符串
  */
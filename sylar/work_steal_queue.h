@@ -0,0 +1,112 @@
+/**
+ * @file work_steal_queue.h
+ * @brief 工作窃取队列
+ * @version 0.1
+ * @date 2021-06-15
+ */
+
+#ifndef __SYLAR_WORK_STEAL_QUEUE_H__
+#define __SYLAR_WORK_STEAL_QUEUE_H__
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 有界无锁的工作窃取队列
+ * @details 单生产者多消费者的环形队列：只有队列的所有者线程可以push，所有者和其他线程都可以从队头pop，
+ *          其他线程pop就是窃取。所有者也从队头取，保证先进先出，避免反复把自己加入调度的协程饿死队列里的其他任务。
+ *          队列满时push失败，由调用方把任务放到全局队列
+ * @tparam T 元素类型，必须可以放进std::atomic，一般是指针
+ */
+template <class T>
+class WorkStealQueue : Noncopyable {
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，向上取整到2的幂
+     */
+    explicit WorkStealQueue(uint32_t capacity) {
+        uint32_t cap = 1;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        m_mask = cap - 1;
+        m_buffer.reset(new std::atomic<T>[cap]);
+    }
+
+    /**
+     * @brief 入队，只允许所有者线程调用
+     * @return 队列满时返回false
+     */
+    bool push(T v) {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        if (tail - head > m_mask) {
+            return false;
+        }
+        m_buffer[tail & m_mask].store(v, std::memory_order_relaxed);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 从队头出队，任意线程都可以调用
+     * @return 队列为空时返回false
+     */
+    bool pop(T &v) {
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t tail = m_tail.load(std::memory_order_acquire);
+            if (head == tail) {
+                return false;
+            }
+            // 先读出元素再CAS，CAS失败说明元素已被别人取走，所有者可能已经覆盖了这个槽位，丢弃读到的值重试。
+            // 成功之前不能写v，否则最后返回false时调用方拿到的是别人取走的元素
+            T tmp = m_buffer[head & m_mask].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                v = tmp;
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief 当前元素个数，其他线程调用时只是一个近似值
+     */
+    uint32_t size() const {
+        uint32_t tail = m_tail.load(std::memory_order_acquire);
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    /**
+     * @brief 是否为空
+     */
+    bool empty() const { return size() == 0; }
+
+    /**
+     * @brief 容量
+     */
+    uint32_t capacity() const { return m_mask + 1; }
+
+private:
+    /// 队头，所有线程竞争
+    std::atomic<uint32_t> m_head = {0};
+    /// 与m_tail隔开，避免伪共享
+    char m_pad[64 - sizeof(std::atomic<uint32_t>)];
+    /// 队尾，只有所有者线程写
+    std::atomic<uint32_t> m_tail = {0};
+    /// 容量掩码
+    uint32_t m_mask = 0;
+    /// 环形缓冲区
+    std::unique_ptr<std::atomic<T>[]> m_buffer;
+};
+
+} // namespace sylar
+
+#endif
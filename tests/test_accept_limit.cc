@@ -0,0 +1,153 @@
+/**
+ * @file test_accept_limit.cc
+ * @brief TcpServer连接数上限和fd用尽处理测试
+ * @details 1. 设置最大连接数，连接数多于上限时服务器停止accept，客户端关闭一部分后继续接受
+ *          2. 把RLIMIT_NOFILE调到只够接受少量连接，其余连接应该被立即关闭，accept协程也不应该空转
+ * @version 0.1
+ * @date 2021-06-22
+ */
+
+#include "sylar/sylar.h"
+#include <sys/resource.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 一直读到对端关闭的服务器
+ */
+class HoldServer : public sylar::TcpServer {
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        char buf[64];
+        while (client->recv(buf, sizeof(buf)) > 0) {
+        }
+        client->close();
+    }
+};
+
+/**
+ * @brief 启动服务器，返回时已经开始accept
+ */
+static sylar::TcpServer::ptr start_server(sylar::IOManager &iom, sylar::Address::ptr addr, uint32_t max_conns) {
+    sylar::TcpServer::ptr server;
+    sylar::Semaphore started;
+    iom.schedule([&]() {
+        server.reset(new HoldServer);
+        server->setMaxConnections(max_conns);
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started.notify();
+    });
+    started.wait();
+    return server;
+}
+
+/**
+ * @brief 连接数上限，超出的连接留在backlog里，有连接关闭后继续接受
+ */
+void test_max_connections() {
+    sylar::IOManager server_iom(2, false, "server");
+    sylar::Address::ptr addr   = sylar::Address::LookupAnyIPAddress("127.0.0.1:8099");
+    sylar::TcpServer::ptr server = start_server(server_iom, addr, 4);
+
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        client_iom.schedule([server, addr]() {
+            std::vector<sylar::Socket::ptr> socks;
+            for (int i = 0; i < 10; ++i) {
+                sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+                SYLAR_ASSERT(sock->connect(addr));
+                socks.push_back(sock);
+            }
+            usleep(200 * 1000);
+            SYLAR_LOG_INFO(g_logger) << "10 clients connected, max_connections=4, server connections="
+                                     << server->getConnectionCount();
+
+            for (int i = 0; i < 3; ++i) {
+                socks[i]->close();
+            }
+            usleep(200 * 1000);
+            SYLAR_LOG_INFO(g_logger) << "3 clients closed, server connections=" << server->getConnectionCount();
+
+            for (auto &i : socks) {
+                i->close();
+            }
+            usleep(500 * 1000);
+            SYLAR_LOG_INFO(g_logger) << "all clients closed, server connections=" << server->getConnectionCount();
+        });
+    }
+    server->stop();
+}
+
+/**
+ * @brief fd用尽时连接被立即关闭，accept协程不空转
+ */
+void test_emfile() {
+    sylar::IOManager server_iom(1, false, "server");
+    sylar::Address::ptr addr   = sylar::Address::LookupAnyIPAddress("127.0.0.1:8100");
+    sylar::TcpServer::ptr server = start_server(server_iom, addr, 0);
+
+    struct rlimit old_limit;
+    getrlimit(RLIMIT_NOFILE, &old_limit);
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        client_iom.schedule([server, addr, old_limit]() {
+            // 先创建好客户端的fd，再把上限调到只够服务器接受2个连接
+            const int count = 20;
+            std::vector<sylar::Socket::ptr> socks;
+            int max_fd = 0;
+            for (int i = 0; i < count; ++i) {
+                sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+                socks.push_back(sock);
+            }
+            for (auto &i : socks) {
+                SYLAR_ASSERT(i->connect(addr));
+                max_fd = std::max(max_fd, i->getSocket());
+            }
+            // connect之前socket还没有创建，这里才知道最大的fd，连接已经在backlog里了
+            struct rlimit limit = old_limit;
+            limit.rlim_cur      = max_fd + 3;
+            setrlimit(RLIMIT_NOFILE, &limit);
+
+            struct rusage begin_usage, end_usage;
+            getrusage(RUSAGE_SELF, &begin_usage);
+            usleep(1000 * 1000);
+            getrusage(RUSAGE_SELF, &end_usage);
+            uint64_t cpu_us = (end_usage.ru_utime.tv_sec - begin_usage.ru_utime.tv_sec) * 1000000 +
+                              (end_usage.ru_utime.tv_usec - begin_usage.ru_utime.tv_usec) +
+                              (end_usage.ru_stime.tv_sec - begin_usage.ru_stime.tv_sec) * 1000000 +
+                              (end_usage.ru_stime.tv_usec - begin_usage.ru_stime.tv_usec);
+
+            int closed = 0;
+            for (auto &i : socks) {
+                i->setRecvTimeout(100);
+                char c;
+                if (i->recv(&c, 1) == 0) {
+                    ++closed;
+                }
+            }
+            SYLAR_LOG_INFO(g_logger) << "fds exhausted: clients=" << count << " server connections="
+                                     << server->getConnectionCount() << " shed=" << server->getShedCount()
+                                     << " closed by server=" << closed << " cpu used in 1s=" << cpu_us << "us";
+
+            setrlimit(RLIMIT_NOFILE, &old_limit);
+            for (auto &i : socks) {
+                i->close();
+            }
+            usleep(200 * 1000);
+        });
+    }
+    server->stop();
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    test_max_connections();
+    test_emfile();
+    return 0;
+}
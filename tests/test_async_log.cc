@@ -0,0 +1,159 @@
+/**
+ * @file test_async_log.cc
+ * @brief 异步文件日志测试
+ * @details 日志写到一个FIFO里，读端模拟磁盘，隔一段时间停顿一下不读。多个线程一边写日志一边统计每次调用的耗时，
+ *          比较FileLogAppender和AsyncFileLogAppender的延迟分布，同时检查读到的日志条数和丢弃计数
+ * @version 0.1
+ * @date 2021-06-26
+ */
+
+#include "sylar/sylar.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// FIFO路径
+static const char *FIFO_PATH = "/tmp/sylar_test_async_log.fifo";
+/// 写日志的线程数
+static const int THREADS = 4;
+/// 每个线程写的日志条数
+static const int RECORDS = 20000;
+/// 模拟磁盘每隔多少毫秒停顿一次
+static const uint64_t STALL_EVERY_MS = 500;
+/// 模拟磁盘每次停顿多少毫秒
+static const uint64_t STALL_MS = 100;
+
+/**
+ * @brief 模拟慢磁盘的读端，统计读到的行数
+ */
+class SlowDisk {
+public:
+    SlowDisk() {
+        // O_RDWR打开，写端关闭重开时读端不会读到EOF，写端打开也不会阻塞
+        m_fd = open(FIFO_PATH, O_RDWR | O_NONBLOCK);
+        SYLAR_ASSERT(m_fd >= 0);
+        m_thread.reset(new sylar::Thread(std::bind(&SlowDisk::run, this), "slow_disk"));
+    }
+
+    /**
+     * @brief 读完管道里剩下的数据后退出，返回读到的行数
+     */
+    uint64_t stop() {
+        m_stopping = true;
+        m_thread->join();
+        close(m_fd);
+        return m_lines;
+    }
+
+private:
+    void run() {
+        std::vector<char> buf(65536);
+        uint64_t last_stall = sylar::GetCurrentMS();
+        while (true) {
+            if (sylar::GetCurrentMS() >= last_stall + STALL_EVERY_MS) {
+                usleep(STALL_MS * 1000);
+                last_stall = sylar::GetCurrentMS();
+            }
+            ssize_t rt = read(m_fd, &buf[0], buf.size());
+            if (rt > 0) {
+                m_lines += std::count(buf.begin(), buf.begin() + rt, '\n');
+                usleep(1000);
+                continue;
+            }
+            if (m_stopping) {
+                break;
+            }
+            struct pollfd pfd;
+            pfd.fd     = m_fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 10);
+        }
+    }
+
+private:
+    int m_fd = -1;
+    std::atomic<bool> m_stopping{false};
+    uint64_t m_lines = 0;
+    sylar::Thread::ptr m_thread;
+};
+
+/**
+ * @brief THREADS个线程各写RECORDS条日志，输出单次调用耗时的分位数
+ */
+void bench(const std::string &name, std::function<sylar::LogAppender::ptr()> create) {
+    // 先打开读端，写端打开FIFO时才不会阻塞
+    SlowDisk disk;
+    sylar::LogAppender::ptr appender = create();
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%d%T%t%T%m%n")));
+    sylar::Logger::ptr logger(new sylar::Logger("bench"));
+    logger->addAppender(appender);
+
+    std::vector<std::vector<uint32_t> > costs(THREADS);
+    std::vector<sylar::Thread::ptr> workers;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int t = 0; t < THREADS; ++t) {
+        workers.push_back(std::make_shared<sylar::Thread>([logger, &costs, t]() {
+            std::vector<uint32_t> &cost = costs[t];
+            cost.reserve(RECORDS);
+            for (int i = 0; i < RECORDS; ++i) {
+                uint64_t start = sylar::GetCurrentUS();
+                SYLAR_LOG_INFO(logger) << "request " << i << " handled by worker " << t;
+                cost.push_back(sylar::GetCurrentUS() - start);
+                usleep(20);
+            }
+        }, "worker_" + std::to_string(t)));
+    }
+    for (auto &i : workers) {
+        i->join();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    uint64_t dropped = 0;
+    auto async = std::dynamic_pointer_cast<sylar::AsyncFileLogAppender>(appender);
+    if (async) {
+        async->flush();
+        dropped = async->getDropped();
+    }
+    // 释放Appender，同步的关闭文件流，异步的写完缓冲区并停掉后台线程
+    logger.reset();
+    appender.reset();
+    async.reset();
+    uint64_t lines = disk.stop();
+
+    std::vector<uint32_t> all;
+    for (auto &i : costs) {
+        all.insert(all.end(), i.begin(), i.end());
+    }
+    std::sort(all.begin(), all.end());
+    SYLAR_LOG_INFO(g_logger) << name << ": records=" << all.size() << " used=" << used / 1000 << "ms"
+                             << " p50=" << all[all.size() / 2] << "us p99=" << all[all.size() * 99 / 100]
+                             << "us p999=" << all[all.size() * 999 / 1000] << "us max=" << all.back()
+                             << "us lines read=" << lines << " dropped=" << dropped;
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    unlink(FIFO_PATH);
+    SYLAR_ASSERT(mkfifo(FIFO_PATH, 0644) == 0);
+
+    bench("FileLogAppender", []() {
+        return std::make_shared<sylar::FileLogAppender>(FIFO_PATH);
+    });
+    bench("AsyncFileLogAppender block", []() {
+        return std::make_shared<sylar::AsyncFileLogAppender>(FIFO_PATH, sylar::AsyncFileLogAppender::BLOCK);
+    });
+    // 缓冲区很小，停顿期间放不下，丢弃的条数会写进文件
+    bench("AsyncFileLogAppender count 16KB", []() {
+        return std::make_shared<sylar::AsyncFileLogAppender>(FIFO_PATH, sylar::AsyncFileLogAppender::COUNT, 16384);
+    });
+
+    unlink(FIFO_PATH);
+    return 0;
+}
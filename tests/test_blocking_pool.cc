@@ -0,0 +1,103 @@
+/**
+ * @file test_blocking_pool.cc
+ * @brief 阻塞调用线程池测试
+ * @version 0.1
+ * @date 2021-06-21
+ */
+
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 一个协程执行500ms的阻塞调用，同一个调度线程上的定时器协程应该照常每20ms执行一次
+ */
+void test_no_stall() {
+    sylar::IOManager iom(1, false, "no_stall");
+    std::atomic<int> ticks{0};
+    std::atomic<bool> done{false};
+    sylar::Timer::ptr timer = iom.addTimer(20, [&]() {
+        ++ticks;
+    }, true);
+    iom.schedule([&]() {
+        int thread    = sylar::GetThreadId();
+        uint64_t begin = sylar::GetCurrentMS();
+        sylar::BlockingPool::GetInstance()->run([]() {
+            usleep_f(500 * 1000);
+        });
+        SYLAR_LOG_INFO(g_logger) << "blocking call used " << sylar::GetCurrentMS() - begin
+                                 << "ms, ticks meanwhile=" << ticks << ", same thread="
+                                 << (thread == sylar::GetThreadId());
+        timer->cancel();
+        done = true;
+    });
+}
+
+/**
+ * @brief hook的open/read/stat/getaddrinfo走线程池，errno能带回来
+ */
+void test_hooked_calls() {
+    sylar::IOManager iom(2, false, "hooked");
+    iom.schedule([]() {
+        const char *path = "/tmp/sylar_test_blocking_pool";
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        const char data[] = "hello blocking pool";
+        ssize_t n = write(fd, data, sizeof(data));
+        char buf[64] = {0};
+        ssize_t m = pread(fd, buf, sizeof(buf), 0);
+        struct stat st;
+        int rt = stat(path, &st);
+        SYLAR_LOG_INFO(g_logger) << "open fd=" << fd << " write=" << n << " pread=" << m << " data=" << buf
+                                 << " stat rt=" << rt << " size=" << st.st_size;
+        close(fd);
+        unlink(path);
+
+        // O_TMPFILE要带mode参数，只有O_DIRECTORY时不带
+        fd = open("/tmp", O_TMPFILE | O_RDWR, 0600);
+        rt = fstat(fd, &st);
+        SYLAR_LOG_INFO(g_logger) << "open O_TMPFILE fd=" << fd << " mode=" << std::oct << (st.st_mode & 0777)
+                                 << std::dec;
+        close(fd);
+
+        fd = open("/nonexistent/sylar", O_RDONLY);
+        SYLAR_LOG_INFO(g_logger) << "open nonexistent fd=" << fd << " errno=" << errno << "(" << strerror(errno) << ")";
+
+        sylar::Address::ptr addr = sylar::Address::LookupAny("localhost:80");
+        SYLAR_LOG_INFO(g_logger) << "lookup localhost: " << (addr ? addr->toString() : "failed");
+    });
+}
+
+/**
+ * @brief 很多协程同时提交，观察排队深度
+ */
+void test_queue_depth() {
+    sylar::BlockingPool *pool = sylar::BlockingPool::GetInstance();
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(2, false, "depth");
+        for (int i = 0; i < 64; ++i) {
+            iom.schedule([]() {
+                sylar::BlockingPool::GetInstance()->run([]() {
+                    usleep_f(10 * 1000);
+                });
+            });
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "64 calls of 10ms on " << pool->getThreadCount() << " threads used "
+                             << sylar::GetCurrentMS() - begin << "ms, submit=" << pool->getSubmitCount()
+                             << " complete=" << pool->getCompleteCount() << " queue=" << pool->getQueueDepth()
+                             << " max queue=" << pool->getMaxQueueDepth() << " busy=" << pool->getBusyCount();
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    test_no_stall();
+    test_hooked_calls();
+    test_queue_depth();
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file test_fd_manager.cc
+ * @brief FdManager查找性能测试
+ * @details 打开大量hook过的socket，统计多个调度线程上hook的read每秒调用次数，
+ *          再把FdMgr的无锁查找和原来的读写锁加std::vector<shared_ptr>的查找对比
+ * @version 0.1
+ * @date 2021-06-21
+ */
+
+#include "sylar/sylar.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// 希望打开的fd数，受RLIMIT_NOFILE限制
+static const size_t WANT_FDS = 100000;
+/// 每个线程的调用次数
+static const size_t CALLS = 1000000;
+
+/**
+ * @brief 原来的FdManager查找方式，用来对比
+ */
+class LegacyTable {
+public:
+    typedef sylar::RWMutex RWMutexType;
+
+    LegacyTable() { m_datas.resize(64); }
+
+    sylar::FdCtx::ptr get(int fd) {
+        RWMutexType::ReadLock lock(m_mutex);
+        if ((int)m_datas.size() <= fd) {
+            return nullptr;
+        }
+        return m_datas[fd];
+    }
+
+    void set(int fd, sylar::FdCtx::ptr ctx) {
+        RWMutexType::WriteLock lock(m_mutex);
+        if (fd >= (int)m_datas.size()) {
+            m_datas.resize(fd * 1.5);
+        }
+        m_datas[fd] = ctx;
+    }
+
+private:
+    RWMutexType m_mutex;
+    std::vector<sylar::FdCtx::ptr> m_datas;
+};
+
+/**
+ * @brief 尽量调高RLIMIT_NOFILE，返回可以打开的socket数
+ */
+static size_t raise_nofile() {
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rlim_t want = WANT_FDS + 256;
+    if (rl.rlim_cur < want) {
+        rl.rlim_cur = rl.rlim_max == RLIM_INFINITY ? want : std::min(want, rl.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return std::min((size_t)WANT_FDS, (size_t)rl.rlim_cur - 256);
+}
+
+/**
+ * @brief 在threads个调度线程上对打开的socket轮流调用hook的read
+ */
+void bench_hooked_read(const std::vector<int> &fds, size_t threads) {
+    std::atomic<uint64_t> calls{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(threads, false, "read");
+        for (size_t t = 0; t < threads; ++t) {
+            iom.schedule([&fds, &calls, t]() {
+                char c;
+                size_t index = t * 7919;
+                for (size_t i = 0; i < CALLS; ++i) {
+                    index = (index + 7919) % fds.size();
+                    read(fds[index], &c, 1);
+                }
+                calls += CALLS;
+            });
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "hooked read: fds=" << fds.size() << " threads=" << threads
+                             << " calls=" << calls << " used=" << used / 1000 << "ms "
+                             << (uint64_t)(calls * 1000000.0 / used) << " calls/s";
+}
+
+/**
+ * @brief 只测查找本身，FdMgr和原来的实现各跑一遍
+ */
+void bench_lookup(const std::vector<int> &fds, size_t threads) {
+    LegacyTable legacy;
+    for (auto fd : fds) {
+        legacy.set(fd, sylar::FdMgr::GetInstance()->get(fd));
+    }
+
+    auto run = [&fds, threads](const char *name, std::function<bool(int)> lookup) {
+        std::vector<sylar::Thread::ptr> workers;
+        std::atomic<uint64_t> found{0};
+        uint64_t begin = sylar::GetCurrentUS();
+        for (size_t t = 0; t < threads; ++t) {
+            workers.push_back(std::make_shared<sylar::Thread>([&fds, &found, &lookup, t]() {
+                uint64_t n   = 0;
+                size_t index = t * 7919;
+                for (size_t i = 0; i < CALLS; ++i) {
+                    index = (index + 7919) % fds.size();
+                    n += lookup(fds[index]);
+                }
+                found += n;
+            }, "lookup_" + std::to_string(t)));
+        }
+        for (auto &i : workers) {
+            i->join();
+        }
+        uint64_t used = sylar::GetCurrentUS() - begin;
+        SYLAR_LOG_INFO(g_logger) << name << " lookup: threads=" << threads << " found=" << found
+                                 << " used=" << used / 1000 << "ms "
+                                 << (uint64_t)(threads * CALLS * 1000000.0 / used) << " lookups/s";
+    };
+
+    run("legacy", [&legacy](int fd) {
+        sylar::FdCtx::ptr ctx = legacy.get(fd);
+        return ctx && ctx->isSocket();
+    });
+    run("fd_table", [](int fd) {
+        sylar::FdCtx *ctx = sylar::FdMgr::GetInstance()->lookup(fd);
+        return ctx && ctx->isSocket();
+    });
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    size_t count = raise_nofile();
+    std::vector<int> fds;
+    {
+        // 在调度线程里创建，走hook的socket注册FdCtx
+        sylar::IOManager iom(1, false, "open");
+        iom.schedule([&fds, count]() {
+            for (size_t i = 0; i < count; ++i) {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                if (fd < 0) {
+                    SYLAR_LOG_WARN(g_logger) << "socket failed after " << i << " fds errno=" << errno;
+                    break;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                fds.push_back(fd);
+            }
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "opened " << fds.size() << " sockets, wanted " << WANT_FDS;
+
+    bench_hooked_read(fds, 1);
+    bench_hooked_read(fds, 4);
+    bench_lookup(fds, 1);
+    bench_lookup(fds, 4);
+
+    for (auto fd : fds) {
+        close(fd);
+    }
+    return 0;
+}
@@ -59,9 +59,91 @@ void test_fiber() {
     fiber->resume();
 
     SYLAR_LOG_INFO(g_logger) << "use_count:" << fiber.use_count(); // 1
+
+    // 反复创建销毁协程，除第一次外，栈都应该从当前线程的栈池中取到
+    for (int i = 0; i < 10; i++) {
+        sylar::Fiber::ptr f(new sylar::Fiber(run_in_fiber2, 0, false));
+        f->resume();
+    }
     SYLAR_LOG_INFO(g_logger) << "test_fiber end";
 }
 
+/**
+ * @brief 上下文切换基准测试，直接使用FiberContext，不经过Fiber的状态管理
+ */
+template <class Context>
+struct SwitchBench {
+    static Context s_main;
+    static Context s_ctx;
+
+    static void Loop() {
+        while (true) {
+            Context::Swap(&s_ctx, &s_main);
+        }
+    }
+
+    static void Run(uint64_t rounds) {
+        size_t stacksize = 128 * 1024;
+        void *stack      = sylar::StackAllocator::Alloc(stacksize);
+        s_ctx.make(stack, stacksize, &Loop);
+
+        uint64_t begin = sylar::GetCurrentUS();
+        for (uint64_t i = 0; i < rounds; i++) {
+            Context::Swap(&s_main, &s_ctx);
+        }
+        uint64_t used = sylar::GetCurrentUS() - begin;
+        sylar::StackAllocator::Dealloc(stack, stacksize);
+
+        // 每一轮切进去再切回来，算两次切换
+        SYLAR_LOG_INFO(g_logger) << Context::Name() << " context: " << rounds * 2 << " switches in "
+                                 << used << "us, " << (used ? rounds * 2 * 1000000 / used : 0)
+                                 << " switches/s";
+    }
+};
+
+template <class Context>
+Context SwitchBench<Context>::s_main;
+template <class Context>
+Context SwitchBench<Context>::s_ctx;
+
+void bench_fiber_switch(uint64_t rounds) {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() {
+        while (true) {
+            sylar::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < rounds; i++) {
+        fiber->resume();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "Fiber resume/yield (" << sylar::FiberContext::Name() << "): "
+                             << rounds * 2 << " switches in " << used << "us, "
+                             << (used ? rounds * 2 * 1000000 / used : 0) << " switches/s";
+    // 协程没有结束，析构时会断言失败，这里故意泄漏
+    new sylar::Fiber::ptr(fiber);
+}
+
+/**
+ * @brief 默认尺寸的协程中间夹着自定义尺寸的协程，缓存的默认尺寸栈不应该被清空
+ */
+void test_stack_pool_mixed_sizes() {
+    sylar::Fiber::GetThis();
+    const uint64_t rounds = 100;
+    uint64_t hit          = sylar::StackAllocator::GetHitCount();
+    for (uint64_t i = 0; i < rounds; i++) {
+        sylar::Fiber::ptr fiber(new sylar::Fiber([]() {}, 0, false));
+        fiber->resume();
+        sylar::Fiber::ptr big(new sylar::Fiber([]() {}, 1024 * 1024, false));
+        big->resume();
+    }
+    hit = sylar::StackAllocator::GetHitCount() - hit;
+    SYLAR_LOG_INFO(g_logger) << "mixed stack sizes: " << hit << " hits in " << rounds << " default size fibers";
+    SYLAR_ASSERT(hit >= rounds - 1);
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
@@ -79,6 +161,17 @@ int main(int argc, char *argv[]) {
         i->join();
     }
 
+    test_stack_pool_mixed_sizes();
+
+    const uint64_t rounds = 1000000;
+    SwitchBench<sylar::UContext>::Run(rounds);
+#ifdef SYLAR_HAS_ASM_CONTEXT
+    SwitchBench<sylar::AsmContext>::Run(rounds);
+#endif
+    bench_fiber_switch(rounds);
+
+    SYLAR_LOG_INFO(g_logger) << "stack pool hit: " << sylar::StackAllocator::GetHitCount()
+                             << ", miss: " << sylar::StackAllocator::GetMissCount();
     SYLAR_LOG_INFO(g_logger) << "main end";
     return 0;
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include "sylar/streams/socket_stream.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -80,6 +81,81 @@ void test_sock() {
     SYLAR_LOG_INFO(g_logger) << buff;
 }
 
+/**
+ * 测试sendfile/splice/pread hook，服务端用SocketStream::sendFile发送一个比socket缓冲区大得多的文件，
+ * 客户端用splice经过管道收到另一个文件里，最后用pread比较两个文件
+ */
+void test_sendfile() {
+    const size_t size = 16 * 1024 * 1024;
+    const char *src_path = "/tmp/sylar_test_sendfile.src";
+    const char *dst_path = "/tmp/sylar_test_sendfile.dst";
+    int src = open(src_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    std::string block(4096, 0);
+    for (size_t i = 0; i < size; i += block.size()) {
+        for (size_t j = 0; j < block.size(); ++j) {
+            block[j] = (char)((i + j) * 131);
+        }
+        pwrite(src, block.data(), block.size(), i);
+    }
+
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8098");
+    sylar::Socket::ptr listener = sylar::Socket::CreateTCP(addr);
+    if (!listener->bind(addr) || !listener->listen()) {
+        close(src);
+        return;
+    }
+    sylar::IOManager::GetThis()->schedule([addr, size, dst_path]() {
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+        if (!sock->connect(addr)) {
+            return;
+        }
+        int dst = open(dst_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        int pipes[2];
+        pipe(pipes);
+        loff_t off = 0;
+        while (off < (loff_t)size) {
+            ssize_t n = splice(sock->getSocket(), nullptr, pipes[1], nullptr, 65536, SPLICE_F_MOVE);
+            if (n <= 0) {
+                SYLAR_LOG_ERROR(g_logger) << "splice from socket rt=" << n << " errno=" << errno;
+                break;
+            }
+            while (n > 0) {
+                ssize_t m = splice(pipes[0], nullptr, dst, &off, n, SPLICE_F_MOVE);
+                if (m <= 0) {
+                    break;
+                }
+                n -= m;
+            }
+        }
+        SYLAR_LOG_INFO(g_logger) << "splice received " << off << " bytes";
+        close(pipes[0]);
+        close(pipes[1]);
+        close(dst);
+    });
+
+    sylar::Socket::ptr client = listener->accept();
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::SocketStream stream(client);
+    int64_t rt = stream.sendFile(src, 0, size);
+    SYLAR_LOG_INFO(g_logger) << "sendFile rt=" << rt << " used=" << sylar::GetCurrentMS() - begin << "ms";
+    stream.close();
+    // 等客户端写完
+    sleep(1);
+
+    int dst = open(dst_path, O_RDONLY);
+    std::string a(block.size(), 0), b(block.size(), 0);
+    bool same = true;
+    for (size_t i = 0; same && i < size; i += block.size()) {
+        same = pread(src, &a[0], a.size(), i) == (ssize_t)a.size()
+               && pread(dst, &b[0], b.size(), i) == (ssize_t)b.size() && a == b;
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_sendfile " << (same ? "ok" : "mismatch");
+    close(dst);
+    close(src);
+    unlink(src_path);
+    unlink(dst_path);
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
@@ -89,6 +165,7 @@ int main(int argc, char *argv[]) {
     // 只有以协程调度的方式运行hook才能生效
     sylar::IOManager iom;
     iom.schedule(test_sock);
+    iom.schedule(test_sendfile);
 
     SYLAR_LOG_INFO(g_logger) << "main end";
     return 0;
@@ -1,11 +1,34 @@
 /**
  * @file test_http_parser.cc
  * @brief 测试HTTP协议解析
+ * @details 零拷贝解析分别整块和逐字节喂入，结果应该和拷贝解析一致；
+ *          替换全局operator new，统计两种模式下解析一个请求的分配次数
  * @version 0.1
  * @date 2021-09-25
  */
 #include "sylar/sylar.h"
 
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size) {
+    ++s_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
 const char test_request_data[] = "POST /login?aa=bb#sss HTTP/1.1\r\n"
                                  "Host: www.sylar.top\r\n"
                                  "Content-Length: 10\r\n\r\n"
@@ -19,6 +42,18 @@ const char test_request_chunked_data[] = "POST /two_chunks_mult_zero_end HTTP/1.
                                          "000\r\n"
                                          "\r\n";
 
+/// 浏览器发出的典型请求
+const char test_browser_request_data[] = "GET /api/v1/users/12345/profile?fields=name,avatar&lang=zh-CN HTTP/1.1\r\n"
+                                         "Host: www.sylar.top\r\n"
+                                         "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+                                         "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                                         "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                                         "Accept-Encoding: gzip, deflate, br\r\n"
+                                         "Cookie: session_id=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+                                         "Referer: https://www.sylar.top/index.html\r\n"
+                                         "Connection: keep-alive\r\n"
+                                         "\r\n";
+
 const char test_response_data[] = "HTTP/1.1 301 Moved Permanently\r\n"
                                   "Location: http://www.google.com/\r\n"
                                   "Content-Type: text/html; charset=UTF-8\r\n"
@@ -64,6 +99,72 @@ void test_response(const char *str) {
     }
 }
 
+/**
+ * @brief 零拷贝解析，step为每次喂给解析器的字节数，数据始终在同一块内存里
+ */
+sylar::http::HttpRequest::ptr parse_zero_copy(std::string &data, size_t step) {
+    sylar::http::HttpRequestParser parser(true);
+    size_t offset = 0;
+    while (offset < data.size() && !parser.isFinished() && !parser.hasError()) {
+        size_t len = std::min(step, data.size() - offset);
+        offset += parser.execute(&data[offset], len);
+    }
+    if (parser.hasError() || !parser.isFinished()) {
+        return nullptr;
+    }
+    return parser.getData();
+}
+
+/**
+ * @brief 零拷贝解析的结果要和拷贝解析一致
+ */
+void test_zero_copy(const char *str) {
+    std::string copy = str;
+    sylar::http::HttpRequestParser parser;
+    parser.execute(&copy[0], copy.size());
+    SYLAR_ASSERT(!parser.hasError());
+    std::string expect = parser.getData()->toString();
+
+    for (size_t step : {(size_t)1, (size_t)7, strlen(str)}) {
+        std::string data                = str;
+        sylar::http::HttpRequest::ptr req = parse_zero_copy(data, step);
+        SYLAR_ASSERT(req);
+        SYLAR_ASSERT(req->hasViews());
+        bool same = req->getHeaderView("HOST") == req->getHeader("host") &&
+                    req->getPathView() == sylar::http::StringView(req->getPath()) &&
+                    req->toString() == expect;
+        SYLAR_LOG_INFO(g_logger) << "zero copy step=" << step << " path=" << req->getPath()
+                                 << " same as copy parser=" << same;
+        SYLAR_ASSERT(same);
+    }
+}
+
+/**
+ * @brief 统计解析一个请求的分配次数，访问path和两个头部，和servlet的常见用法一样
+ */
+void bench_allocs(const char *str, bool zero_copy) {
+    const int count = 100000;
+    std::string data = str;
+    std::string buf  = data;
+    uint64_t allocs  = s_allocs;
+    uint64_t begin   = sylar::GetCurrentUS();
+    for (int i = 0; i < count; ++i) {
+        memcpy(&buf[0], data.c_str(), data.size());
+        sylar::http::HttpRequestParser parser(zero_copy);
+        parser.execute(&buf[0], buf.size());
+        sylar::http::HttpRequest::ptr req = parser.getData();
+        req->init();
+        if (req->getPathView().empty() || req->getHeaderView("host").empty() ||
+            req->getHeaderView("user-agent").empty()) {
+            SYLAR_LOG_ERROR(g_logger) << "parse failed";
+            return;
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << (zero_copy ? "zero copy" : "copy") << " parse: allocs per request="
+                             << (double)(s_allocs - allocs) / count << " " << used * 1000 / count << "ns per request";
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
@@ -73,5 +174,13 @@ int main(int argc, char *argv[]) {
 
     test_response(test_response_data);
 
+    test_zero_copy(test_request_data);
+    test_zero_copy(test_request_chunked_data);
+    test_zero_copy(test_browser_request_data);
+
+    SYLAR_LOG_NAME("http")->setLevel(sylar::LogLevel::WARN);
+    bench_allocs(test_browser_request_data, false);
+    bench_allocs(test_browser_request_data, true);
+
     return 0;
 }
\ No newline at end of file
@@ -1,107 +1,258 @@
-#include <sys/epoll.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <cstring>
-#include <iostream>
-#include <vector>
-
-#define PORT 8020
-#define MAX_EVENTS 1024
-
-const char* http_response =
-    "HTTP/1.1 200 OK\r\n"
-    "Content-Length: 12\r\n"
-    "Connection: close\r\n"
-    "\r\n"
-    "Hello World\n";
-
-int set_non_blocking(int fd) {
-    int old = fcntl(fd, F_GETFL);
-    return fcntl(fd, F_SETFL, old | O_NONBLOCK);
+/**
+ * @file test_http_server.cc
+ * @brief HttpServer流水线请求测试
+ * @details 1. 一次写入多个请求，检查响应的数量和顺序
+ *          2. 头部和消息体都超过读缓存大小的请求，分多次写入；流水线上夹着大消息体的响应
+ *          3. 多条连接上按不同的流水线深度发请求，比较吞吐量
+ * @version 0.1
+ * @date 2021-06-23
+ */
+
+#include "sylar/sylar.h"
+#include "sylar/http/http_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_requests{0};
+static std::atomic<uint64_t> s_errors{0};
+
+/**
+ * @brief 请求序号，固定4位，这样每个响应一样长
+ */
+static std::string seq(int i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%04d", i);
+    return buf;
+}
+
+/**
+ * @brief 拼出depth个GET请求，query依次为0到depth-1
+ */
+static std::string make_requests(int depth) {
+    std::string data;
+    for (int i = 0; i < depth; ++i) {
+        data += "GET /echo?" + seq(i) + " HTTP/1.1\r\nhost: 127.0.0.1\r\nconnection: keep-alive\r\n\r\n";
+    }
+    return data;
+}
+
+/**
+ * @brief 读到length字节为止
+ */
+static bool read_all(sylar::Socket::ptr sock, std::string &buf, size_t length) {
+    buf.resize(length);
+    size_t offset = 0;
+    while (offset < length) {
+        int rt = sock->recv(&buf[offset], length - offset);
+        if (rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+/**
+ * @brief 一次写入多个请求，响应应该按顺序全部返回
+ */
+void test_pipeline(sylar::Address::ptr addr) {
+    const int depth         = 8;
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    std::string data = make_requests(depth);
+    SYLAR_ASSERT(sock->send(data.c_str(), data.size()) == (int)data.size());
+
+    // 响应的body就是请求的query，一直读到最后一个响应的body出现
+    std::string rsp;
+    std::string last = "\r\n\r\n" + seq(depth - 1);
+    char buf[4096];
+    while (rsp.find(last) == std::string::npos) {
+        int rt = sock->recv(buf, sizeof(buf));
+        if (rt <= 0) {
+            SYLAR_LOG_ERROR(g_logger) << "pipeline: connection closed, got " << rsp.size() << " bytes";
+            return;
+        }
+        rsp.append(buf, rt);
+    }
+    size_t pos   = 0;
+    int in_order = 0;
+    for (int i = 0; i < depth; ++i) {
+        pos = rsp.find("\r\n\r\n" + seq(i), pos);
+        if (pos == std::string::npos) {
+            break;
+        }
+        ++in_order;
+    }
+    SYLAR_LOG_INFO(g_logger) << "pipeline: sent " << depth << " requests in one write, got " << in_order
+                             << " responses in order, " << rsp.size() << " bytes";
 }
 
-int create_listen_socket() {
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) {
-        perror("socket");
-        exit(1);
+/**
+ * @brief 头部和消息体都比读缓存大，零拷贝模式下读缓存要扩大、请求要拷贝出来
+ */
+void test_large_request(sylar::Address::ptr addr) {
+    std::string header(10000, 'h');
+    std::string body(100000, 'b');
+    std::string data = "POST /size HTTP/1.1\r\nhost: 127.0.0.1\r\nconnection: keep-alive\r\nx-large: " + header +
+                       "\r\ncontent-length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    // 后面紧跟一个流水线请求，确认缓存复用后还能正常解析
+    data += make_requests(1);
+
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    for (size_t offset = 0; offset < data.size(); offset += 1000) {
+        size_t len = std::min((size_t)1000, data.size() - offset);
+        SYLAR_ASSERT(sock->send(&data[offset], len) == (int)len);
     }
+    std::string rsp;
+    std::string expect = std::to_string(header.size()) + "," + std::to_string(body.size());
+    std::string last   = "\r\n\r\n" + seq(0);
+    char buf[4096];
+    while (rsp.find(last) == std::string::npos) {
+        int rt = sock->recv(buf, sizeof(buf));
+        if (rt <= 0) {
+            break;
+        }
+        rsp.append(buf, rt);
+    }
+    SYLAR_LOG_INFO(g_logger) << "large request: header=" << header.size() << " body=" << body.size()
+                             << " size ok=" << (rsp.find("\r\n\r\n" + expect) != std::string::npos)
+                             << " next request ok=" << (rsp.find(last) != std::string::npos);
+}
 
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+/**
+ * @brief 两个小响应中间夹一个不拷贝的大消息体，三个响应一起writev出去，顺序和内容都要对
+ */
+void test_large_response(sylar::Address::ptr addr) {
+    std::string data = make_requests(1) + "GET /large HTTP/1.1\r\nhost: 127.0.0.1\r\nconnection: keep-alive\r\n\r\n" +
+                       make_requests(2).substr(make_requests(1).size());
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    SYLAR_ASSERT(sock->send(data.c_str(), data.size()) == (int)data.size());
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(PORT);
-    addr.sin_addr.s_addr = INADDR_ANY;
+    std::string rsp;
+    std::string last = "\r\n\r\n" + seq(1);
+    char buf[4096];
+    while (rsp.find(last) == std::string::npos) {
+        int rt = sock->recv(buf, sizeof(buf));
+        if (rt <= 0) {
+            break;
+        }
+        rsp.append(buf, rt);
+    }
+    size_t first = rsp.find("\r\n\r\n" + seq(0));
+    size_t large = rsp.find("\r\n\r\n" + std::string(200000, 'l'));
+    size_t next  = rsp.find(last);
+    SYLAR_LOG_INFO(g_logger) << "large response: " << rsp.size() << " bytes, in order="
+                             << (first < large && large != std::string::npos && large < next &&
+                                 next != std::string::npos);
+}
 
-    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        exit(1);
+/**
+ * @brief 一条连接上每批发送depth个请求，读完depth个响应再发下一批
+ * @param[in] rsp_size 单个响应的长度，响应都一样长
+ */
+void client(sylar::Address::ptr addr, int depth, int batches, size_t rsp_size) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    if (!sock->connect(addr)) {
+        ++s_errors;
+        return;
     }
+    std::string data = make_requests(depth);
+    std::string rsp;
+    for (int i = 0; i < batches; ++i) {
+        if (sock->send(data.c_str(), data.size()) != (int)data.size() ||
+            !read_all(sock, rsp, rsp_size * depth)) {
+            ++s_errors;
+            return;
+        }
+        s_requests += depth;
+    }
+}
 
-    if (listen(listen_fd, 128) < 0) {
-        perror("listen");
-        exit(1);
+/**
+ * @brief 流水线压测
+ */
+void bench(sylar::Address::ptr addr, int conns, int depth, int requests) {
+    s_requests = 0;
+    s_errors   = 0;
+
+    // 每个响应长度相同，先取一个看多长
+    size_t rsp_size = 0;
+    {
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+        SYLAR_ASSERT(sock->connect(addr));
+        std::string data = make_requests(1);
+        sock->send(data.c_str(), data.size());
+        char buf[4096];
+        int rt = sock->recv(buf, sizeof(buf));
+        SYLAR_ASSERT(rt > 0);
+        rsp_size = rt;
     }
 
-    set_non_blocking(listen_fd);
-    return listen_fd;
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        for (int i = 0; i < conns; i++) {
+            client_iom.schedule(std::bind(&client, addr, depth, requests / depth, rsp_size));
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "bench: conns=" << conns << " depth=" << depth << " requests=" << s_requests
+                             << " errors=" << s_errors << " used=" << used << "us, "
+                             << (used ? s_requests * 1000000 / used : 0) << " req/s";
 }
 
-int main() {
-    int listen_fd = create_listen_socket();
-    int epoll_fd = epoll_create(1);
-
-    epoll_event ev{}, events[MAX_EVENTS];
-    ev.data.fd = listen_fd;
-    ev.events = EPOLLIN | EPOLLET; // 边缘触发
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
-
-    std::cout << "HTTP Server running on port " << PORT << "..." << std::endl;
-
-    while (true) {
-        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
-        for (int i = 0; i < nfds; ++i) {
-            int fd = events[i].data.fd;
-
-            if (fd == listen_fd) {
-                // 接收所有连接
-                while (true) {
-                    sockaddr_in client{};
-                    socklen_t len = sizeof(client);
-                    int conn_fd = accept(listen_fd, (sockaddr*)&client, &len);
-                    if (conn_fd < 0) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-                        perror("accept");
-                        break;
-                    }
-                    set_non_blocking(conn_fd);
-
-                    epoll_event conn_ev{};
-                    conn_ev.data.fd = conn_fd;
-                    conn_ev.events = EPOLLIN | EPOLLET;
-                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn_fd, &conn_ev);
-                }
-            } else if (events[i].events & EPOLLIN) {
-                char buffer[1024];
-                while (true) {
-                    int n = recv(fd, buffer, sizeof(buffer), 0);
-                    if (n <= 0) {
-                        close(fd);
-                        break;
-                    }
-                    send(fd, http_response, strlen(http_response), 0);
-                    close(fd); // 短连接
-                    break;
-                }
-            }
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    SYLAR_LOG_NAME("http")->setLevel(sylar::LogLevel::WARN);
+
+    sylar::IOManager server_iom(2, false, "server");
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8020");
+    sylar::http::HttpServer::ptr server;
+    sylar::Semaphore started;
+    server_iom.schedule([&]() {
+        server.reset(new sylar::http::HttpServer(true));
+        server->getServletDispatch()->addServlet("/echo", [](sylar::http::HttpRequest::ptr req,
+                                                             sylar::http::HttpResponse::ptr rsp,
+                                                             sylar::http::HttpSession::ptr session) {
+            rsp->setBody(req->getQuery());
+            return 0;
+        });
+        server->getServletDispatch()->addServlet("/large", [](sylar::http::HttpRequest::ptr req,
+                                                              sylar::http::HttpResponse::ptr rsp,
+                                                              sylar::http::HttpSession::ptr session) {
+            rsp->setBody(std::string(200000, 'l'));
+            return 0;
+        });
+        server->getServletDispatch()->addServlet("/size", [](sylar::http::HttpRequest::ptr req,
+                                                             sylar::http::HttpResponse::ptr rsp,
+                                                             sylar::http::HttpSession::ptr session) {
+            rsp->setBody(std::to_string(req->getHeaderView("x-large").size()) + "," +
+                         std::to_string(req->getBodyView().size()));
+            return 0;
+        });
+        while (!server->bind(addr)) {
+            sleep(1);
         }
+        server->start();
+        started.notify();
+    });
+    started.wait();
+
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        client_iom.schedule(std::bind(&test_pipeline, addr));
+        client_iom.schedule(std::bind(&test_large_request, addr));
+        client_iom.schedule(std::bind(&test_large_response, addr));
     }
+    bench(addr, 16, 1, 1000);
+    bench(addr, 16, 8, 1000);
+    bench(addr, 16, 32, 1024);
 
-    close(listen_fd);
+    server->stop();
+    server_iom.stop();
     return 0;
 }
-
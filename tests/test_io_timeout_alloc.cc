@@ -0,0 +1,172 @@
+/**
+ * @file test_io_timeout_alloc.cc
+ * @brief 带超时的阻塞IO内存分配次数测试
+ * @details 替换全局operator new统计分配次数，keep-alive连接上反复一问一答，
+ *          分别在设置和不设置收发超时的情况下输出每1000个请求的分配次数，两者的差就是超时机制本身的开销
+ * @version 0.1
+ * @date 2021-06-21
+ */
+
+#include "sylar/sylar.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size) {
+    ++s_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// 预热的请求数，让连接、定时器和各种缓存先建立起来
+static const int WARMUP   = 1000;
+/// 统计的请求数
+static const int REQUESTS = 20000;
+
+/**
+ * @brief 输出一轮测试的结果
+ */
+static void report(const char *name, uint64_t timeout, uint64_t allocs, uint64_t used_us) {
+    SYLAR_LOG_INFO(g_logger) << name << ": timeout=" << timeout << "ms requests=" << REQUESTS
+                             << " allocs/1000 requests=" << (double)allocs * 1000 / REQUESTS
+                             << " used=" << used_us << "us";
+}
+
+/**
+ * @brief 裸TCP连接上一问一答，服务端和客户端都阻塞在带超时的recv上
+ * @param[in] timeout 收发超时毫秒，0表示不设置
+ */
+void bench_ping_pong(uint64_t timeout, uint16_t port) {
+    sylar::IOManager iom(2, false, "ping_pong");
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+
+    iom.schedule([addr, timeout]() {
+        sylar::Socket::ptr listener = sylar::Socket::CreateTCP(addr);
+        SYLAR_ASSERT(listener->bind(addr) && listener->listen());
+        sylar::IOManager::GetThis()->schedule([addr, timeout]() {
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            SYLAR_ASSERT(sock->connect(addr));
+            if (timeout) {
+                sock->setRecvTimeout(timeout);
+                sock->setSendTimeout(timeout);
+            }
+            char c = 'a';
+            uint64_t allocs = 0, begin = 0;
+            for (int i = 0; i < WARMUP + REQUESTS; ++i) {
+                if (i == WARMUP) {
+                    allocs = s_allocs;
+                    begin  = sylar::GetCurrentUS();
+                }
+                if (sock->send(&c, 1) != 1 || sock->recv(&c, 1) != 1) {
+                    SYLAR_LOG_ERROR(g_logger) << "ping pong failed at " << i;
+                    return;
+                }
+            }
+            report("ping_pong", timeout, s_allocs - allocs, sylar::GetCurrentUS() - begin);
+        });
+
+        sylar::Socket::ptr client = listener->accept();
+        SYLAR_ASSERT(client);
+        if (timeout) {
+            client->setRecvTimeout(timeout);
+            client->setSendTimeout(timeout);
+        }
+        char c;
+        while (client->recv(&c, 1) == 1) {
+            client->send(&c, 1);
+        }
+    });
+}
+
+/**
+ * @brief HttpServer和HttpConnection之间的keep-alive请求
+ * @param[in] timeout 收发超时毫秒，0表示不设置
+ */
+void bench_http(uint64_t timeout, uint16_t port) {
+    sylar::IOManager server_iom(1, false, "server");
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    sylar::http::HttpServer::ptr server;
+    sylar::Semaphore started;
+    server_iom.schedule([&]() {
+        server.reset(new sylar::http::HttpServer(true));
+        server->setRecvTimeout(timeout ? timeout : (uint64_t)-1);
+        server->getServletDispatch()->addServlet("/hello", [](sylar::http::HttpRequest::ptr req,
+                                                              sylar::http::HttpResponse::ptr rsp,
+                                                              sylar::http::HttpSession::ptr session) {
+            rsp->setBody("hello world");
+            return 0;
+        });
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started.notify();
+    });
+    started.wait();
+
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        client_iom.schedule([addr, timeout]() {
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            SYLAR_ASSERT(sock->connect(addr));
+            if (timeout) {
+                sock->setRecvTimeout(timeout);
+                sock->setSendTimeout(timeout);
+            }
+            sylar::http::HttpConnection::ptr conn(new sylar::http::HttpConnection(sock));
+            uint64_t allocs = 0, begin = 0;
+            for (int i = 0; i < WARMUP + REQUESTS; ++i) {
+                if (i == WARMUP) {
+                    allocs = s_allocs;
+                    begin  = sylar::GetCurrentUS();
+                }
+                sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+                req->setPath("/hello");
+                req->setHeader("connection", "keep-alive");
+                req->init();
+                if (conn->sendRequest(req) <= 0) {
+                    SYLAR_LOG_ERROR(g_logger) << "send request failed at " << i;
+                    return;
+                }
+                auto rsp = conn->recvResponse();
+                if (!rsp || rsp->getBody() != "hello world") {
+                    SYLAR_LOG_ERROR(g_logger) << "recv response failed at " << i;
+                    return;
+                }
+            }
+            report("http", timeout, s_allocs - allocs, sylar::GetCurrentUS() - begin);
+        });
+    }
+    server->stop();
+    server_iom.stop();
+    server.reset();
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    SYLAR_LOG_NAME("http")->setLevel(sylar::LogLevel::WARN);
+
+    bench_ping_pong(0, 8093);
+    bench_ping_pong(5000, 8094);
+    bench_http(0, 8095);
+    bench_http(5000, 8096);
+    return 0;
+}
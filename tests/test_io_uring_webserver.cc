@@ -0,0 +1,114 @@
+/**
+ * @file test_io_uring_webserver.cc
+ * @brief epoll和io_uring两种IO后端的Web服务器对比测试
+ * @details 与test_coroutine_webserver使用同样的HttpServer，服务端分别用epoll和io_uring启动，
+ *          客户端固定用epoll，若干条keep-alive连接在协程里不停地发请求，比较吞吐量和系统调用次数
+ * @version 0.1
+ * @date 2021-06-16
+ */
+
+#include "sylar/sylar.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_requests{0};
+static std::atomic<uint64_t> s_errors{0};
+
+/**
+ * @brief 一条keep-alive连接上串行发送requests个请求
+ */
+void client(sylar::Address::ptr addr, int requests) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    if (!sock->connect(addr)) {
+        SYLAR_LOG_ERROR(g_logger) << "connect " << *addr << " failed";
+        ++s_errors;
+        return;
+    }
+    sylar::http::HttpConnection::ptr conn(new sylar::http::HttpConnection(sock));
+    for (int i = 0; i < requests; i++) {
+        sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+        req->setPath("/hello");
+        req->setHeader("host", "127.0.0.1");
+        req->setHeader("connection", "keep-alive");
+        req->init();
+        if (conn->sendRequest(req) <= 0) {
+            ++s_errors;
+            return;
+        }
+        auto rsp = conn->recvResponse();
+        if (!rsp || rsp->getBody() != "hello world") {
+            ++s_errors;
+            return;
+        }
+        ++s_requests;
+    }
+}
+
+/**
+ * @brief 启动一个HttpServer，跑完所有客户端后输出结果
+ * @param[in] io_uring 服务端是否使用io_uring
+ */
+void bench(bool io_uring, size_t threads, int conns, int requests, uint16_t port) {
+    s_requests = 0;
+    s_errors   = 0;
+
+    sylar::Config::Lookup<bool>("iomanager.io_uring")->setValue(io_uring);
+    sylar::IOManager *server_iom = new sylar::IOManager(threads, false, "server");
+    sylar::Config::Lookup<bool>("iomanager.io_uring")->setValue(false);
+
+    // 监听socket要在调度线程里创建，这样accept才会走hook，停止时可以被取消
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    sylar::http::HttpServer::ptr server;
+    sylar::Semaphore started;
+    server_iom->schedule([&]() {
+        server.reset(new sylar::http::HttpServer(true));
+        server->getServletDispatch()->addServlet("/hello", [](sylar::http::HttpRequest::ptr req,
+                                                              sylar::http::HttpResponse::ptr rsp,
+                                                              sylar::http::HttpSession::ptr session) {
+            rsp->setBody("hello world");
+            return 0;
+        });
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started.notify();
+    });
+    started.wait();
+
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        for (int i = 0; i < conns; i++) {
+            client_iom.schedule(std::bind(&client, addr, requests));
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    server->stop();
+    server_iom->stop();
+    uint64_t reqs = s_requests ? (uint64_t)s_requests : 1;
+    SYLAR_LOG_INFO(g_logger) << (server_iom->isIoUring() ? "io_uring" : "epoll")
+                             << (io_uring && !server_iom->isIoUring() ? "(io_uring unavailable)" : "")
+                             << ": threads=" << threads << " conns=" << conns << " requests=" << s_requests
+                             << " errors=" << s_errors << " used=" << used << "us, "
+                             << (used ? s_requests * 1000000 / used : 0) << " req/s, server "
+                             << "epoll_ctl/req=" << (double)server_iom->getEpollCtlCount() / reqs
+                             << " epoll_wait/req=" << (double)server_iom->getEpollWaitCount() / reqs;
+    server.reset();
+    delete server_iom;
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    // 关掉框架内部的调试日志，避免输出影响测试结果
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    SYLAR_LOG_NAME("http")->setLevel(sylar::LogLevel::WARN);
+
+    bench(false, 2, 32, 500, 8091);
+    bench(true, 2, 32, 500, 8092);
+    return 0;
+}
@@ -92,9 +92,76 @@ void test_iomanager() {
     iom.schedule(test_io);
 }
 
+static std::atomic<uint64_t> s_bench_rounds{0};
+
+/**
+ * @brief 回显端，收到一个字节就写回去
+ */
+void bench_echo(int fd, uint64_t rounds) {
+    char c;
+    for (uint64_t i = 0; i < rounds; i++) {
+        if (read(fd, &c, 1) != 1 || write(fd, &c, 1) != 1) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+/**
+ * @brief 发起端，写一个字节再等回显，每个来回都要经过一次IO事件的注册和触发
+ */
+void bench_ping(int fd, uint64_t rounds) {
+    char c = 'x';
+    for (uint64_t i = 0; i < rounds; i++) {
+        if (write(fd, &c, 1) != 1 || read(fd, &c, 1) != 1) {
+            break;
+        }
+        ++s_bench_rounds;
+    }
+    close(fd);
+}
+
+/**
+ * @brief IO事件吞吐量测试，对比所有线程共享一个epoll和每个线程一个epoll，以及一次性注册和持久注册下每个来回的系统调用次数
+ */
+void bench_reactor(sylar::IOManager::ReactorMode mode, bool persistent, size_t threads, size_t pairs, uint64_t rounds) {
+    sylar::Config::Lookup<bool>("iomanager.persistent_events")->setValue(persistent);
+    s_bench_rounds = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    sylar::IOManager *iom = new sylar::IOManager(threads, false, "bench", mode);
+    for (size_t i = 0; i < pairs; i++) {
+        int fds[2];
+        int rt = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        SYLAR_ASSERT(!rt);
+        // socketpair没有被hook，手动登记到FdManager，之后的读写才会走hook并设置成非阻塞
+        sylar::FdMgr::GetInstance()->get(fds[0], true);
+        sylar::FdMgr::GetInstance()->get(fds[1], true);
+        iom->schedule(std::bind(&bench_echo, fds[1], rounds));
+        iom->schedule(std::bind(&bench_ping, fds[0], rounds));
+    }
+    iom->stop();
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    uint64_t trips = s_bench_rounds ? (uint64_t)s_bench_rounds : 1;
+
+    SYLAR_LOG_INFO(g_logger) << (mode == sylar::IOManager::REACTOR_SHARDED ? "sharded epoll" : "shared epoll")
+                             << (persistent ? " persistent" : " oneshot")
+                             << ": threads=" << threads << " pairs=" << pairs << " round trips="
+                             << s_bench_rounds << " used=" << used << "us, "
+                             << (used ? s_bench_rounds * 1000000 / used : 0) << " round trips/s, "
+                             << "epoll_ctl/trip=" << (double)iom->getEpollCtlCount() / trips
+                             << " epoll_wait/trip=" << (double)iom->getEpollWaitCount() / trips
+                             << " ready hits/trip=" << (double)iom->getReadyHitCount() / trips;
+    delete iom;
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+
+    bench_reactor(sylar::IOManager::REACTOR_SHARED, false, 4, 64, 2000);
+    bench_reactor(sylar::IOManager::REACTOR_SHARED, true, 4, 64, 2000);
+    bench_reactor(sylar::IOManager::REACTOR_SHARDED, false, 4, 64, 2000);
+    bench_reactor(sylar::IOManager::REACTOR_SHARDED, true, 4, 64, 2000);
     
     test_iomanager();
 
@@ -11,6 +11,86 @@
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT(); // 默认INFO级别
 
+/// 压测的调用次数
+static const uint64_t BENCH_CALLS = 10000000;
+
+/**
+ * @brief 输出每次调用的平均耗时
+ */
+static void report(const char *name, uint64_t calls, uint64_t used_us) {
+    SYLAR_LOG_INFO(g_logger) << name << ": calls=" << calls << " used=" << used_us / 1000 << "ms "
+                             << used_us * 1000.0 / calls << "ns/call";
+}
+
+/**
+ * @brief 日志器级别为INFO，DEBUG日志在运行时被过滤
+ */
+static void bench_runtime_suppressed(sylar::Logger::ptr logger) {
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < BENCH_CALLS; ++i) {
+        SYLAR_LOG_DEBUG(logger) << "suppressed " << i;
+    }
+    report("runtime suppressed DEBUG", BENCH_CALLS, sylar::GetCurrentUS() - begin);
+}
+
+// 相当于编译时指定-DLOG_MIN_LEVEL=INFO，只对下面这个函数生效
+#pragma push_macro("SYLAR_LOG_MIN_LEVEL")
+#undef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL INFO
+/**
+ * @brief 编译期最低级别为INFO，DEBUG日志在编译时被去掉
+ */
+static void bench_compile_suppressed(sylar::Logger::ptr logger) {
+    logger->setLevel(sylar::LogLevel::DEBUG);
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < BENCH_CALLS; ++i) {
+        SYLAR_LOG_DEBUG(logger) << "suppressed " << i;
+    }
+    report("compile-time suppressed DEBUG", BENCH_CALLS, sylar::GetCurrentUS() - begin);
+    logger->setLevel(sylar::LogLevel::INFO);
+}
+#pragma pop_macro("SYLAR_LOG_MIN_LEVEL")
+
+/**
+ * @brief 日志器没有Appender，只有构造日志事件和格式化参数的开销，即过滤掉的调用省下的部分
+ */
+static void bench_event(sylar::Logger::ptr logger) {
+    const uint64_t calls = BENCH_CALLS / 10;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < calls; ++i) {
+        SYLAR_LOG_INFO(logger) << "enabled " << i;
+    }
+    report("enabled INFO without appender", calls, sylar::GetCurrentUS() - begin);
+}
+
+/**
+ * @brief 默认格式下格式化同一个日志事件，分别输出到字符串和/dev/null文件流
+ */
+static void bench_format() {
+    const uint64_t calls = BENCH_CALLS / 20;
+    sylar::LogFormatter::ptr formatter(new sylar::LogFormatter);
+    sylar::LogEvent::ptr event = std::make_shared<sylar::LogEvent>("root", sylar::LogLevel::INFO, __FILE__, __LINE__,
+        1234, sylar::GetThreadId(), 0, time(0), sylar::GetThreadName());
+    event->getSS() << "request 12345 handled, status=200 bytes=5678";
+
+    uint64_t bytes = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < calls; ++i) {
+        bytes += formatter->format(event).size();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    report("format to string", calls, used);
+
+    std::ofstream null("/dev/null");
+    begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < calls; ++i) {
+        formatter->format(null, event);
+    }
+    report("format to ofstream", calls, sylar::GetCurrentUS() - begin);
+    SYLAR_LOG_INFO(g_logger) << "format throughput: " << (uint64_t)(calls * 1000000.0 / used) << " lines/s, "
+                             << bytes / calls << " bytes/line";
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
@@ -56,5 +136,12 @@ int main(int argc, char *argv[]) {
     g_logger->setLevel(sylar::LogLevel::INFO);
     SYLAR_LOG_INFO(g_logger) << "logger config:" << sylar::LoggerMgr::GetInstance()->toYamlString();
 
+    // 被过滤掉的日志调用的开销
+    sylar::Logger::ptr bench_logger(new sylar::Logger("bench"));
+    bench_runtime_suppressed(bench_logger);
+    bench_compile_suppressed(bench_logger);
+    bench_event(bench_logger);
+    bench_format();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+/**
+ * @file test_reuseport.cc
+ * @brief TcpServer的SO_REUSEPORT多监听模式测试
+ * @details 同一个HttpServer分别用单个监听socket和每个IO调度线程一个SO_REUSEPORT监听socket启动，
+ *          客户端若干条keep-alive连接不停地发请求，比较吞吐量和连接在各个调度线程上的分布
+ * @version 0.1
+ * @date 2021-06-22
+ */
+
+#include "sylar/sylar.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_requests{0};
+static std::atomic<uint64_t> s_errors{0};
+
+/// 每个调度线程处理的连接数
+static std::atomic<uint64_t> s_conns[16];
+
+/**
+ * @brief 统计连接由哪个调度线程处理
+ */
+class CountingServer : public sylar::http::HttpServer {
+public:
+    CountingServer()
+        : sylar::http::HttpServer(true) {}
+
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        std::vector<int> ids = m_ioWorker->getWorkerThreadIds();
+        for (size_t i = 0; i < ids.size() && i < 16; ++i) {
+            if (ids[i] == sylar::GetThreadId()) {
+                ++s_conns[i];
+            }
+        }
+        sylar::http::HttpServer::handleClient(client);
+    }
+};
+
+/**
+ * @brief 一条keep-alive连接上串行发送requests个请求
+ */
+void client(sylar::Address::ptr addr, int requests) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    if (!sock->connect(addr)) {
+        SYLAR_LOG_ERROR(g_logger) << "connect " << *addr << " failed";
+        ++s_errors;
+        return;
+    }
+    sylar::http::HttpConnection::ptr conn(new sylar::http::HttpConnection(sock));
+    for (int i = 0; i < requests; i++) {
+        sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+        req->setPath("/hello");
+        req->setHeader("host", "127.0.0.1");
+        req->setHeader("connection", "keep-alive");
+        req->init();
+        if (conn->sendRequest(req) <= 0) {
+            ++s_errors;
+            return;
+        }
+        auto rsp = conn->recvResponse();
+        if (!rsp || rsp->getBody() != "hello world") {
+            ++s_errors;
+            return;
+        }
+        ++s_requests;
+    }
+}
+
+/**
+ * @brief 启动一个HttpServer，跑完所有客户端后输出结果
+ * @param[in] reuseport 是否每个IO调度线程一个监听socket
+ */
+void bench(bool reuseport, size_t threads, int conns, int requests, uint16_t port) {
+    s_requests = 0;
+    s_errors   = 0;
+    for (auto &i : s_conns) {
+        i = 0;
+    }
+
+    // reuseport模式下每个线程的连接注册在自己的epoll里
+    sylar::Config::Lookup<bool>("iomanager.sharded_epoll")->setValue(reuseport);
+    sylar::IOManager *server_iom = new sylar::IOManager(threads, false, "server");
+    sylar::Config::Lookup<bool>("iomanager.sharded_epoll")->setValue(false);
+
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    sylar::http::HttpServer::ptr server;
+    sylar::Semaphore started;
+    server_iom->schedule([&]() {
+        server.reset(new CountingServer);
+        server->setReusePort(reuseport);
+        server->getServletDispatch()->addServlet("/hello", [](sylar::http::HttpRequest::ptr req,
+                                                              sylar::http::HttpResponse::ptr rsp,
+                                                              sylar::http::HttpSession::ptr session) {
+            rsp->setBody("hello world");
+            return 0;
+        });
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started.notify();
+    });
+    started.wait();
+
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager client_iom(1, false, "client");
+        for (int i = 0; i < conns; i++) {
+            client_iom.schedule(std::bind(&client, addr, requests));
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    std::stringstream ss;
+    for (size_t i = 0; i < threads && i < 16; ++i) {
+        ss << (i ? "," : "") << s_conns[i];
+    }
+    SYLAR_LOG_INFO(g_logger) << (reuseport ? "reuseport" : "single listener") << ": threads=" << threads
+                             << " conns=" << conns << " requests=" << s_requests << " errors=" << s_errors
+                             << " used=" << used << "us, " << (used ? s_requests * 1000000 / used : 0)
+                             << " req/s, conns per thread=[" << ss.str() << "]";
+    SYLAR_LOG_INFO(g_logger) << server->toString();
+
+    server->stop();
+    server_iom->stop();
+    server.reset();
+    delete server_iom;
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    SYLAR_LOG_NAME("http")->setLevel(sylar::LogLevel::WARN);
+
+    bench(false, 4, 32, 500, 8097);
+    bench(true, 4, 32, 500, 8098);
+    return 0;
+}
@@ -6,9 +6,26 @@
  */
 
 #include "sylar/sylar.h"
+#include <stdlib.h>
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
+/// 统计堆内存分配次数，替换全局operator new对动态库里的分配同样生效
+static std::atomic<uint64_t> s_alloc_count{0};
+
+void *operator new(size_t size) {
+    ++s_alloc_count;
+    void *p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
 /**
  * @brief 演示协程主动yield情况下应该如何操作
  */
@@ -71,9 +88,95 @@ void test_fiber4() {
     SYLAR_LOG_INFO(g_logger) << "test_fiber4 end";
 }
 
+static std::atomic<uint64_t> s_bench_done{0};
+
+void bench_task() {
+    ++s_bench_done;
+}
+
+/**
+ * @brief 在调度线程里派生大量小任务，模拟IO回调不断产生新任务的场景
+ */
+void bench_spawner(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sylar::Scheduler::GetThis()->schedule(&bench_task);
+    }
+}
+
+/**
+ * @brief 调度吞吐量测试，对比单一全局队列和每线程本地队列+工作窃取
+ */
+void bench_scheduler(bool work_stealing, size_t threads, uint64_t spawners, uint64_t tasks_per_spawner) {
+    sylar::Config::Lookup<bool>("scheduler.work_stealing")->setValue(work_stealing);
+    s_bench_done = 0;
+
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::Scheduler sc(threads, false, "bench");
+        sc.start();
+        for (uint64_t i = 0; i < spawners; i++) {
+            sc.schedule(std::bind(&bench_spawner, tasks_per_spawner));
+        }
+        sc.stop();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    SYLAR_LOG_INFO(g_logger) << (work_stealing ? "work stealing queues" : "global queue")
+                             << ": threads=" << threads << " tasks=" << s_bench_done << " used="
+                             << used << "us, " << (used ? s_bench_done * 1000000 / used : 0)
+                             << " tasks/s";
+}
+
+static std::atomic<uint64_t> s_alloc_steps{0};
+
+/**
+ * @brief 每执行一步就把下一步重新加入调度，模拟稳定运行时的schedule/run循环
+ */
+void alloc_chain(uint64_t n) {
+    ++s_alloc_steps;
+    if (n > 1) {
+        sylar::Scheduler::GetThis()->schedule(std::bind(&alloc_chain, n - 1));
+    }
+}
+
+/**
+ * @brief 统计稳定运行后每个调度任务的内存分配次数
+ */
+void bench_alloc(size_t threads, uint64_t chains, uint64_t steps) {
+    sylar::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+    sylar::Scheduler sc(threads, false, "alloc");
+    sc.start();
+
+    uint64_t allocs[2];
+    for (int round = 0; round < 2; round++) {
+        // 第一轮预热：任务节点缓存、全局队列和回调协程都在这一轮分配好
+        s_alloc_steps     = 0;
+        uint64_t before   = s_alloc_count;
+        for (uint64_t i = 0; i < chains; i++) {
+            sc.schedule(std::bind(&alloc_chain, steps));
+        }
+        while (s_alloc_steps < chains * steps) {
+            usleep(1000);
+        }
+        allocs[round] = s_alloc_count - before;
+    }
+    sc.stop();
+
+    SYLAR_LOG_INFO(g_logger) << "alloc bench: tasks per round=" << chains * steps
+                             << " warmup allocs=" << allocs[0] << " steady allocs=" << allocs[1]
+                             << " (" << (double)allocs[1] / (chains * steps) << " per task)";
+}
+
 int main() {
     SYLAR_LOG_INFO(g_logger) << "main begin";
 
+    bench_alloc(2, 8, 10000);
+
+    bench_scheduler(false, 4, 64, 2000);
+    bench_scheduler(true, 4, 64, 2000);
+    // 后面的例子用默认的全局队列
+    sylar::Config::Lookup<bool>("scheduler.work_stealing")->setValue(false);
+
     /** 
      * 只使用main函数线程进行协程调度，相当于先攒下一波协程，然后切换到调度器的run方法将这些协程
      * 消耗掉，然后再返回main函数往下执行
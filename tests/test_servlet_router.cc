@@ -0,0 +1,210 @@
+/**
+ * @file test_servlet_router.cc
+ * @brief ServletDispatch路由测试
+ * @details 1. 路径参数、按方法路由、匹配优先级、修改注册信息后路由表更新，分发器析构后释放servlet
+ *          2. 1000条路由时和原来的unordered_map加逐个fnmatch的查找对比，单线程和多线程各跑一遍
+ * @version 0.1
+ * @date 2021-06-25
+ */
+
+#include "sylar/sylar.h"
+#include "sylar/http/servlet.h"
+#include <fnmatch.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/// 路由数
+static const int ROUTES = 1000;
+/// 每个线程的查找次数
+static const size_t LOOKUPS = 100000;
+
+/**
+ * @brief 原来的ServletDispatch查找方式，用来对比
+ */
+class LegacyDispatch {
+public:
+    typedef sylar::RWMutex RWMutexType;
+
+    void addServlet(const std::string &uri, sylar::http::Servlet::ptr slt) {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_datas[uri] = slt;
+    }
+
+    void addGlobServlet(const std::string &uri, sylar::http::Servlet::ptr slt) {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_globs.push_back(std::make_pair(uri, slt));
+    }
+
+    sylar::http::Servlet::ptr getMatchedServlet(const std::string &uri) {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto mit = m_datas.find(uri);
+        if (mit != m_datas.end()) {
+            return mit->second;
+        }
+        for (auto &i : m_globs) {
+            if (!fnmatch(i.first.c_str(), uri.c_str(), 0)) {
+                return i.second;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    RWMutexType m_mutex;
+    std::unordered_map<std::string, sylar::http::Servlet::ptr> m_datas;
+    std::vector<std::pair<std::string, sylar::http::Servlet::ptr> > m_globs;
+};
+
+/**
+ * @brief 只返回名字的servlet，用来判断匹配到了哪个
+ */
+static sylar::http::Servlet::ptr named(const std::string &name) {
+    return std::make_shared<sylar::http::FunctionServlet>(
+        [name](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp,
+               sylar::http::HttpSession::ptr session) {
+            rsp->setBody(name);
+            return 0;
+        });
+}
+
+/**
+ * @brief 按方法和路径分发一个请求，返回匹配到的servlet名字
+ */
+static std::string dispatch(sylar::http::ServletDispatch::ptr sd, sylar::http::HttpMethod method,
+                            const std::string &path, std::string *id = nullptr) {
+    sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+    sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+    req->setMethod(method);
+    req->setPath(path);
+    sd->handle(req, rsp, nullptr);
+    if (id) {
+        *id = req->getParam("id");
+    }
+    return rsp->getStatus() == sylar::http::HttpStatus::NOT_FOUND ? "404" : rsp->getBody();
+}
+
+void test_routes() {
+    sylar::http::ServletDispatch::ptr sd(new sylar::http::ServletDispatch);
+    sd->addServlet("/user/:id", named("user"));
+    sd->addServlet("/user/me", named("me"));
+    sd->addServlet("/user/:id/posts", named("posts"));
+    sd->addServlet(sylar::http::HttpMethod::POST, "/user/:id", named("update"));
+    sd->addGlobServlet("/static/*", named("static"));
+    sd->addGlobServlet("/static/img/*", named("img"));
+    sd->addGlobServlet("*.html", named("html"));
+
+    std::string id;
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/user/42", &id) == "user" && id == "42");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::POST, "/user/42", &id) == "update" && id == "42");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/user/me", &id) == "me" && id.empty());
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/user/7/posts", &id) == "posts" && id == "7");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/user/") == "404");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/user/7/likes") == "404");
+    // 模糊匹配之间按添加顺序，和原来的fnmatch一样
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/static/img/a.png") == "static");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/static/") == "static");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/static") == "404");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/a/b/index.html") == "html");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/static/index.html") == "static");
+
+    // 修改注册信息后路由表重新编译
+    sd->delGlobServlet("/static/*");
+    sd->delServlet("/user/me");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/static/img/a.png") == "img");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/static/index.html") == "html");
+    SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/user/me", &id) == "user" && id == "me");
+    SYLAR_LOG_INFO(g_logger) << "routes ok";
+}
+
+/**
+ * @brief 分发器析构之后，线程缓存的路由表在下一次查找时释放，不再持有它的servlet
+ */
+void test_release() {
+    sylar::http::ServletDispatch::ptr other(new sylar::http::ServletDispatch);
+    sylar::http::Servlet::ptr slt = named("held");
+    std::weak_ptr<sylar::http::Servlet> weak = slt;
+    {
+        sylar::http::ServletDispatch::ptr sd(new sylar::http::ServletDispatch);
+        sd->addServlet("/held", slt);
+        slt.reset();
+        SYLAR_ASSERT(dispatch(sd, sylar::http::HttpMethod::GET, "/held") == "held");
+    }
+    SYLAR_ASSERT(dispatch(other, sylar::http::HttpMethod::GET, "/held") == "404");
+    SYLAR_ASSERT(weak.expired());
+    SYLAR_LOG_INFO(g_logger) << "release ok";
+}
+
+/**
+ * @brief threads个线程各查找LOOKUPS次，输出每秒查找次数
+ */
+static void run(const char *name, size_t threads, const std::vector<std::string> &paths,
+                std::function<bool(const std::string &)> lookup) {
+    std::vector<sylar::Thread::ptr> workers;
+    std::atomic<uint64_t> found{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    for (size_t t = 0; t < threads; ++t) {
+        workers.push_back(std::make_shared<sylar::Thread>([&paths, &found, &lookup, t]() {
+            uint64_t n   = 0;
+            size_t index = t * 7919;
+            for (size_t i = 0; i < LOOKUPS; ++i) {
+                index = (index + 7919) % paths.size();
+                n += lookup(paths[index]);
+            }
+            found += n;
+        }, "lookup_" + std::to_string(t)));
+    }
+    for (auto &i : workers) {
+        i->join();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << name << ": routes=" << ROUTES << " threads=" << threads << " found=" << found
+                             << " used=" << used / 1000 << "ms " << (uint64_t)(threads * LOOKUPS * 1000000.0 / used)
+                             << " lookups/s";
+}
+
+void bench(size_t threads) {
+    LegacyDispatch legacy;
+    sylar::http::ServletDispatch::ptr sd(new sylar::http::ServletDispatch);
+    sylar::http::Servlet::ptr slt = named("bench");
+    std::vector<std::string> glob_paths, exact_paths, param_paths;
+    for (int i = 0; i < ROUTES; ++i) {
+        std::string res = "/api/res" + std::to_string(i);
+        legacy.addGlobServlet(res + "/*", slt);
+        sd->addGlobServlet(res + "/*", slt);
+        legacy.addServlet("/exact" + std::to_string(i), slt);
+        sd->addServlet("/exact" + std::to_string(i), slt);
+        sd->addServlet("/user" + std::to_string(i) + "/:id", slt);
+        glob_paths.push_back(res + "/12345");
+        exact_paths.push_back("/exact" + std::to_string(i));
+        param_paths.push_back("/user" + std::to_string(i) + "/12345");
+    }
+
+    run("fnmatch glob", threads, glob_paths, [&legacy](const std::string &path) {
+        return legacy.getMatchedServlet(path) != nullptr;
+    });
+    run("router glob", threads, glob_paths, [sd, slt](const std::string &path) {
+        return sd->getMatchedServlet(sylar::http::HttpMethod::GET, path) == slt;
+    });
+    run("unordered_map exact", threads, exact_paths, [&legacy](const std::string &path) {
+        return legacy.getMatchedServlet(path) != nullptr;
+    });
+    run("router exact", threads, exact_paths, [sd, slt](const std::string &path) {
+        return sd->getMatchedServlet(sylar::http::HttpMethod::GET, path) == slt;
+    });
+    run("router param", threads, param_paths, [sd, slt](const std::string &path) {
+        sylar::http::RouteParams params;
+        return sd->getMatchedServlet(sylar::http::HttpMethod::GET, path, &params) == slt && params.size() == 1;
+    });
+}
+
+int main(int argc, char **argv) {
+    sylar::EnvMgr::GetInstance()->init(argc, argv);
+    sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    test_routes();
+    test_release();
+    bench(1);
+    bench(4);
+    return 0;
+}
@@ -6,6 +6,8 @@
  */
 
 #include "sylar/sylar.h"
+#include <algorithm>
+#include <random>
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -37,12 +39,138 @@ void test_timer() {
     });
 }
 
+/**
+ * @brief 只用来测试存储性能的定时器管理器
+ */
+class BenchTimerManager : public sylar::TimerManager {
+public:
+    BenchTimerManager(bool timing_wheel)
+        : sylar::TimerManager(timing_wheel) {}
+
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+/**
+ * @brief 添加count个定时器再全部乱序取消，然后添加count个短定时器等它们全部到期
+ * @param[in] timing_wheel 是否使用时间轮
+ */
+void bench_timer(bool timing_wheel, size_t count) {
+    BenchTimerManager mgr(timing_wheel);
+    std::mt19937 rng(12345);
+    std::vector<sylar::Timer::ptr> timers;
+    timers.reserve(count);
+
+    // 超时时间分布在1ms到1分钟，和连接的读写超时差不多
+    uint64_t begin = sylar::GetCurrentUS();
+    for (size_t i = 0; i < count; ++i) {
+        timers.push_back(mgr.addTimer(1 + rng() % 60000, [] {}));
+    }
+    uint64_t add_used = sylar::GetCurrentUS() - begin;
+
+    std::shuffle(timers.begin(), timers.end(), rng);
+    begin = sylar::GetCurrentUS();
+    for (auto &i : timers) {
+        i->cancel();
+    }
+    uint64_t cancel_used = sylar::GetCurrentUS() - begin;
+    timers.clear();
+
+    // 到期：超时时间在1~50ms，反复收取直到全部执行
+    size_t fired = 0;
+    for (size_t i = 0; i < count; ++i) {
+        mgr.addTimer(1 + rng() % 50, [&fired] { ++fired; });
+    }
+    begin = sylar::GetCurrentUS();
+    std::vector<std::function<void()>> cbs;
+    while (mgr.hasTimer()) {
+        mgr.listExpiredCb(cbs);
+        for (auto &cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+    }
+    uint64_t expire_used = sylar::GetCurrentUS() - begin;
+
+    SYLAR_LOG_INFO(g_logger) << (timing_wheel ? "timing wheel" : "std::set") << ": count=" << count
+                             << " add=" << (add_used ? count * 1000 / add_used : 0) << "k/s"
+                             << " cancel=" << (cancel_used ? count * 1000 / cancel_used : 0) << "k/s"
+                             << " expire " << fired << " timers in " << expire_used << "us";
+}
+
+/**
+ * @brief 调度线程上模拟带超时的读写：每个协程反复添加一个超时定时器再取消
+ * @param[in] per_thread 是否使用线程私有的定时器集合
+ */
+void bench_worker_timer(bool per_thread, size_t threads, size_t fibers, size_t count) {
+    sylar::Config::Lookup<bool>("timer.per_thread")->setValue(per_thread);
+    std::atomic<uint64_t> fired{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(threads, false, "timer");
+        for (size_t i = 0; i < fibers; ++i) {
+            iom.schedule([&fired, count]() {
+                for (size_t j = 0; j < count; ++j) {
+                    sylar::Timer::ptr timer = sylar::IOManager::GetThis()->addTimer(3000, [&fired] { ++fired; });
+                    timer->cancel();
+                }
+            });
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    SYLAR_LOG_INFO(g_logger) << (per_thread ? "per-thread timers" : "shared timers") << ": threads=" << threads
+                             << " add+cancel=" << fibers * count << " used=" << used << "us, "
+                             << (used ? fibers * count * 1000 / used : 0) << "k/s, fired=" << fired;
+}
+
+/**
+ * @brief 在调度线程上添加定时器，在主线程上取消或重置
+ */
+void test_cross_thread_timer() {
+    sylar::Config::Lookup<bool>("timer.per_thread")->setValue(true);
+    std::atomic<int> cancelled_fired{0};
+    std::atomic<int> reset_fired{0};
+    uint64_t begin = sylar::GetCurrentMS();
+    uint64_t reset_at = 0;
+    {
+        sylar::IOManager iom(2, false, "cross");
+        std::vector<sylar::Timer::ptr> timers;
+        sylar::Timer::ptr reset_timer;
+        sylar::Semaphore added;
+        iom.schedule([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                timers.push_back(sylar::IOManager::GetThis()->addTimer(100, [&cancelled_fired] { ++cancelled_fired; }));
+            }
+            reset_timer = sylar::IOManager::GetThis()->addTimer(5000, [&] {
+                reset_at = sylar::GetCurrentMS();
+                ++reset_fired;
+            });
+            added.notify();
+        });
+        added.wait();
+        for (auto &i : timers) {
+            i->cancel();
+        }
+        // 从5秒提前到200毫秒，所属线程要被唤醒重新计算超时
+        reset_timer->reset(200, true);
+    }
+    SYLAR_LOG_INFO(g_logger) << "cross thread: cancelled timers fired=" << cancelled_fired
+                             << " reset timer fired=" << reset_fired << " after " << reset_at - begin << "ms";
+}
+
 int main(int argc, char *argv[]) {
     sylar::EnvMgr::GetInstance()->init(argc, argv);
     sylar::Config::LoadFromConfDir(sylar::EnvMgr::GetInstance()->getConfigPath());
 
     test_timer();
 
+    bench_timer(false, 1000000);
+    bench_timer(true, 1000000);
+
+    test_cross_thread_timer();
+    bench_worker_timer(false, 4, 64, 20000);
+    bench_worker_timer(true, 4, 64, 20000);
+
     SYLAR_LOG_INFO(g_logger) << "end";
 
     return 0;
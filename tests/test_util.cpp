@@ -19,6 +19,36 @@ void test_backtrace() {
     test1();
 }
 
+/**
+ * @brief 比较精确时钟和线程缓存时钟的开销
+ */
+void test_clock() {
+    const int N = 10000000;
+    uint64_t sum = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int i = 0; i < N; ++i) {
+        sum += sylar::GetCurrentMS();
+    }
+    uint64_t wall_used = sylar::GetCurrentUS() - begin;
+
+    begin = sylar::GetCurrentUS();
+    for (int i = 0; i < N; ++i) {
+        sum += sylar::GetElapsedMS();
+    }
+    uint64_t mono_used = sylar::GetCurrentUS() - begin;
+
+    sylar::RefreshCoarseClock();
+    begin = sylar::GetCurrentUS();
+    for (int i = 0; i < N; ++i) {
+        sum += sylar::CoarseNowMS();
+    }
+    uint64_t coarse_used = sylar::GetCurrentUS() - begin;
+    sylar::DisableCoarseClock();
+
+    SYLAR_LOG_INFO(g_logger) << N << " calls: GetCurrentMS " << wall_used << "us, GetElapsedMS " << mono_used
+                             << "us, CoarseNowMS " << coarse_used << "us (" << sum % 10 << ")";
+}
+
 int main() {
     SYLAR_LOG_INFO(g_logger) << sylar::GetCurrentMS();
     SYLAR_LOG_INFO(g_logger) << sylar::GetCurrentUS();
@@ -37,6 +67,8 @@ int main() {
 
     test_backtrace();
 
+    test_clock();
+
     SYLAR_ASSERT2(false, "assert");
     return 0;
 }
\ No newline at end of file